@@ -0,0 +1,234 @@
+/**
+ * Bit-sliced engine for the on/off/mode transition table.
+ *
+ * The state of 64 zones lives in one word per state bit. A round of
+ * events becomes one mask per event type plus a mask of guard results,
+ * and every row of the transition table is applied to 64 zones at once
+ * with a handful of bitwise operations.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "pool.hpp"
+
+namespace bitslice {
+enum EVENT : uint8_t { TURN_ON, TURN_OFF, CHANGE_ON_TIME, EVENTS };
+enum ACTION : uint8_t { NO_ACTION, SET_START, TOGGLE_TIMESLOT };
+
+struct row {
+  bool from_on;
+  EVENT event;
+  bool guarded;
+  ACTION action;
+  bool to_on;
+};
+
+// Same rows as the ctrl::fsm transition table
+// clang-format off
+inline constexpr row table[] = {
+  // FROM ON -- EVENT --------- GUARD -- ACTION ----------- TO ON //
+  {  false,     TURN_ON,        true,    SET_START,         true  },
+  {  true,      TURN_OFF,       false,   NO_ACTION,         false },
+  {  true,      TURN_ON,        true,    SET_START,         true  },
+  {  true,      CHANGE_ON_TIME, false,   TOGGLE_TIMESLOT,   true  },
+};
+// clang-format on
+
+// Mirrors turn_on_guard for start times given as minutes past midnight
+inline bool start_valid(uint16_t minute) { return minute < 24 * 60; }
+
+struct counters {
+  uint64_t batches;
+  uint64_t events;
+  uint64_t handled;
+};
+
+// Everything that survives a restart, plain words that can live anywhere
+struct state {
+  std::span<uint64_t> on;
+  std::span<uint64_t> short_slot;
+  std::span<uint16_t> start;
+  counters *count;
+};
+
+class engine {
+ public:
+  explicit engine(size_t zones)
+      : engine(zones, {}) {}
+
+  // Runs on 'external' storage, e.g. a mapped file, when it is given
+  engine(size_t zones, state external)
+      : zones_{zones},
+        words_{(zones + 63) / 64},
+        owned_words_(external.count ? 0 : 2 * words_),
+        owned_start_(external.count ? 0 : zones),
+        on_{external.count ? external.on : std::span(owned_words_).first(words_)},
+        short_{external.count ? external.short_slot : std::span(owned_words_).last(words_)},
+        start_{external.count ? external.start : std::span(owned_start_)},
+        count_{external.count ? external.count : &owned_count_},
+        guard_(words_),
+        started_(words_) {
+    for (auto &m : mask_)
+      m.resize(words_);
+  }
+  engine(const engine &) = delete;
+  engine &operator=(const engine &) = delete;
+
+  size_t size() const { return zones_; }
+  const counters &count() const { return *count_; }
+  bool is_on(size_t z) const { return on_[z / 64] >> (z % 64) & 1; }
+  bool is_short(size_t z) const { return short_[z / 64] >> (z % 64) & 1; }
+  uint16_t start(size_t z) const { return start_[z]; }
+
+  size_t count_on() const {
+    size_t count = 0;
+    for (const auto w : on_)
+      count += __builtin_popcountll(w);
+    return count;
+  }
+
+  size_t memory_bytes() const {
+    return sizeof(*this) + (on_.size() + short_.size() + guard_.capacity() +
+                            started_.capacity() + by_zone_.capacity() + spare_.capacity()) *
+                               sizeof(uint64_t) +
+           words_ * EVENTS * sizeof(uint64_t) + start_.size() * sizeof(uint16_t) +
+           touched_.capacity() * sizeof(size_t) + starts_.capacity() * sizeof(staged_start);
+  }
+
+  // Applies events in order per zone, returns the number handled
+  size_t process_events(std::span<const zones::event> events) {
+    by_zone_.clear();
+    for (size_t i = 0; i < events.size(); ++i)
+      if (events[i].zone < zones_ && events[i].type < EVENTS)
+        by_zone_.push_back(uint64_t(events[i].zone) << 32 | i);
+    std::sort(by_zone_.begin(), by_zone_.end());
+
+    // Round n takes the n-th event of every zone, one event per zone
+    size_t handled = 0;
+    std::vector<uint64_t> &rest = spare_;
+    while (!by_zone_.empty()) {
+      rest.clear();
+      for (size_t i = 0; i < by_zone_.size(); ++i) {
+        const bool repeat = i > 0 && (by_zone_[i] >> 32) == (by_zone_[i - 1] >> 32);
+        if (repeat)
+          rest.push_back(by_zone_[i]);
+        else
+          stage(events[uint32_t(by_zone_[i])]);
+      }
+      handled += apply();
+      by_zone_.swap(rest);
+    }
+    ++count_->batches;
+    count_->events += events.size();
+    count_->handled += handled;
+    return handled;
+  }
+
+  // Event masks for every zone at once, one bit per zone, no payloads.
+  // turn_on events start at 'minute' for every zone in the mask.
+  size_t apply_masks(std::span<const uint64_t> turn_on,
+                     std::span<const uint64_t> turn_off,
+                     std::span<const uint64_t> change_on_time,
+                     uint16_t minute) {
+    const uint64_t guard = start_valid(minute) ? ~uint64_t(0) : 0;
+    size_t handled       = 0;
+    for (size_t w = 0; w < words_; ++w) {
+      const uint64_t ev[EVENTS] = {turn_on[w], turn_off[w], change_on_time[w]};
+      uint64_t started{};
+      handled += __builtin_popcountll(step(w, ev, guard, started));
+      for (; started; started &= started - 1)
+        start_[w * 64 + __builtin_ctzll(started)] = minute;
+    }
+    ++count_->batches;
+    count_->handled += handled;
+    return handled;
+  }
+
+ private:
+  // Runs every table row over word 'w', returns the zones that transitioned
+  uint64_t step(size_t w, const uint64_t (&ev)[EVENTS], uint64_t guard, uint64_t &started) {
+    const uint64_t on = on_[w];
+    uint64_t next_on  = on;
+    uint64_t handled  = 0;
+    for (const auto &r : table) {
+      uint64_t fire = (r.from_on ? on : ~on) & ev[r.event];
+      if (r.guarded)
+        fire &= guard;
+      handled |= fire;
+      next_on = r.to_on ? (next_on | fire) : (next_on & ~fire);
+      if (r.action == TOGGLE_TIMESLOT)
+        short_[w] ^= fire;
+      else if (r.action == SET_START)
+        started |= fire;
+    }
+    on_[w] = next_on;
+    return handled;
+  }
+
+  void stage(const zones::event &e) {
+    const auto w = e.zone / 64;
+    const auto b = uint64_t(1) << (e.zone % 64);
+    if (!dirty(w))
+      touched_.push_back(w);
+    mask_[e.type][w] |= b;
+    if (e.type == TURN_ON) {
+      if (start_valid(e.arg))
+        guard_[w] |= b;
+      starts_.push_back({e.zone, e.arg});
+    }
+  }
+
+  bool dirty(size_t w) const {
+    return mask_[TURN_ON][w] | mask_[TURN_OFF][w] | mask_[CHANGE_ON_TIME][w];
+  }
+
+  size_t apply() {
+    size_t handled = 0;
+    for (const auto w : touched_) {
+      const uint64_t ev[EVENTS] = {mask_[TURN_ON][w], mask_[TURN_OFF][w], mask_[CHANGE_ON_TIME][w]};
+      handled += __builtin_popcountll(step(w, ev, guard_[w], started_[w]));
+      mask_[TURN_ON][w] = mask_[TURN_OFF][w] = mask_[CHANGE_ON_TIME][w] = 0;
+    }
+
+    // Payloads are only written for zones whose turn_on fired
+    for (const auto &s : starts_)
+      if (started_[s.zone / 64] >> (s.zone % 64) & 1)
+        start_[s.zone] = s.minute;
+    starts_.clear();
+
+    for (const auto w : touched_)
+      guard_[w] = started_[w] = 0;
+    touched_.clear();
+    return handled;
+  }
+
+  struct staged_start {
+    uint32_t zone;
+    uint16_t minute;
+  };
+
+  size_t zones_;
+  size_t words_;
+  std::vector<uint64_t> owned_words_;
+  std::vector<uint16_t> owned_start_;
+  counters owned_count_{};
+  std::span<uint64_t> on_;
+  std::span<uint64_t> short_;
+  std::span<uint16_t> start_;
+  counters *count_;
+
+  // Staging for one round
+  std::vector<uint64_t> mask_[EVENTS];
+  std::vector<uint64_t> guard_;
+  std::vector<uint64_t> started_;
+  std::vector<size_t> touched_;
+  std::vector<staged_start> starts_;
+  std::vector<uint64_t> by_zone_;
+  std::vector<uint64_t> spare_;
+};
+}  // namespace bitslice
@@ -0,0 +1,119 @@
+/**
+ * Hardware bring-up as a set of tasks run concurrently.
+ *
+ * Each task initializes one bus or backend and names the tasks it has
+ * to wait for, e.g. two backends on the same I2C bus run one after the
+ * other while a SPI chain and a DMX universe come up next to them.
+ * Dependencies can only name tasks added before, which keeps the plan
+ * free of cycles. run() returns once every task finished, nothing
+ * drives an output before that, and reports each task's time to ready.
+ *
+ *   bringup::plan plan;
+ *   plan.add("gpio", {}, [] { return setup_pins(); });
+ *   plan.add("i2c:/dev/i2c-1:0x20", {"gpio"}, [] { return probe(); });
+ *   plan.run();
+ **/
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bringup {
+using clock = std::chrono::steady_clock;
+
+struct report {
+  std::string name;
+  std::vector<std::string> after;
+  bool ok{false};
+  bool skipped{false};         // A task it waited for failed
+  clock::duration waited{};    // Until its dependencies were ready
+  clock::duration ready_at{};  // Since run() started
+};
+
+class plan {
+ public:
+  // Returns false if 'after' names a task not added yet
+  bool add(std::string name, std::vector<std::string> after, std::function<bool()> init) {
+    std::vector<size_t> deps;
+    for (const auto &a : after) {
+      size_t i = 0;
+      while (i < tasks_.size() && tasks_[i].report.name != a)
+        ++i;
+      if (i == tasks_.size()) {
+        printf("  Bring-up %s: waits for unknown task %s\n", name.c_str(), a.c_str());
+        return false;
+      }
+      deps.push_back(i);
+    }
+    tasks_.push_back({{std::move(name), std::move(after)}, std::move(deps), std::move(init)});
+    return true;
+  }
+
+  // Runs every task on its own thread as soon as the tasks it waits for
+  // are ready. True if all of them succeeded.
+  bool run() {
+    const auto start = clock::now();
+    std::vector<std::shared_future<bool>> done;
+    std::vector<std::thread> threads;
+    for (auto &t : tasks_) {
+      std::promise<bool> ready;
+      done.push_back(ready.get_future().share());
+      std::vector<std::shared_future<bool>> deps;
+      for (const auto d : t.deps)
+        deps.push_back(done[d]);
+      threads.emplace_back([&t, start, deps = std::move(deps), ready = std::move(ready)]() mutable {
+        bool deps_ok = true;
+        for (auto &d : deps)
+          deps_ok &= d.get();
+        t.report.waited   = clock::now() - start;
+        t.report.skipped  = !deps_ok;
+        t.report.ok       = deps_ok && t.init();
+        t.report.ready_at = clock::now() - start;
+        ready.set_value(t.report.ok);
+      });
+    }
+    for (auto &th : threads)
+      th.join();
+    total_ = clock::now() - start;
+
+    bool ok = true;
+    for (const auto &t : tasks_) {
+      const auto &r = t.report;
+      printf("  Bring-up %s: %s at %.1fms, waited %.1fms\n",
+             r.name.c_str(),
+             r.skipped ? "skipped" : r.ok ? "ready" : "failed",
+             ms(r.ready_at),
+             ms(r.waited));
+      ok &= r.ok;
+    }
+    printf("  Bring-up of %zu tasks took %.1fms\n", tasks_.size(), ms(total_));
+    return ok;
+  }
+
+  std::vector<report> reports() const {
+    std::vector<report> out;
+    for (const auto &t : tasks_)
+      out.push_back(t.report);
+    return out;
+  }
+  clock::duration total() const { return total_; }
+
+  static double ms(clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+ private:
+  struct task {
+    bringup::report report;
+    std::vector<size_t> deps;
+    std::function<bool()> init;
+  };
+
+  std::vector<task> tasks_;
+  clock::duration total_{};
+};
+}  // namespace bringup
@@ -0,0 +1,202 @@
+/**
+ * Busy-poll input mode for installations that need microsecond response.
+ *
+ * The calling thread is pinned to one core and spins on the memory-mapped
+ * GPIO level register, with a CPU pause hint between reads. Edges are
+ * handled inline on the spinning thread, an edge that drives an output
+ * is timed up to the written output as well. After at most 'max_spin'
+ * the spin yields the core and returns so the caller can service
+ * everything else.
+ *
+ * Any file of at least one page can stand in for /dev/gpiomem, so the
+ * mode runs off the Pi against a register file toggled by another
+ * process or thread. Only such a stand-in is created when missing, a
+ * missing device is an error.
+ **/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace hw {
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+struct busy_stats {
+  uint64_t reads{};
+  uint64_t edges{};
+  uint64_t yields{};
+  uint64_t max_latency_ns{};
+  uint64_t latency_log2_ns[40]{};  // Read gap before each edge plus handling
+
+  uint64_t driven{};  // Edges that wrote an output
+  uint64_t max_output_ns{};
+  uint64_t output_log2_ns[40]{};  // Read gap before each such edge up to the write
+
+  uint64_t percentile_ns(double q) const { return percentile(latency_log2_ns, edges, q); }
+  uint64_t output_percentile_ns(double q) const { return percentile(output_log2_ns, driven, q); }
+
+ private:
+  static uint64_t percentile(const uint64_t (&log2)[40], uint64_t count, double q) {
+    uint64_t seen{};
+    for (size_t i = 0; i < 40; ++i) {
+      seen += log2[i];
+      if (count && seen >= q * count)
+        return uint64_t(1) << i;
+    }
+    return 0;
+  }
+};
+
+class busy_poller {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  struct config {
+    std::string path{"/dev/gpiomem"};
+    std::vector<unsigned> pins;  // BCM numbers, bit i of levels() is pins[i]
+    int cpu{-1};
+    std::chrono::microseconds max_spin{1000};
+    bool create{false};  // 'path' is a register file, made if missing
+  };
+
+  ~busy_poller() {
+    if (regs_)
+      munmap((void *)regs_, map_size);
+  }
+
+  bool open(config cfg) {
+    cfg_ = std::move(cfg);
+    if (cfg_.pins.size() > 32 ||
+        std::any_of(cfg_.pins.begin(), cfg_.pins.end(), [](unsigned p) { return p > 53; })) {
+      printf("  Busy poll: pins must be up to 32 BCM numbers below 54\n");
+      return false;
+    }
+
+    const int fd = ::open(cfg_.path.c_str(), O_RDWR | O_CLOEXEC | (cfg_.create ? O_CREAT : 0), 0644);
+    if (fd < 0)
+      return fail("open");
+    // A fresh fake register file starts out as one zeroed page
+    struct stat st {};
+    fstat(fd, &st);
+    if (cfg_.create && S_ISREG(st.st_mode) && st.st_size < off_t(map_size) &&
+        ftruncate(fd, map_size) != 0) {
+      ::close(fd);
+      return fail("ftruncate");
+    }
+    void *map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+      return fail("mmap");
+    regs_ = static_cast<volatile uint32_t *>(map);
+
+    for (const auto pin : cfg_.pins)
+      mask_[pin / 32] |= 1u << (pin % 32);
+    last_[0] = regs_[gplev0] & mask_[0];
+    last_[1] = regs_[gplev0 + 1] & mask_[1];
+
+    if (cfg_.cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cfg_.cpu, &set);
+      if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        return fail("sched_setaffinity");
+    }
+    printf("  Busy polling %s on cpu %d\n", cfg_.path.c_str(), cfg_.cpu);
+    return true;
+  }
+
+  // Current input levels, bit i is pins[i]
+  uint32_t levels() const {
+    const uint32_t bank[2] = {regs_[gplev0], regs_[gplev0 + 1]};
+    uint32_t out{};
+    for (size_t i = 0; i < cfg_.pins.size(); ++i)
+      out |= (bank[cfg_.pins[i] / 32] >> (cfg_.pins[i] % 32) & 1) << i;
+    return out;
+  }
+
+  // Spins until 'max_spin' has passed, on_edge() runs inline on every
+  // change of the watched pins. It may return whether it wrote an
+  // output. Yields the core before returning.
+  template <class Fn>
+  void spin(Fn &&on_edge) {
+    const auto start = clock::now();
+    auto last_read   = start;
+    for (;;) {
+      const uint32_t bank0 = regs_[gplev0] & mask_[0];
+      const uint32_t bank1 = regs_[gplev0 + 1] & mask_[1];
+      const auto now       = clock::now();
+      ++stats_.reads;
+
+      if (bank0 != last_[0] || bank1 != last_[1]) {
+        last_[0] = bank0;
+        last_[1] = bank1;
+        bool drove = false;
+        if constexpr (std::is_same_v<decltype(on_edge()), bool>)
+          drove = on_edge();
+        else
+          on_edge();
+
+        // The edge came at some point since the previous read
+        const auto ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     clock::now() - last_read)
+                                     .count());
+        record(stats_.latency_log2_ns, stats_.max_latency_ns, ns);
+        ++stats_.edges;
+        if (drove) {
+          record(stats_.output_log2_ns, stats_.max_output_ns, ns);
+          ++stats_.driven;
+        }
+      }
+      if (now - start >= cfg_.max_spin)
+        break;
+      last_read = now;
+      cpu_relax();
+    }
+    // The cap is only a cap if others get the core
+    sched_yield();
+    ++stats_.yields;
+  }
+
+  const busy_stats &stats() const { return stats_; }
+
+ private:
+  static constexpr size_t map_size = 4096;
+  static constexpr size_t gplev0   = 0x34 / 4;
+
+  static void record(uint64_t (&log2)[40], uint64_t &max, uint64_t ns) {
+    ++log2[std::min(39, 64 - __builtin_clzll(ns | 1))];
+    max = std::max(max, ns);
+  }
+
+  bool fail(const char *what) {
+    printf("  Busy poll %s: %s failed: %s\n", cfg_.path.c_str(), what, strerror(errno));
+    return false;
+  }
+
+  config cfg_;
+  volatile uint32_t *regs_{};
+  uint32_t mask_[2]{};
+  uint32_t last_[2]{};
+  busy_stats stats_;
+};
+}  // namespace hw
@@ -0,0 +1,31 @@
+/**
+ * CRC-32 (IEEE 802.3) used to validate persisted data.
+ **/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace checksum {
+inline constexpr auto crc32_table = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}();
+
+// Chain calls by passing the previous result as 'crc'
+inline uint32_t crc32(const void *data, size_t len, uint32_t crc = 0) {
+  const auto *p = static_cast<const uint8_t *>(data);
+  crc           = ~crc;
+  for (size_t i = 0; i < len; ++i)
+    crc = crc32_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+}  // namespace checksum
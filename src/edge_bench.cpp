@@ -0,0 +1,196 @@
+/**
+ * Edge latency of the busy-poll input mode against a fake register file.
+ *
+ * A thread toggles BCM 2 in the GPIO level register of a mapped file and
+ * stamps the time of each toggle. The poller spins on the same file as
+ * the controller's --busy-poll does and takes the latency of every edge
+ * from that stamp. The next toggle waits for the previous edge, so every
+ * edge must be seen. Pin the two with --cpu and --toggle-cpu to separate
+ * cores, sharing one core measures the scheduler.
+ *
+ * With --controller the same file drives the on/off input of a busy
+ * polling light_controller, each toggle switches its light. Nine in ten
+ * toggles must reach the light pin, the controller's edge to pin times
+ * are reported and their median must stay below --max-us.
+ *
+ *   edge_bench [--edges=N] [--cpu=N] [--toggle-cpu=N] [--spin-us=US] [--file=PATH]
+ *              [--controller=PATH] [--port=PORT] [--max-us=US]
+ **/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "busypoll.hpp"
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             hw::busy_poller::clock::now().time_since_epoch())
+      .count();
+}
+
+int main(int argc, char *argv[]) {
+  auto args        = std::vector<std::string>(argv, argv + argc);
+  const auto edges = std::stoul(option(args, "edges").value_or("10000"));
+  const auto path  = option(args, "file").value_or("edge_bench.gpio");
+  const int cpu    = std::stoi(option(args, "cpu").value_or("-1"));
+  const int other  = std::stoi(option(args, "toggle-cpu").value_or("-1"));
+
+  hw::busy_poller poller;
+  hw::busy_poller::config cfg{.path = path, .pins = {2}, .cpu = cpu};
+  cfg.max_spin = std::chrono::microseconds(std::stoul(option(args, "spin-us").value_or("1000")));
+  cfg.create   = true;
+  if (!poller.open(cfg))
+    return 1;
+  const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  void *map    = fd < 0 ? MAP_FAILED : mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (map == MAP_FAILED) {
+    printf("  Mapping %s failed\n", path.c_str());
+    return 1;
+  }
+  auto *gplev0 = static_cast<volatile uint32_t *>(map) + 0x34 / 4;
+  *gplev0      = 0;
+
+  std::atomic<int64_t> stamp{0};
+  std::atomic<size_t> seen{0};
+  std::thread toggler([&] {
+    if (other >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(other, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    for (size_t e = 0; e < edges; ++e) {
+      while (seen.load(std::memory_order_acquire) < e)
+        std::this_thread::yield();
+      stamp.store(now_ns(), std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      *gplev0 = *gplev0 ^ (1u << 2);
+    }
+  });
+
+  std::vector<int64_t> latency;
+  latency.reserve(edges);
+  uint32_t level = 0;
+  const auto end = now_ns() + int64_t(edges) * 10'000'000 + 1'000'000'000;
+  while (latency.size() < edges && now_ns() < end) {
+    poller.spin([&] {
+      const auto at = now_ns();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const auto levels = poller.levels();
+      if (levels == level)
+        return;
+      level = levels;
+      latency.push_back(at - stamp.load(std::memory_order_relaxed));
+      seen.store(latency.size(), std::memory_order_release);
+    });
+  }
+  seen.store(edges);
+  toggler.join();
+
+  std::sort(latency.begin(), latency.end());
+  auto pct = [&](double q) { return latency.empty() ? 0.0 : latency[size_t(q * (latency.size() - 1))] / 1e3; };
+  const auto &st = poller.stats();
+  printf("  %zu of %zu edges seen, %llu reads, %llu yields\n",
+         latency.size(),
+         size_t(edges),
+         (unsigned long long)st.reads,
+         (unsigned long long)st.yields);
+  printf("  Toggle to handler: p50 %.2f us, p99 %.2f us, max %.2f us\n", pct(0.5), pct(0.99), pct(1.0));
+  printf("  Poller histogram: p50 <%.2f us, p99 <%.2f us\n",
+         st.percentile_ns(0.5) / 1e3,
+         st.percentile_ns(0.99) / 1e3);
+  if (latency.size() != edges) {
+    printf("  FAILED: edges were missed\n");
+    return 1;
+  }
+  const auto controller = option(args, "controller");
+  if (!controller) {
+    munmap(map, 4096);
+    remove(path.c_str());
+    return 0;
+  }
+
+  // The light is scheduled on from this minute, every edge of the
+  // on/off input turns it off or on again
+  const auto port   = uint16_t(std::stoul(option(args, "port").value_or("18390")));
+  const auto max_us = std::stod(option(args, "max-us").value_or("500"));
+  const auto now    = std::time(nullptr);
+  std::tm local{};
+  localtime_r(&now, &local);
+  char start[8];
+  snprintf(start, sizeof(start), "%02d:%02d", local.tm_hour, local.tm_min);
+  *gplev0 = 0;
+  harness::child lc;
+  if (!lc.start({*controller,
+                 start,
+                 "--http=" + std::to_string(port),
+                 "--busy-poll=-1",
+                 "--gpio-file=" + path,
+                 "--vgpio=edge_bench.sock"},
+                "edge_bench.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see edge_bench.log\n");
+    return 1;
+  }
+  // Two toggles the controller was not scheduled in between make no
+  // edge, or one it finds undone when it samples the inputs. On a shared
+  // core that happens now and then.
+  for (size_t e = 0; e < edges; ++e) {
+    *gplev0 = *gplev0 ^ (1u << 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  const auto body = harness::request(port, "GET", "/inputs/busy");
+  munmap(map, 4096);
+  remove(path.c_str());
+  remove("edge_bench.sock");
+  const auto at     = body ? body->find("edge_to_output_ns") : std::string::npos;
+  const auto sensed = body ? harness::number(*body, "edges").value_or(0) : 0;
+  const auto driven = body ? harness::number(*body, "driven").value_or(0) : 0;
+  if (at == std::string::npos) {
+    printf("  FAILED: GET /inputs/busy failed\n");
+    return 1;
+  }
+  const auto times = std::string_view(*body).substr(at);
+  const auto p50   = harness::number(times, "p50").value_or(0) / 1e3;
+  printf("  Controller, edge to light pin: %.0f of %.0f edges seen of %zu, p50 <%.2f us, p99 <%.2f us, "
+         "max %.2f us\n",
+         driven,
+         sensed,
+         size_t(edges),
+         p50,
+         harness::number(times, "p99").value_or(0) / 1e3,
+         harness::number(times, "max").value_or(0) / 1e3);
+  if (driven < edges * 9 / 10) {
+    printf("  FAILED: edges did not reach the light pin\n");
+    return 1;
+  }
+  if (p50 > max_us) {
+    printf("  FAILED: half the edges took longer than %.0f us to reach the pin\n", max_us);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * Fixed-size event envelopes and a jump table back to typed events.
+ *
+ * An envelope is 16 trivially copyable bytes: the event's index in a
+ * dispatcher's event list, a zone, a timestamp and a 16-bit inline
+ * payload. It fits ring buffers, sockets and replay files as is. Each
+ * event type packs into and unpacks from the payload through a codec,
+ * the default codec carries nothing.
+ *
+ *   using dispatch = events::dispatcher<turn_on, turn_off>;
+ *   const auto env = dispatch::wrap(turn_off{}, zone, now);
+ *   dispatch::process(sm, env);  // sm.process_event(turn_off{})
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+namespace events {
+struct envelope {
+  uint16_t type;
+  uint16_t arg;  // Inline payload, e.g. the start minute of a turn_on
+  uint32_t zone;
+  uint64_t time_ns;
+};
+static_assert(sizeof(envelope) == 16 && std::is_trivially_copyable_v<envelope>);
+
+template <class Event>
+struct codec {
+  static uint16_t pack(const Event &) { return 0; }
+  static Event unpack(uint16_t) { return Event{}; }
+};
+
+template <class... Events>
+struct dispatcher {
+  static constexpr uint16_t types = sizeof...(Events);
+
+  // Position of Event in the list, its envelope type
+  template <class Event>
+  static constexpr uint16_t tag = [] {
+    static_assert((std::is_same_v<Event, Events> || ...), "not in the event list");
+    uint16_t i = 0;
+    ((std::is_same_v<Event, Events> ? false : ++i) && ...);
+    return i;
+  }();
+
+  template <class Event>
+  static envelope wrap(const Event &e, uint32_t zone = 0, uint64_t time_ns = 0) {
+    return {tag<Event>, codec<Event>::pack(e), zone, time_ns};
+  }
+
+  // One indirect call through a table built per state machine type,
+  // false for unknown types and events the machine did not handle
+  template <class SM>
+  static bool process(SM &sm, const envelope &env) {
+    using handler                     = bool (*)(SM &, uint16_t);
+    static constexpr handler table[] = {&unwrap<SM, Events>...};
+    return env.type < types && table[env.type](sm, env.arg);
+  }
+
+ private:
+  template <class SM, class Event>
+  static bool unwrap(SM &sm, uint16_t arg) {
+    return sm.process_event(codec<Event>::unpack(arg));
+  }
+};
+}  // namespace events
@@ -0,0 +1,190 @@
+/**
+ * Sunrise and sunset ramps stepped a frame at a time.
+ *
+ * A ramp follows a gamma curve approximated by straight segments. On
+ * entering a segment a channel gets a fixed-point step per frame, so a
+ * frame costs one addition per ramping channel. Channels that are not
+ * ramping cost nothing, and only values that changed at the output
+ * resolution are emitted.
+ *
+ *   fade::engine fades{channels, {.bits = 8}};
+ *   fades.start(3, 255, 30 * 60 * 44);  // 30 minutes at 44 Hz
+ *   fades.step([](size_t ch, uint16_t v) { dmx.set(ch, v); });
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace fade {
+struct config {
+  unsigned bits{8};   // Output resolution, up to 16
+  double gamma{2.2};  // Perceived brightness grows linearly in time
+};
+
+struct fade_stats {
+  uint64_t frames{};
+  uint64_t stepped{};  // Channel steps over all frames
+  uint64_t emitted{};
+  uint64_t started{};
+  uint64_t finished{};
+  uint64_t last_step_ns{};
+};
+
+class engine {
+ public:
+  static constexpr size_t segments = 16;
+
+  engine(size_t channels, config cfg = {}) : cfg_{cfg}, channels_(channels) {
+    cfg_.bits = std::clamp(cfg_.bits, 1u, 16u);
+    for (size_t k = 0; k <= segments; ++k)
+      curve_[k] = uint32_t(std::lround(std::pow(double(k) / segments, cfg_.gamma) * one));
+  }
+
+  size_t channels() const { return channels_.size(); }
+  size_t ramping() const { return active_.size(); }
+  const fade_stats &stats() const { return stats_; }
+  uint16_t max() const { return uint16_t((1u << cfg_.bits) - 1); }
+  uint16_t value(size_t ch) const { return channels_[ch].emitted; }
+  uint16_t target(size_t ch) const { return channels_[ch].to; }
+
+  // Jumps to 'value', ending any ramp. Emitted by the next step.
+  void set(size_t ch, uint16_t value) {
+    auto &c = channels_[ch];
+    stop(ch);
+    c.from = c.to = std::min(value, max());
+    c.fixed       = uint32_t(c.to) << shift();
+    c.frames      = 0;
+    emit_pending_.push_back(uint32_t(ch));
+  }
+
+  // Ramps from the current value to 'to' over 'frames' frames, down the
+  // mirrored curve when dimming. A ramp already there does nothing.
+  void start(size_t ch, uint16_t to, uint32_t frames) {
+    auto &c = channels_[ch];
+    to      = std::min(to, max());
+    if (c.to == to && (c.frames || c.fixed >> shift() == to))
+      return;
+    if (!frames) {
+      set(ch, to);
+      return;
+    }
+    c.from           = uint16_t(c.fixed >> shift());
+    c.to             = to;
+    c.segment_frames = std::max<uint32_t>(1, frames / segments);
+    c.segment        = 0;
+    enter(c);
+    if (c.slot == none) {
+      c.slot = uint32_t(active_.size());
+      active_.push_back(uint32_t(ch));
+    }
+    ++stats_.started;
+  }
+
+  // Advances every ramp by one frame, calls emit(channel, value) for
+  // each value that changed. Returns the number emitted.
+  template <class Emit>
+  size_t step(Emit &&emit) {
+    const auto start = std::chrono::steady_clock::now();
+    size_t emitted   = 0;
+    auto output    = [&](size_t ch, channel &c) {
+      const auto v = uint16_t(c.fixed >> shift());
+      if (v != c.emitted) {
+        c.emitted = v;
+        emit(ch, v);
+        ++emitted;
+      }
+    };
+    for (const auto ch : emit_pending_)
+      output(ch, channels_[ch]);
+    emit_pending_.clear();
+
+    stats_.stepped += active_.size();
+    for (size_t i = 0; i < active_.size();) {
+      const auto ch = active_[i];
+      auto &c       = channels_[ch];
+      c.fixed += uint32_t(c.delta);
+      if (--c.frames == 0) {
+        c.fixed = point(c, c.segment + 1);
+        if (++c.segment < segments) {
+          enter(c);
+        } else {
+          stop(ch);
+          ++stats_.finished;
+          output(ch, c);
+          continue;  // 'i' now holds the last active channel
+        }
+      }
+      output(ch, c);
+      ++i;
+    }
+    ++stats_.frames;
+    stats_.emitted += emitted;
+    stats_.last_step_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::steady_clock::now() - start)
+                                       .count());
+    return emitted;
+  }
+
+ private:
+  static constexpr uint32_t none = UINT32_MAX;
+  static constexpr uint32_t one  = 1u << 16;  // Curve values, 0 to 1
+
+  struct channel {
+    uint32_t fixed{};  // Value with shift() fraction bits
+    int32_t delta{};   // Per frame, same scale
+    uint32_t frames{};  // Left in the current segment
+    uint32_t segment_frames{};
+    uint32_t slot{none};  // Index in active_
+    uint16_t from{};
+    uint16_t to{};
+    uint16_t emitted{};
+    uint8_t segment{};
+  };
+
+  // Fraction bits, so that a 16 bit value still fits 32 bits
+  unsigned shift() const { return 32 - cfg_.bits - 1; }
+
+  // Value at breakpoint 'k' of the ramp, brightening follows the curve
+  // up and dimming follows it mirrored in time
+  uint32_t point(const channel &c, size_t k) const {
+    const bool up     = c.to >= c.from;
+    const auto span   = uint64_t(up ? c.to - c.from : c.from - c.to);
+    const auto shaped = up ? curve_[k] : one - curve_[segments - k];
+    const auto offset = uint32_t((span * shaped << shift()) >> 16);
+    const auto base   = uint32_t(c.from) << shift();
+    return up ? base + offset : base - offset;
+  }
+
+  void enter(channel &c) {
+    const auto start = c.segment ? c.fixed : (c.fixed = point(c, 0));
+    const auto end   = point(c, c.segment + 1u);
+    c.frames         = c.segment_frames;
+    c.delta          = int32_t((int64_t(end) - int64_t(start)) / int64_t(c.frames));
+  }
+
+  void stop(size_t ch) {
+    auto &c = channels_[ch];
+    if (c.slot == none)
+      return;
+    const auto last          = active_.back();
+    active_[c.slot]          = last;
+    channels_[last].slot     = c.slot;
+    active_.pop_back();
+    c.slot   = none;
+    c.frames = 0;
+  }
+
+  config cfg_;
+  std::array<uint32_t, segments + 1> curve_{};
+  std::vector<channel> channels_;
+  std::vector<uint32_t> active_;
+  std::vector<uint32_t> emit_pending_;
+  fade_stats stats_;
+};
+}  // namespace fade
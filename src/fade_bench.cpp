@@ -0,0 +1,101 @@
+/**
+ * Channels per frame per core of the fade engine against per-frame curves.
+ *
+ * Ramps --ramping of --channels channels from off to full over --frames
+ * frames, the rest hold still, and times every frame of the fade::engine
+ * next to recomputing each channel's gamma curve with std::pow every
+ * frame. From the mean frame time follow the channels one core steps
+ * within a frame at 44 and at 100 Hz. Every ramp must end on its target,
+ * the largest gap to the exact curve along the way is reported.
+ *
+ *   fade_bench [--channels=N] [--ramping=PERCENT] [--frames=N] [--bits=N]
+ **/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "fade.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  auto args           = std::vector<std::string>(argv, argv + argc);
+  const auto channels = std::stoul(option(args, "channels").value_or("10000"));
+  const auto percent  = std::stoul(option(args, "ramping").value_or("100"));
+  const auto frames   = uint32_t(std::stoul(option(args, "frames").value_or("4400")));
+  const auto bits     = unsigned(std::stoul(option(args, "bits").value_or("8")));
+  const auto ramping  = channels * std::min(percent, 100ul) / 100;
+
+  fade::engine fades{channels, {.bits = bits}};
+  const auto full = fades.max();
+  std::vector<uint16_t> out(channels), exact(channels);
+  for (size_t ch = 0; ch < ramping; ++ch)
+    fades.start(ch, full, frames);
+
+  // Engine, with the gap to the exact curve checked outside the timing
+  double engine_ns = 0;
+  int worst        = 0;
+  for (uint32_t f = 1; f <= frames; ++f) {
+    const auto start = std::chrono::steady_clock::now();
+    fades.step([&](size_t ch, uint16_t v) { out[ch] = v; });
+    engine_ns += since_ns(start);
+    if (f % 97 == 0 && ramping) {
+      const auto want = int(std::lround(std::pow(double(f) / frames, 2.2) * full));
+      worst           = std::max(worst, std::abs(int(out[0]) - want));
+    }
+  }
+
+  // Every ramping channel's curve recomputed every frame, each channel
+  // with a ramp length of its own as in the engine
+  std::vector<uint32_t> length(ramping, frames);
+  double curve_ns = 0;
+  for (uint32_t f = 1; f <= frames; ++f) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t ch = 0; ch < ramping; ++ch) {
+      const auto t = std::min(1.0, double(f) / length[ch]);
+      const auto v = uint16_t(std::lround(std::pow(t, 2.2) * full));
+      if (v != exact[ch])
+        exact[ch] = v;
+    }
+    curve_ns += since_ns(start);
+  }
+
+  size_t off_target = 0;
+  for (size_t ch = 0; ch < ramping; ++ch)
+    off_target += out[ch] != full || exact[ch] != full;
+
+  auto report = [&](const char *what, double ns) {
+    const auto per_frame = ns / frames;
+    const auto per_ch    = ramping ? per_frame / ramping : 0.0;
+    printf("  %-14s %9.0f ns per frame, %6.2f ns per ramping channel, "
+           "%10.0f channels at 44 Hz, %10.0f at 100 Hz\n",
+           what,
+           per_frame,
+           per_ch,
+           per_ch ? 1e9 / 44 / per_ch : 0.0,
+           per_ch ? 1e9 / 100 / per_ch : 0.0);
+  };
+  printf("  %zu channels, %zu ramping over %u frames, %u bits\n", size_t(channels), size_t(ramping), frames, bits);
+  report("fade::engine", engine_ns);
+  report("pow per frame", curve_ns);
+  printf("  Largest gap to the exact curve: %d of %u\n", worst, unsigned(full));
+  if (off_target) {
+    printf("  FAILED: %zu channels did not end on their target\n", off_target);
+    return 1;
+  }
+  return 0;
+}
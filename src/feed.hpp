@@ -0,0 +1,340 @@
+/**
+ * Push feed of state changes to any number of stream subscribers.
+ *
+ * Each published message is encoded once into a reference counted frame
+ * which every subscriber queue points at. A subscriber whose backlog is
+ * full loses its queue and is sent a fresh snapshot once it catches up.
+ * A message that does not fit a frame is not sent cut short: it is
+ * counted as oversized and every subscriber is resynced instead.
+ **/
+
+#pragma once
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "reactor.hpp"
+
+namespace feed {
+static constexpr size_t frame_size = 192;
+
+struct frame {
+  uint32_t refs{};
+  uint16_t size{};
+  char data[frame_size];
+};
+
+struct stats {
+  uint64_t published{};
+  uint64_t bytes_sent{};
+  uint64_t resyncs{};
+  uint64_t subscribers{};
+  uint64_t oversized{};
+};
+
+class publisher {
+ public:
+  // Writes the current state as one message, returns its length
+  using snapshot_fn = std::function<size_t(char *buf, size_t capacity)>;
+
+  publisher(io::reactor &reactor, size_t backlog, snapshot_fn snapshot)
+      : reactor_{reactor},
+        backlog_{backlog},
+        snapshot_{std::move(snapshot)},
+        frames_(backlog + 1) {
+    // Queues only ever hold the newest 'backlog' frames, plus one in flight
+    for (auto &f : frames_)
+      free_.push_back(&f);
+  }
+
+  ~publisher() {
+    for (auto &s : subs_)
+      if (s)
+        close(s->fd);
+    if (listen_fd_ >= 0)
+      close(listen_fd_);
+    if (!unix_path_.empty())
+      unlink(unix_path_.c_str());
+  }
+
+  // All digits listens on that loopback TCP port, anything else is a socket path
+  bool listen(const std::string &where) {
+    const bool is_port =
+        !where.empty() &&
+        where.find_first_not_of("0123456789") == std::string::npos;
+    if (is_port) {
+      listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd_ < 0)
+        return fail(where);
+      sockaddr_in addr{};
+      addr.sin_family      = AF_INET;
+      addr.sin_port        = htons(uint16_t(std::stoi(where)));
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      const int one        = 1;
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+        return fail(where);
+    } else {
+      listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd_ < 0)
+        return fail(where);
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      if (where.size() >= sizeof(addr.sun_path))
+        return fail(where);
+      std::strcpy(addr.sun_path, where.c_str());
+      unlink(addr.sun_path);
+      if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+        return fail(where);
+      unix_path_ = where;
+    }
+    if (::listen(listen_fd_, 128) < 0)
+      return fail(where);
+
+    reactor_.add(listen_fd_, EPOLLIN, [this](uint32_t) { accept_all(); });
+    printf("  Feed listening on %s\n", where.c_str());
+    return true;
+  }
+
+  // Encodes once, every subscriber shares the same frame
+  __attribute__((format(printf, 2, 3))) void publish(const char *fmt, ...) {
+    if (free_.empty())
+      evict_oldest_holders();
+    if (free_.empty()) {
+      // Resyncing subscribers still finishing older frames hold the rest
+      frames_.emplace_back();
+      free_.push_back(&frames_.back());
+    }
+    frame *f = free_.back();
+    free_.pop_back();
+
+    va_list args;
+    va_start(args, fmt);
+    const int n = vsnprintf(f->data, frame_size, fmt, args);
+    va_end(args);
+    if (n <= 0 || size_t(n) >= frame_size) {
+      free_.push_back(f);
+      ++stats_.oversized;
+      for (auto &s : subs_) {
+        if (!s || s->resync)
+          continue;
+        resync(*s);
+        if (!s->waiting)
+          flush(*s);
+      }
+      return;
+    }
+    f->size = uint16_t(n);
+    f->refs = 1;
+    ++stats_.published;
+
+    for (auto &s : subs_) {
+      if (!s || s->resync)
+        continue;
+      if (s->queue.size() - s->head == backlog_) {
+        resync(*s);
+        continue;
+      }
+      ++f->refs;
+      s->queue.push_back(f);
+      if (!s->waiting)
+        flush(*s);
+    }
+    release(f);
+  }
+
+  const feed::stats &stats() const { return stats_; }
+
+ private:
+  struct subscriber {
+    int fd{-1};
+    std::vector<frame *> queue;
+    size_t head{};
+    size_t offset{};
+    bool resync{true};
+    bool waiting{false};
+    size_t snapshot_size{};
+    size_t snapshot_sent{};
+    char snapshot[frame_size * 2];
+  };
+
+  bool fail(const std::string &where) {
+    printf("  Feed listen on %s failed: %s\n", where.c_str(), strerror(errno));
+    if (listen_fd_ >= 0)
+      close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  void accept_all() {
+    while (true) {
+      const int fd =
+          accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+        return;
+      const int sndbuf = 64 * 1024;
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+      std::erase(subs_, nullptr);
+      auto sub = std::make_unique<subscriber>();
+      sub->fd  = fd;
+      sub->queue.reserve(backlog_);
+      auto *s = sub.get();
+      subs_.push_back(std::move(sub));
+      ++stats_.subscribers;
+
+      // New subscribers start from a snapshot like resynced ones
+      reactor_.add(fd, EPOLLIN | EPOLLRDHUP, [this, s](uint32_t events) {
+        on_event(*s, events);
+      });
+      flush(*s);
+    }
+  }
+
+  void on_event(subscriber &s, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+      drop(s);
+      return;
+    }
+    if (events & EPOLLIN) {
+      // Subscribers have nothing to say, discard whatever they send
+      char sink[256];
+      if (read(s.fd, sink, sizeof(sink)) == 0) {
+        drop(s);
+        return;
+      }
+    }
+    if (events & EPOLLOUT)
+      flush(s);
+  }
+
+  void flush(subscriber &s) {
+    while (true) {
+      // The snapshot goes out once the frame on the wire is finished
+      if (s.resync && s.snapshot_size == 0 && s.head == s.queue.size()) {
+        s.queue.clear();
+        s.head          = 0;
+        s.snapshot_size = snapshot_(s.snapshot, sizeof(s.snapshot));
+        s.snapshot_sent = 0;
+        s.resync        = s.snapshot_size > 0;
+      }
+      if (s.snapshot_sent == s.snapshot_size && s.head == s.queue.size())
+        break;
+
+      iovec iov[16];
+      int n = 0;
+      if (s.snapshot_sent < s.snapshot_size)
+        iov[n++] = {s.snapshot + s.snapshot_sent,
+                    s.snapshot_size - s.snapshot_sent};
+      for (size_t i = s.head; i < s.queue.size() && n < 16; ++i) {
+        const size_t skip = (i == s.head) ? s.offset : 0;
+        iov[n++] = {s.queue[i]->data + skip, s.queue[i]->size - skip};
+      }
+
+      ssize_t sent = writev(s.fd, iov, n);
+      if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          return drop(s);
+        // Keep the queue compact while the subscriber lags behind
+        s.queue.erase(s.queue.begin(), s.queue.begin() + s.head);
+        s.head = 0;
+        return wait_writable(s, true);
+      }
+      stats_.bytes_sent += sent;
+
+      const size_t snap =
+          std::min(size_t(sent), s.snapshot_size - s.snapshot_sent);
+      s.snapshot_sent += snap;
+      sent -= snap;
+      if (snap > 0 && s.snapshot_sent == s.snapshot_size) {
+        s.snapshot_size = 0;
+        s.snapshot_sent = 0;
+        s.resync        = false;
+      }
+      while (sent > 0) {
+        frame *f          = s.queue[s.head];
+        const size_t part = std::min(size_t(sent), f->size - s.offset);
+        s.offset += part;
+        sent -= part;
+        if (s.offset == f->size) {
+          release(f);
+          ++s.head;
+          s.offset = 0;
+        }
+      }
+    }
+    s.queue.clear();
+    s.head = 0;
+    wait_writable(s, false);
+  }
+
+  void wait_writable(subscriber &s, bool on) {
+    if (s.waiting != on)
+      reactor_.modify(s.fd, EPOLLIN | EPOLLRDHUP | (on ? uint32_t(EPOLLOUT) : 0u));
+    s.waiting = on;
+  }
+
+  // Drops the backlog, the subscriber is sent a snapshot when writable
+  void resync(subscriber &s) {
+    const bool partial = s.offset > 0;
+    for (size_t i = s.head + (partial ? 1 : 0); i < s.queue.size(); ++i)
+      release(s.queue[i]);
+    if (partial) {
+      // Finish the frame on the wire first so the stream stays parseable
+      s.queue.resize(s.head + 1);
+    } else {
+      s.queue.clear();
+      s.head = 0;
+    }
+    s.resync = true;
+    ++stats_.resyncs;
+  }
+
+  void evict_oldest_holders() {
+    for (auto &s : subs_)
+      if (s && s->queue.size() - s->head >= backlog_)
+        resync(*s);
+  }
+
+  void drop(subscriber &s) {
+    for (size_t i = s.head; i < s.queue.size(); ++i)
+      release(s.queue[i]);
+    reactor_.remove(s.fd);
+    close(s.fd);
+    --stats_.subscribers;
+    // Slots are compacted on the next accept, 'subs_' may be iterated now
+    for (auto &p : subs_)
+      if (p.get() == &s)
+        p.reset();
+  }
+
+  void release(frame *f) {
+    if (--f->refs == 0)
+      free_.push_back(f);
+  }
+
+  io::reactor &reactor_;
+  size_t backlog_;
+  snapshot_fn snapshot_;
+  std::deque<frame> frames_;
+  std::vector<frame *> free_;
+  std::vector<std::unique_ptr<subscriber>> subs_;
+  int listen_fd_{-1};
+  std::string unix_path_;
+  feed::stats stats_;
+};
+}  // namespace feed
@@ -0,0 +1,165 @@
+/**
+ * Fan-out latency of the push feed for growing numbers of subscribers.
+ *
+ * Runs the controller with --feed on a loopback port, on a virtual GPIO
+ * chip nobody drives so that no input adds transitions, and for each count
+ * in --subscribers, connects that many subscribers and reads their
+ * snapshots. Then it flips the light off and on over HTTP and times each
+ * request until the last subscriber has the frame of that transition.
+ * Every subscriber must see every frame, in order and without a resync.
+ *
+ *   feed_bench CONTROLLER [--subscribers=1,100,1000] [--flips=N] [--port=PORT]
+ **/
+
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+struct subscriber {
+  int fd{-1};
+  std::string pending;
+  double last_seq{-1};
+  size_t frames{};
+  bool out_of_order{false};
+};
+
+// Reads whatever arrived, returns the number of complete lines taken
+static size_t take_lines(subscriber &s) {
+  char buf[4096];
+  for (ssize_t n; (n = recv(s.fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0;)
+    s.pending.append(buf, size_t(n));
+  size_t lines = 0;
+  for (size_t eol; (eol = s.pending.find('\n')) != std::string::npos; ++lines) {
+    const auto line = s.pending.substr(0, eol);
+    s.pending.erase(0, eol + 1);
+    const auto seq = harness::number(line, "seq").value_or(-1);
+    if (line.find("\"snapshot\":true") == std::string::npos) {
+      s.out_of_order |= s.last_seq >= 0 && seq != s.last_seq + 1;
+      ++s.frames;
+    }
+    s.last_seq = seq;
+  }
+  return lines;
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: feed_bench CONTROLLER [--subscribers=1,100,1000] [--flips=N] [--port=PORT]\n");
+    return 1;
+  }
+  const auto flips = std::stoul(option(args, "flips").value_or("200"));
+  const auto port  = uint16_t(std::stoul(option(args, "port").value_or("18340")));
+  const auto feed  = uint16_t(port + 1);
+  std::vector<size_t> counts;
+  for (std::string_view list = option(args, "subscribers").value_or("1,100,1000"); !list.empty();) {
+    const auto comma = list.find(',');
+    counts.push_back(std::stoul(std::string(list.substr(0, comma))));
+    list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+  }
+
+  harness::child lc;
+  if (!lc.start({args[1],
+                 "07:00",
+                 "--http=" + std::to_string(port),
+                 "--feed=" + std::to_string(feed),
+                 "--vgpio=feed_bench.sock"},
+                "feed_bench.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see feed_bench.log\n");
+    return 1;
+  }
+
+  bool failed  = false;
+  const int ep = epoll_create1(EPOLL_CLOEXEC);
+  for (const auto count : counts) {
+    std::vector<subscriber> subs(count);
+    for (size_t i = 0; i < count; ++i) {
+      subs[i].fd = harness::connect_local(feed);
+      epoll_event ev{};
+      ev.events   = EPOLLIN;
+      ev.data.u64 = i;
+      if (subs[i].fd < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, subs[i].fd, &ev) != 0) {
+        printf("  Connecting subscriber %zu failed\n", i);
+        return 1;
+      }
+    }
+
+    // Waits until every subscriber has 'lines' more lines, false on timeout
+    auto await = [&](std::vector<size_t> &left) {
+      size_t waiting = std::count_if(left.begin(), left.end(), [](size_t n) { return n > 0; });
+      const auto until = harness::monotonic_ns() + 5'000'000'000;
+      epoll_event events[64];
+      while (waiting && harness::monotonic_ns() < until) {
+        const int n = epoll_wait(ep, events, 64, 100);
+        for (int e = 0; e < n; ++e) {
+          const auto i = events[e].data.u64;
+          if (!left[i])
+            continue;
+          left[i] -= std::min(left[i], take_lines(subs[i]));
+          waiting -= left[i] == 0;
+        }
+      }
+      return waiting == 0;
+    };
+
+    std::vector<size_t> left(count, 1);
+    if (!await(left)) {
+      printf("  FAILED: not every subscriber got a snapshot\n");
+      return 1;
+    }
+    std::vector<double> latency;
+    for (size_t f = 0; f < flips; ++f) {
+      left.assign(count, 1);
+      const auto start = harness::monotonic_ns();
+      harness::request(port, "POST", f % 2 ? "/event/turn_on" : "/event/turn_off");
+      if (!await(left)) {
+        printf("  FAILED: flip %zu did not reach every subscriber\n", f);
+        failed = true;
+        break;
+      }
+      latency.push_back((harness::monotonic_ns() - start) / 1e3);
+    }
+
+    size_t broken = 0;
+    for (auto &s : subs) {
+      broken += s.out_of_order || s.frames != latency.size();
+      epoll_ctl(ep, EPOLL_CTL_DEL, s.fd, nullptr);
+      close(s.fd);
+    }
+    std::sort(latency.begin(), latency.end());
+    auto pct       = [&](double q) { return latency.empty() ? 0.0 : latency[size_t(q * (latency.size() - 1))]; };
+    const auto st  = harness::request(port, "GET", "/feed");
+    const auto rsy = st ? harness::number(*st, "resyncs").value_or(-1) : -1;
+    printf("  %4zu subscribers: request to last subscriber p50 %.0f us, p99 %.0f us, max %.0f us, %.0f resyncs\n",
+           count,
+           pct(0.5),
+           pct(0.99),
+           pct(1.0),
+           rsy);
+    if (broken) {
+      printf("  FAILED: %zu subscribers missed frames or saw them out of order\n", broken);
+      failed = true;
+    }
+    // The feed notices closed subscribers on its next wakeup
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  close(ep);
+  remove("feed_bench.sock");
+  return failed ? 1 : 0;
+}
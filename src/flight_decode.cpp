@@ -0,0 +1,140 @@
+/**
+ * Prints the records of a flight recorder file, oldest first.
+ *
+ *   flight_decode FILE [--last=N]
+ *   flight_decode FILE --bench=N   Records N events into FILE, reports
+ *                                  the cost per record next to printf
+ **/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "recorder.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static int bench(const std::string &path, uint64_t count) {
+  recorder::ring ring;
+  if (!ring.open(path, 1 << 16))
+    return 1;
+  recorder::active = &ring;
+  const auto sm    = ring.intern("ctrl::fsm");
+  const auto event = ring.intern("ctrl::turn_on");
+
+  auto start = recorder::monotonic_ns();
+  for (uint64_t i = 0; i < count; ++i)
+    ring.write(recorder::EVENT, sm, event);
+  const double recorded = double(recorder::monotonic_ns() - start) / count;
+
+  FILE *null = fopen("/dev/null", "w");
+  start      = recorder::monotonic_ns();
+  for (uint64_t i = 0; i < count; ++i)
+    fprintf(null, "%s[event] %s\n", "ctrl::fsm", "ctrl::turn_on");
+  const double printed = double(recorder::monotonic_ns() - start) / count;
+  fclose(null);
+
+  printf("  %llu records: %.1fns each, printf to /dev/null %.1fns each\n",
+         (unsigned long long)count,
+         recorded,
+         printed);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: flight_decode FILE [--last=N] [--bench=N]\n");
+    return 1;
+  }
+  if (const auto n = option(args, "bench"))
+    return bench(args[1], std::stoull(*n));
+
+  const int fd = open(args[1].c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < recorder::file_size(0)) {
+    printf("  %s: not a flight recorder file\n", args[1].c_str());
+    return 1;
+  }
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return 1;
+  const auto &h = *static_cast<const recorder::header *>(p);
+  if (std::memcmp(h.magic, recorder::magic, sizeof(h.magic)) != 0 || h.version != recorder::version ||
+      h.record_size != sizeof(recorder::record) ||
+      size_t(st.st_size) < recorder::file_size(h.capacity)) {
+    printf("  %s: not a flight recorder file\n", args[1].c_str());
+    return 1;
+  }
+  const auto *records =
+      reinterpret_cast<const recorder::record *>(static_cast<const char *>(p) + recorder::file_size(0));
+  const uint32_t names = std::min<uint32_t>(h.names.load(), recorder::max_names);
+  auto name            = [&](uint16_t i) { return i < names ? h.name[i] : "?"; };
+
+  const uint64_t head = h.head.load();
+  uint64_t first      = head > h.capacity ? head - h.capacity : 0;
+  if (const auto last = option(args, "last"))
+    first = std::max(first, head - std::min<uint64_t>(head, std::stoull(*last)));
+  printf("  pid %u, %llu records written, showing %llu\n",
+         h.pid,
+         (unsigned long long)head,
+         (unsigned long long)(head - first));
+  if (const auto lost = h.overflow.load())
+    printf("  %u names did not fit the name table, shown as ?\n", lost);
+
+  uint64_t torn = 0;
+  for (uint64_t seq = first; seq < head; ++seq) {
+    const auto &r = records[seq & (h.capacity - 1)];
+    if (r.seq.load() != seq + 1) {
+      ++torn;
+      continue;
+    }
+    const int64_t wall = int64_t(recorder::record_ns(h, r.ticks)) + h.wall_offset_ns;
+    const time_t secs  = wall / 1'000'000'000;
+    char when[32];
+    strftime(when, sizeof(when), "%F %T", localtime(&secs));
+    printf("%s.%09lld %8llu ", when, (long long)(wall % 1'000'000'000), (unsigned long long)seq);
+    switch (r.kind) {
+      case recorder::EVENT:
+        printf("%s[event] %s\n", name(r.a), name(r.b));
+        break;
+      case recorder::GUARD:
+        printf("%s[guard] %s %s %s\n", name(r.a), name(r.b), name(r.c), r.value ? "[OK]" : "[REJECTED]");
+        break;
+      case recorder::ACTION:
+        printf("%s[action] %s %s\n", name(r.a), name(r.b), name(r.c));
+        break;
+      case recorder::TRANSITION:
+        printf("%s[transition] %s -> %s\n", name(r.a), name(r.b), name(r.c));
+        break;
+      case recorder::INPUT:
+      case recorder::OUTPUT:
+        printf("%s [%s] (%u) %s\n",
+               r.kind == recorder::INPUT ? "Input" : "Output",
+               name(r.a),
+               r.b,
+               r.value ? "HIGH" : "LOW");
+        break;
+      default:
+        printf("unknown record kind %u\n", r.kind);
+    }
+  }
+  if (torn)
+    printf("  %llu records torn or overwritten while being read\n", (unsigned long long)torn);
+  munmap(p, st.st_size);
+  return 0;
+}
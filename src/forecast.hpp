@@ -0,0 +1,155 @@
+/**
+ * Upcoming on/off transitions of zones, worked out from their schedules.
+ *
+ * Whether a schedule is on depends only on the minute of the day, and it
+ * can only change where the schedule starts or stops. A day profile runs
+ * the controller's own predicate at just those minutes, so a forecast is
+ * what the controller will do without stepping through the minutes in
+ * between. Zones on the same schedule share a profile. Local days map to
+ * wall-clock time through mktime. On days that switch to or from
+ * daylight saving time the clock skips or repeats minutes, those days
+ * are walked minute by minute as the controller sees them.
+ *
+ *   forecast::calendar cal{time(nullptr), 7};
+ *   const auto p = forecast::make_profile(decide, {start, start + 1, stop, stop + 1});
+ *   forecast::transitions(p, cal, out);
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+namespace forecast {
+struct transition {
+  int64_t at;    // Unix time
+  uint16_t day;  // Local day, 0 holds the start of the forecast
+  uint16_t minute;
+  bool on;
+};
+
+// From 'minute' of the day on, up to the next edge, the schedule is 'on'
+struct edge {
+  uint16_t minute;
+  bool on;
+};
+
+using profile = std::vector<edge>;
+
+// Decides a schedule at midnight and at each of 'minutes' of the day, the
+// minutes it can switch at. Edges that do not switch are dropped.
+template <class Decide>
+profile make_profile(Decide &&on, std::vector<uint16_t> minutes) {
+  minutes.push_back(0);
+  for (auto &m : minutes)
+    m %= 24 * 60;
+  std::sort(minutes.begin(), minutes.end());
+  minutes.erase(std::unique(minutes.begin(), minutes.end()), minutes.end());
+  profile p;
+  for (const auto m : minutes) {
+    const bool state = on(m);
+    if (p.empty() || p.back().on != state)
+      p.push_back({m, state});
+  }
+  return p;
+}
+
+// Whether the schedule of 'p' is on at 'minute' of the day
+inline bool on_at(const profile &p, uint16_t minute) {
+  bool on = false;
+  for (const auto &e : p) {
+    if (e.minute > minute)
+      break;
+    on = e.on;
+  }
+  return on;
+}
+
+// The local days of a forecast, from the one holding 'now'
+class calendar {
+ public:
+  calendar(int64_t now, unsigned days) : now_{now}, end_{now + int64_t(days) * 86400} {
+    const auto t = time_t(now);
+    tm local{};
+    localtime_r(&t, &local);
+    minute_ = uint16_t(local.tm_hour * 60 + local.tm_min);
+    // One day more, a transition can fall on the day after the last
+    for (unsigned d = 0; d <= days + 1; ++d) {
+      tm date       = local;
+      date.tm_mday += int(d);
+      date.tm_hour  = date.tm_min = date.tm_sec = 0;
+      date.tm_isdst = -1;
+      const auto midnight = int64_t(mktime(&date));
+      days_.push_back({midnight, false, date, {}});
+    }
+    for (size_t d = 0; d + 1 < days_.size(); ++d)
+      days_[d].regular = days_[d + 1].midnight - days_[d].midnight == 86400;
+  }
+
+  int64_t now() const { return now_; }
+  int64_t end() const { return end_; }
+  size_t days() const { return days_.size() - 1; }
+  uint16_t minute_now() const { return minute_; }
+  const tm &date(size_t day) const { return days_[day].date; }
+
+  bool regular(size_t day) const { return days_[day].regular; }
+
+  // Unix time of 'minute' on a regular local 'day'
+  int64_t at(size_t day, uint16_t minute) const { return days_[day].midnight + int64_t(minute) * 60; }
+
+  // The minutes an irregular 'day' has, with their minute of the day
+  const std::vector<std::pair<int64_t, uint16_t>> &timeline(size_t day) {
+    auto &d = days_[day];
+    if (d.timeline.empty())
+      for (auto t = d.midnight; t < days_[day + 1].midnight; t += 60) {
+        const auto tt = time_t(t);
+        tm local{};
+        localtime_r(&tt, &local);
+        d.timeline.push_back({t, uint16_t(local.tm_hour * 60 + local.tm_min)});
+      }
+    return d.timeline;
+  }
+
+ private:
+  struct day {
+    int64_t midnight;
+    bool regular;  // 24 hours long
+    tm date;
+    std::vector<std::pair<int64_t, uint16_t>> timeline;  // Filled on use if not regular
+  };
+
+  int64_t now_;
+  int64_t end_;
+  uint16_t minute_{};
+  std::vector<day> days_;
+};
+
+// Appends the transitions of a schedule with profile 'p' after now and up
+// to the end of the calendar
+inline void transitions(const profile &p, calendar &cal, std::vector<transition> &out) {
+  bool on        = on_at(p, cal.minute_now());
+  auto switch_to = [&](int64_t at, size_t day, uint16_t minute, bool state) {
+    if (at <= cal.now() || state == on)
+      return true;
+    if (at > cal.end())
+      return false;
+    out.push_back({at, uint16_t(day), minute, state});
+    on = state;
+    return true;
+  };
+  for (size_t d = 0; d < cal.days(); ++d) {
+    if (cal.regular(d)) {
+      for (const auto &e : p)
+        if (!switch_to(cal.at(d, e.minute), d, e.minute, e.on))
+          return;
+      continue;
+    }
+    for (const auto &[at, minute] : cal.timeline(d))
+      if (!switch_to(at, d, minute, on_at(p, minute)))
+        return;
+  }
+}
+}  // namespace forecast
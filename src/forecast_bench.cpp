@@ -0,0 +1,175 @@
+/**
+ * Time to forecast every zone over a week, against stepping minutes.
+ *
+ * Puts --zones zones on random start minutes and timeslots and works out
+ * their transitions over --days days with forecast.hpp, each zone on its
+ * own, then steps the same schedules minute by minute as iterate_task
+ * would. Both must list the same transitions. Then it turns the same
+ * zones on in the controller, in UTC, and times GET /forecast, whose
+ * transitions must match as well. Fails when the forecast alone takes
+ * longer than --max-ms.
+ *
+ *   forecast_bench CONTROLLER [--zones=N] [--days=N] [--port=PORT] [--max-ms=MS] [--seed=N]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "forecast.hpp"
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// scheduled_on() of the controller, 18:00 long and 12:00 short timeslots
+struct schedule {
+  uint16_t start;
+  bool short_slot;
+
+  uint16_t stop() const { return uint16_t((start + (short_slot ? 12 : 18) * 60) % 1440); }
+  bool on(int64_t minute) const {
+    return stop() < start ? start <= minute || minute < stop() : start <= minute && minute < stop();
+  }
+};
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: forecast_bench CONTROLLER [--zones=N] [--days=N] [--port=PORT] [--max-ms=MS] [--seed=N]\n");
+    return 1;
+  }
+  const auto zones  = std::stoul(option(args, "zones").value_or("10000"));
+  const auto days   = unsigned(std::stoul(option(args, "days").value_or("7")));
+  const auto port   = uint16_t(std::stoul(option(args, "port").value_or("18370")));
+  const auto max_ms = std::stod(option(args, "max-ms").value_or("100"));
+  std::mt19937_64 rng{std::stoul(option(args, "seed").value_or("1"))};
+
+  // UTC has no daylight saving days, minutes step evenly
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  std::vector<schedule> schedules(zones);
+  for (auto &s : schedules)
+    s = {uint16_t(rng() % 1440), rng() % 2 == 1};
+
+  const auto now = int64_t(std::time(nullptr));
+  std::vector<std::vector<int64_t>> analytic(zones), stepped(zones);
+  auto start = std::chrono::steady_clock::now();
+  forecast::calendar cal{now, days};
+  std::vector<forecast::transition> out;
+  for (size_t z = 0; z < zones; ++z) {
+    const auto &s = schedules[z];
+    const auto p  = forecast::make_profile([&](uint16_t m) { return s.on(m); },
+                                          {s.start, uint16_t(s.start + 1), s.stop(), uint16_t(s.stop() + 1)});
+    out.clear();
+    forecast::transitions(p, cal, out);
+    for (const auto &t : out)
+      analytic[z].push_back(t.at);
+  }
+  const auto analytic_ms = since_ms(start);
+
+  start = std::chrono::steady_clock::now();
+  for (size_t z = 0; z < zones; ++z) {
+    bool on = schedules[z].on(now / 60 % 1440);
+    for (int64_t t = now - now % 60 + 60; t <= cal.end(); t += 60)
+      if (schedules[z].on(t / 60 % 1440) != on) {
+        on = !on;
+        stepped[z].push_back(t);
+      }
+  }
+  const auto stepped_ms = since_ms(start);
+
+  size_t wrong = 0;
+  for (size_t z = 0; z < zones; ++z)
+    wrong += analytic[z] != stepped[z];
+  printf("  %zu zones over %u days: forecast %.1f ms, stepping minutes %.1f ms\n",
+         size_t(zones),
+         days,
+         analytic_ms,
+         stepped_ms);
+  if (wrong) {
+    printf("  FAILED: %zu zones forecast other transitions than stepping minutes finds\n", wrong);
+    return 1;
+  }
+
+  harness::child lc;
+  if (!lc.start({args[1],
+                 "07:00",
+                 "--http=" + std::to_string(port),
+                 "--zones=" + std::to_string(zones),
+                 "--vgpio=forecast_bench.sock"},
+                "forecast_bench.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see forecast_bench.log\n");
+    return 1;
+  }
+  std::string batch;
+  for (size_t z = 0; z < zones; ++z) {
+    char line[48];
+    snprintf(line, sizeof(line), "%zu turn_on %02d:%02d\n", z, schedules[z].start / 60, schedules[z].start % 60);
+    batch += line;
+    if (schedules[z].short_slot)
+      batch += std::to_string(z) + " change_on_time\n";
+  }
+  const auto posted = harness::request(port, "POST", "/zones/events", batch);
+  if (!posted || harness::number(*posted, "malformed").value_or(1) != 0) {
+    printf("  FAILED: the controller did not take the zones\n");
+    return 1;
+  }
+
+  start            = std::chrono::steady_clock::now();
+  const auto body  = harness::request(port, "GET", "/forecast?days=" + std::to_string(days));
+  const auto ms    = since_ms(start);
+  const auto until = int64_t(std::time(nullptr)) + 60;
+  remove("forecast_bench.sock");
+  if (!body) {
+    printf("  FAILED: GET /forecast failed\n");
+    return 1;
+  }
+
+  // Transitions between the request and a week after are compared, the
+  // controller's week started a little later than this one
+  const auto week = now + int64_t(days) * 86400;
+  size_t lines    = 0;
+  for (size_t at = 0, eol; (eol = body->find('\n', at)) != std::string::npos; at = eol + 1, ++lines) {
+    const std::string_view line(body->data() + at, eol - at);
+    const auto z = size_t(harness::number(line, "zone").value_or(-1));
+    if (z >= zones) {
+      ++wrong;
+      continue;
+    }
+    std::vector<int64_t> got, want;
+    for (size_t t = line.find("\"at\":"); t != std::string_view::npos; t = line.find("\"at\":", t + 5))
+      if (const auto v = int64_t(std::strtoll(line.data() + t + 5, nullptr, 10)); v > until && v < week)
+        got.push_back(v);
+    for (const auto v : analytic[z])
+      if (v > until && v < week)
+        want.push_back(v);
+    wrong += got != want;
+  }
+  printf("  GET /forecast?days=%u: %.1f ms for %zu zones, %zu bytes\n", days, ms, lines, body->size());
+  if (wrong || lines != zones) {
+    printf("  FAILED: %zu of %zu zones forecast other transitions in the controller\n", wrong, lines);
+    return 1;
+  }
+  if (analytic_ms > max_ms) {
+    printf("  FAILED: the forecast took longer than %.0f ms\n", max_ms);
+    return 1;
+  }
+  return 0;
+}
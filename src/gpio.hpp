@@ -0,0 +1,22 @@
+/**
+ * Pluggable GPIO access for the hw templates.
+ *
+ * Without a backend the hw templates use wiringPi on the Pi and fake
+ * inputs elsewhere. Once hw::backend is set, every pin setup, read and
+ * write of the templates goes through it instead.
+ **/
+
+#pragma once
+
+namespace hw {
+class gpio_backend {
+ public:
+  virtual ~gpio_backend() = default;
+  virtual void setup_input(int pin, bool pull_up) = 0;
+  virtual void setup_output(int pin)              = 0;
+  virtual bool read(int pin)                      = 0;
+  virtual void write(int pin, bool level)         = 0;
+};
+
+inline gpio_backend *backend{};
+}  // namespace hw
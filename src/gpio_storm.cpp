@@ -0,0 +1,95 @@
+/**
+ * Edge storm driver for the virtual gpiochip of light_controller --vgpio.
+ *
+ * Toggles input lines at a fixed rate, round robin over the given lines,
+ * and reports the rate achieved and the output changes seen meanwhile.
+ *
+ *   gpio_storm SOCKET [--lines=8,9] [--rate=HZ] [--count=N | --seconds=S]
+ **/
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "vgpio.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: gpio_storm SOCKET [--lines=8,9] [--rate=HZ] [--count=N | --seconds=S]\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> lines;
+  const auto list = option(args, "lines").value_or("8");
+  for (size_t at = 0; at < list.size();) {
+    auto sep = list.find(',', at);
+    if (sep == std::string::npos)
+      sep = list.size();
+    lines.push_back(uint8_t(std::stoul(list.substr(at, sep - at))));
+    at = sep + 1;
+  }
+  const double rate    = std::stod(option(args, "rate").value_or("1000"));
+  const double seconds = std::stod(option(args, "seconds").value_or("1"));
+  const uint64_t count = option(args, "count") ? std::stoull(*option(args, "count")) : uint64_t(rate * seconds);
+
+  const int fd = vgpio::seqpacket_socket();
+  auto addr    = vgpio::unix_address(args[1]);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    printf("  Connecting to %s failed: %s\n", args[1].c_str(), strerror(errno));
+    return 1;
+  }
+  vgpio::message watch{vgpio::WATCH, 0, 0, 0, 0, 0};
+  send(fd, &watch, sizeof(watch), MSG_NOSIGNAL);
+
+  // Lines start low on the chip, every edge flips one of them
+  std::vector<uint8_t> level(vgpio::lines);
+  const uint64_t period_ns = uint64_t(1e9 / rate);
+  const uint64_t start     = vgpio::monotonic_ns();
+  uint64_t sent{}, late{}, output_changes{};
+  for (; sent < count; ++sent) {
+    const uint64_t due = start + sent * period_ns;
+    // Output changes pushed back by the chip, drained while waiting
+    for (uint64_t now = vgpio::monotonic_ns(); now < due; now = vgpio::monotonic_ns()) {
+      pollfd p{fd, POLLIN, 0};
+      if (due - now > 100'000 && poll(&p, 1, int((due - now) / 1'000'000)) > 0) {
+        vgpio::message m;
+        while (recv(fd, &m, sizeof(m), MSG_DONTWAIT) == sizeof(m))
+          output_changes += m.op == vgpio::EVENT;
+      }
+    }
+    if (vgpio::monotonic_ns() - due > period_ns)
+      ++late;
+    const auto line = lines[sent % lines.size()];
+    level[line]     = !level[line];
+    vgpio::message m{vgpio::DRIVE, line, level[line], 0, uint32_t(sent), 0};
+    if (send(fd, &m, sizeof(m), MSG_NOSIGNAL) != sizeof(m)) {
+      printf("  Chip went away after %llu edges\n", (unsigned long long)sent);
+      break;
+    }
+  }
+  const double took = (vgpio::monotonic_ns() - start) / 1e9;
+  printf("  %llu edges in %.3fs: %.0f/s for %.0f/s asked, %llu late, %llu output changes\n",
+         (unsigned long long)sent,
+         took,
+         sent / took,
+         rate,
+         (unsigned long long)late,
+         (unsigned long long)output_changes);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * Runs light_controller as a child process and talks to it over HTTP, for
+ * the tools that check and measure it from the outside.
+ *
+ *   harness::child lc;
+ *   lc.start({exe, "07:00", "--http=18200", "--zones=1000"}, "lc.log");
+ *   harness::wait_http(18200, 2s);
+ *   const auto zones = harness::request(18200, "GET", "/zones");
+ *   harness::number(*zones, "mismatches");
+ **/
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace harness {
+inline int64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+// A child process, killed when it goes out of scope
+class child {
+ public:
+  ~child() {
+    if (pid_ > 0) {
+      kill(pid_, SIGKILL);
+      waitpid(pid_, nullptr, 0);
+    }
+  }
+
+  // Starts argv[0] with its output appended to 'log'
+  bool start(const std::vector<std::string> &argv, const std::string &log) {
+    pid_ = fork();
+    if (pid_ < 0)
+      return false;
+    if (pid_ == 0) {
+      const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+      }
+      std::vector<char *> args;
+      for (const auto &a : argv)
+        args.push_back(const_cast<char *>(a.c_str()));
+      args.push_back(nullptr);
+      execv(args[0], args.data());
+      _exit(127);
+    }
+    return true;
+  }
+
+  pid_t pid() const { return pid_; }
+
+  void signal(int sig) const {
+    if (pid_ > 0)
+      kill(pid_, sig);
+  }
+
+  // Exit status, or -1 if the child did not exit within 'timeout'
+  int wait(std::chrono::milliseconds timeout) {
+    const auto until = monotonic_ns() + std::chrono::nanoseconds(timeout).count();
+    for (int status; pid_ > 0;) {
+      if (waitpid(pid_, &status, WNOHANG) == pid_) {
+        pid_ = -1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      }
+      if (monotonic_ns() > until)
+        return -1;
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return -1;
+  }
+
+ private:
+  pid_t pid_{-1};
+};
+
+inline int connect_local(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd >= 0 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0)
+    return fd;
+  if (fd >= 0)
+    close(fd);
+  return -1;
+}
+
+// Body of the response, nothing if the server did not answer with 2xx
+inline std::optional<std::string> request(uint16_t port,
+                                          std::string_view method,
+                                          std::string_view path,
+                                          std::string_view body = {}) {
+  const int fd = connect_local(port);
+  if (fd < 0)
+    return std::nullopt;
+  std::string out(method);
+  out.append(" ").append(path).append(" HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n");
+  out.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n\r\n").append(body);
+  for (size_t at = 0; at < out.size();) {
+    const auto n = send(fd, out.data() + at, out.size() - at, MSG_NOSIGNAL);
+    if (n <= 0) {
+      close(fd);
+      return std::nullopt;
+    }
+    at += size_t(n);
+  }
+  std::string in;
+  char buf[65536];
+  for (ssize_t n; (n = recv(fd, buf, sizeof(buf), 0)) > 0;)
+    in.append(buf, size_t(n));
+  close(fd);
+  const auto head = in.find("\r\n\r\n");
+  if (in.compare(0, 10, "HTTP/1.1 2") != 0 || head == std::string::npos)
+    return std::nullopt;
+  return in.substr(head + 4);
+}
+
+// Polls until the server accepts connections
+inline bool wait_http(uint16_t port, std::chrono::milliseconds timeout) {
+  const auto until = monotonic_ns() + std::chrono::nanoseconds(timeout).count();
+  while (monotonic_ns() < until) {
+    if (const int fd = connect_local(port); fd >= 0) {
+      close(fd);
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return false;
+}
+
+// Number after the first '"key":' in a JSON body
+inline std::optional<double> number(std::string_view body, std::string_view key) {
+  const auto quoted = "\"" + std::string(key) + "\":";
+  const auto at     = body.find(quoted);
+  if (at == std::string_view::npos)
+    return std::nullopt;
+  const std::string value(body.substr(at + quoted.size(), 32));
+  char *end{};
+  const double v = strtod(value.c_str(), &end);
+  if (end == value.c_str())
+    return std::nullopt;
+  return v;
+}
+
+// String after the first '"key":' in a JSON body, empty if missing
+inline std::string text(std::string_view body, std::string_view key) {
+  const auto quoted = "\"" + std::string(key) + "\":\"";
+  const auto at     = body.find(quoted);
+  if (at == std::string_view::npos)
+    return {};
+  const auto value = body.substr(at + quoted.size());
+  return std::string(value.substr(0, value.find('"')));
+}
+}  // namespace harness
@@ -0,0 +1,61 @@
+/**
+ * Fixed size ring of newline terminated history records.
+ **/
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string_view>
+
+namespace logger {
+template <size_t Capacity>
+class history {
+ public:
+  // Oldest records are dropped whole to make room for new ones
+  void append(std::string_view line) {
+    if (line.empty() || line.size() > Capacity)
+      return;
+    while (size_ + line.size() > Capacity)
+      drop_oldest();
+
+    size_t at         = (start_ + size_) % Capacity;
+    const size_t head = std::min(line.size(), Capacity - at);
+    std::memcpy(buf_.data() + at, line.data(), head);
+    std::memcpy(buf_.data(), line.data() + head, line.size() - head);
+    size_ += line.size();
+  }
+
+  // Fills up to two iovecs referencing the ring, oldest record first
+  size_t segments(iovec (&iov)[2]) const {
+    if (size_ == 0)
+      return 0;
+    const size_t head = std::min(size_, Capacity - start_);
+    iov[0]            = {const_cast<char *>(buf_.data()) + start_, head};
+    if (head == size_)
+      return 1;
+    iov[1] = {const_cast<char *>(buf_.data()), size_ - head};
+    return 2;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  void drop_oldest() {
+    while (size_ > 0) {
+      const char c = buf_[start_];
+      start_       = (start_ + 1) % Capacity;
+      --size_;
+      if (c == '\n')
+        break;
+    }
+  }
+
+  std::array<char, Capacity> buf_{};
+  size_t start_{};
+  size_t size_{};
+};
+}  // namespace logger
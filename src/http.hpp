@@ -0,0 +1,664 @@
+/**
+ * Minimal HTTP/1.1 server running on the io::reactor.
+ *
+ * Every connection owns a transmit buffer and a receive buffer, responses
+ * are formatted directly into the former. The receive buffer grows for a
+ * request body up to max_request and shrinks back once it is handled.
+ * Large bodies are attached as iovecs or a file descriptor and sent with
+ * writev/sendfile without copying.
+ *
+ * The server binds to loopback unless given an address. With a token set
+ * every request needs 'Authorization: Bearer TOKEN'.
+ **/
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "reactor.hpp"
+
+namespace http {
+static constexpr size_t max_connections = 16;
+static constexpr size_t rx_size         = 4096;
+static constexpr size_t max_request     = 1024 * 1024;  // Header and body
+static constexpr size_t tx_size         = 8192;
+static constexpr size_t header_reserve  = 256;
+static constexpr size_t max_attached    = 4;
+
+struct request {
+  std::string_view method;
+  std::string_view path;
+  std::string_view query;
+  std::string_view body;
+  std::string_view authorization;
+  bool keep_alive{true};
+};
+
+class response {
+ public:
+  response(char *body, size_t capacity) : body_{body}, capacity_{capacity} {}
+
+  void status(int code) { status_ = code; }
+  void type(const char *content_type) { type_ = content_type; }
+
+  // Appends to the inline body, formatted in place
+  __attribute__((format(printf, 2, 3))) void printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const int n = vsnprintf(body_ + size_, capacity_ - size_, fmt, args);
+    va_end(args);
+    if (n < 0 || size_t(n) >= capacity_ - size_)
+      overflow_ = true;
+    else
+      size_ += n;
+  }
+
+  // Lets snprintf-like formatters write straight into the inline body
+  template <class Fn>
+  void format(Fn &&fn) {
+    const int n = fn(body_ + size_, capacity_ - size_);
+    if (n < 0 || size_t(n) >= capacity_ - size_)
+      overflow_ = true;
+    else
+      size_ += n;
+  }
+
+  // Sent after the inline body, the memory must stay valid until sent
+  void attach(const void *data, size_t len) {
+    if (attached_ == max_attached)
+      overflow_ = true;
+    else if (len > 0)
+      iov_[attached_++] = {const_cast<void *>(data), len};
+  }
+
+  // Sent last with sendfile, the response takes ownership of 'fd'
+  void file(int fd, off_t offset, size_t len) {
+    if (file_fd_ >= 0)
+      close(file_fd_);
+    file_fd_  = fd;
+    file_off_ = offset;
+    file_len_ = len;
+  }
+
+ private:
+  friend class server;
+
+  size_t content_length() const {
+    size_t len = size_ + file_len_;
+    for (size_t i = 0; i < attached_; ++i)
+      len += iov_[i].iov_len;
+    return len;
+  }
+
+  char *body_;
+  size_t capacity_;
+  size_t size_{};
+  bool overflow_{false};
+  int status_{200};
+  const char *type_{"application/json"};
+  iovec iov_[max_attached]{};
+  size_t attached_{};
+  int file_fd_{-1};
+  off_t file_off_{};
+  size_t file_len_{};
+};
+
+using handler = std::function<void(const request &, response &)>;
+
+// Value of a flat JSON string field, '{"key":"value"}', empty if missing
+inline std::string_view json_field(std::string_view body, std::string_view key) {
+  size_t at = 0;
+  while ((at = body.find(key, at)) != std::string_view::npos) {
+    const bool quoted = at > 0 && body[at - 1] == '"' &&
+                        body.substr(at + key.size(), 1) == "\"";
+    at += key.size();
+    if (!quoted)
+      continue;
+    const auto open = body.find('"', body.find(':', at));
+    if (open == std::string_view::npos)
+      return {};
+    const auto close = body.find('"', open + 1);
+    if (close == std::string_view::npos)
+      return {};
+    return body.substr(open + 1, close - open - 1);
+  }
+  return {};
+}
+
+// Value of 'key' in a query string, 'a=1&b=2', empty if missing
+inline std::string_view query_field(std::string_view query, std::string_view key) {
+  while (!query.empty()) {
+    const auto amp  = query.find('&');
+    const auto pair = query.substr(0, amp);
+    query.remove_prefix(amp == std::string_view::npos ? query.size() : amp + 1);
+    if (pair.size() > key.size() && pair.compare(0, key.size(), key) == 0 && pair[key.size()] == '=')
+      return pair.substr(key.size() + 1);
+  }
+  return {};
+}
+
+struct stats {
+  uint64_t requests{};
+  uint64_t errors{};
+  uint64_t latency_log2_us[32]{};
+
+  // Upper bound of the histogram bucket holding the 'q' quantile
+  uint64_t percentile_us(double q) const {
+    uint64_t total{};
+    for (auto n : latency_log2_us)
+      total += n;
+    uint64_t seen{};
+    for (size_t i = 0; i < 32; ++i) {
+      seen += latency_log2_us[i];
+      if (total && seen >= q * total)
+        return uint64_t(1) << i;
+    }
+    return 0;
+  }
+};
+
+class server {
+ public:
+  explicit server(io::reactor &reactor) : reactor_{reactor} {}
+  ~server() {
+    for (auto &c : conns_)
+      if (c.fd >= 0)
+        drop(c);
+    if (listen_fd_ >= 0)
+      close(listen_fd_);
+  }
+
+  // A path ending in '*' matches every path with that prefix
+  void route(std::string_view method, std::string_view path, handler h) {
+    routes_.push_back({method, path, std::move(h)});
+  }
+
+  // Requests without 'Authorization: Bearer <token>' get 401
+  void require_token(std::string token) { token_ = std::move(token); }
+
+  // 'address' is an IPv4 address, "0.0.0.0" for every interface
+  bool listen(uint16_t port, const std::string &address = "127.0.0.1") {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+      printf("  HTTP bind address %s is not an IPv4 address\n", address.c_str());
+      return false;
+    }
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0)
+      return false;
+    const int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        ::listen(listen_fd_, 64) < 0) {
+      printf("  HTTP listen on %s:%u failed: %s\n", address.c_str(), port, strerror(errno));
+      close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+    start();
+    printf("  HTTP listening on %s:%u%s\n", address.c_str(), port, token_.empty() ? "" : " with a token");
+    return true;
+  }
+
+  // Serves on a listening socket handed over by a previous process,
+  // connections queued on it meanwhile are accepted as usual
+  bool adopt(int fd) {
+    int type{};
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0 || type != SOCK_STREAM) {
+      printf("  HTTP inherited socket %d unusable\n", fd);
+      close(fd);
+      return false;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    listen_fd_ = fd;
+    start();
+    printf("  HTTP serving on inherited socket %d\n", fd);
+    return true;
+  }
+
+  int listen_fd() const { return listen_fd_; }
+
+  // Stops accepting and serves the requests already accepted, for at
+  // most 'timeout'. Connections queued meanwhile stay on the listening
+  // socket, idle keep-alive connections are left to be closed
+  void finish(std::chrono::milliseconds timeout) {
+    if (listen_fd_ >= 0)
+      reactor_.remove(listen_fd_);
+    const auto until = clock::now() + timeout;
+    auto in_flight   = [this] {
+      for (const auto &c : conns_)
+        if (c.fd >= 0 && (c.sending || c.rx_len || c.fresh))
+          return true;
+      return false;
+    };
+    while (in_flight() && clock::now() < until)
+      reactor_.run_once(std::chrono::milliseconds(1));
+  }
+
+  // Accepts again after finish(), when the exec it was for failed
+  void resume() {
+    if (listen_fd_ >= 0)
+      reactor_.add(listen_fd_, EPOLLIN, [this](uint32_t) { accept_all(); });
+  }
+
+  const http::stats &stats() const { return stats_; }
+
+ private:
+  using clock = io::reactor::clock;
+  static constexpr auto idle_timeout = std::chrono::seconds(30);
+
+  struct route_entry {
+    std::string_view method;
+    std::string_view path;
+    handler h;
+  };
+
+  struct connection {
+    int fd{-1};
+    std::vector<char> rx = std::vector<char>(rx_size);
+    size_t rx_len{};
+    std::array<char, tx_size> tx;
+    size_t tx_off{};
+    size_t tx_end{};
+    iovec iov[max_attached]{};
+    size_t attached{};
+    int file_fd{-1};
+    off_t file_off{};
+    size_t file_left{};
+    bool sending{false};
+    bool close_after{false};
+    bool fresh{false};  // Accepted, no request answered yet
+    clock::time_point last_active;
+    clock::time_point started;
+  };
+
+  void start() {
+    reactor_.add(listen_fd_, EPOLLIN, [this](uint32_t) { accept_all(); });
+    reactor_.every(std::chrono::seconds(1), [this] { expire_idle(); });
+  }
+
+  void accept_all() {
+    while (true) {
+      const int fd =
+          accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0)
+        return;
+
+      connection *c = nullptr;
+      for (auto &slot : conns_)
+        if (slot.fd < 0) {
+          c = &slot;
+          break;
+        }
+      if (!c) {
+        close(fd);
+        continue;
+      }
+
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      c->fd          = fd;
+      c->rx_len      = 0;
+      c->sending     = false;
+      c->close_after = false;
+      c->fresh       = true;
+      c->last_active = clock::now();
+      reactor_.add(fd, EPOLLIN | EPOLLRDHUP, [this, c](uint32_t events) {
+        on_event(*c, events);
+      });
+    }
+  }
+
+  void drop(connection &c) {
+    reactor_.remove(c.fd);
+    close(c.fd);
+    c.fd = -1;
+    if (c.file_fd >= 0)
+      close(c.file_fd);
+    c.file_fd = -1;
+  }
+
+  void expire_idle() {
+    const auto now = clock::now();
+    for (auto &c : conns_)
+      if (c.fd >= 0 && !c.sending && now - c.last_active > idle_timeout)
+        drop(c);
+  }
+
+  void on_event(connection &c, uint32_t events) {
+    c.last_active = clock::now();
+    if (events & (EPOLLERR | EPOLLHUP)) {
+      drop(c);
+      return;
+    }
+    if (c.sending) {
+      if (events & EPOLLOUT)
+        flush(c);
+      if (c.fd >= 0 && !c.sending)
+        process(c);
+      return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP)) {
+      const ssize_t n = read(c.fd, c.rx.data() + c.rx_len, c.rx.size() - c.rx_len);
+      if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+          drop(c);
+        return;
+      }
+      c.rx_len += n;
+      process(c);
+    }
+  }
+
+  // Handles every complete request in the receive buffer
+  void process(connection &c) {
+    while (!c.sending && c.fd >= 0) {
+      const std::string_view data(c.rx.data(), c.rx_len);
+      const auto header_end = data.find("\r\n\r\n");
+      if (header_end == std::string_view::npos) {
+        if (c.rx_len >= rx_size)
+          fail(c, 431, "Request Header Fields Too Large");
+        return;
+      }
+
+      request req;
+      size_t content_length{};
+      if (!parse(data.substr(0, header_end), req, content_length)) {
+        fail(c, 400, "Bad Request");
+        return;
+      }
+      const size_t total = header_end + 4 + content_length;
+      if (content_length > max_request || total > max_request) {
+        fail(c, 413, "Payload Too Large");
+        return;
+      }
+      if (total > c.rx_len) {
+        if (total > c.rx.size())
+          c.rx.resize(total);
+        return;
+      }
+      req.body = data.substr(header_end + 4, content_length);
+
+      c.started = clock::now();
+      dispatch(c, req);
+
+      // Keep pipelined bytes for the next round
+      std::memmove(c.rx.data(), c.rx.data() + total, c.rx_len - total);
+      c.rx_len -= total;
+      if (c.rx.size() > rx_size && c.rx_len <= rx_size) {
+        c.rx.resize(rx_size);
+        c.rx.shrink_to_fit();
+      }
+      flush(c);
+    }
+  }
+
+  static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i)
+      if (std::tolower(a[i]) != std::tolower(b[i]))
+        return false;
+    return true;
+  }
+
+  static bool parse(std::string_view head, request &req, size_t &length) {
+    auto line_end = head.find("\r\n");
+    auto line     = head.substr(0, line_end);
+
+    const auto sp1 = line.find(' ');
+    const auto sp2 = line.rfind(' ');
+    if (sp1 == std::string_view::npos || sp1 == sp2)
+      return false;
+    req.method        = line.substr(0, sp1);
+    auto target       = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const auto ver    = line.substr(sp2 + 1);
+    req.keep_alive    = (ver == "HTTP/1.1");
+    const auto qmark  = target.find('?');
+    req.path          = target.substr(0, qmark);
+    if (qmark != std::string_view::npos)
+      req.query = target.substr(qmark + 1);
+
+    while (line_end != std::string_view::npos) {
+      head.remove_prefix(line_end + 2);
+      line_end         = head.find("\r\n");
+      line             = head.substr(0, line_end);
+      const auto colon = line.find(':');
+      if (colon == std::string_view::npos)
+        continue;
+      const auto name = line.substr(0, colon);
+      auto value      = line.substr(colon + 1);
+      while (!value.empty() && value.front() == ' ')
+        value.remove_prefix(1);
+
+      if (iequals(name, "Content-Length")) {
+        length = 0;
+        for (const char ch : value) {
+          if (ch < '0' || ch > '9')
+            return false;
+          length = length * 10 + (ch - '0');
+        }
+      } else if (iequals(name, "Authorization")) {
+        req.authorization = value;
+      } else if (iequals(name, "Connection")) {
+        if (iequals(value, "close"))
+          req.keep_alive = false;
+        else if (iequals(value, "keep-alive"))
+          req.keep_alive = true;
+      }
+    }
+    return true;
+  }
+
+  void dispatch(connection &c, const request &req) {
+    response res(c.tx.data() + header_reserve, tx_size - header_reserve);
+
+    const route_entry *match = nullptr;
+    bool path_found          = false;
+    for (const auto &r : routes_) {
+      const bool prefix = !r.path.empty() && r.path.back() == '*';
+      const bool hit =
+          prefix ? req.path.substr(0, r.path.size() - 1) ==
+                       r.path.substr(0, r.path.size() - 1)
+                 : req.path == r.path;
+      if (!hit)
+        continue;
+      path_found = true;
+      if (r.method == req.method) {
+        match = &r;
+        break;
+      }
+    }
+
+    if (!token_.empty() && !authorized(req.authorization)) {
+      res.status(401);
+      res.printf("{\"error\":\"unauthorized\"}");
+    } else if (match) {
+      match->h(req, res);
+    } else {
+      res.status(path_found ? 405 : 404);
+      res.printf("{\"error\":\"%s\"}", path_found ? "method" : "not found");
+    }
+
+    if (res.overflow_) {
+      res.size_     = 0;
+      res.attached_ = 0;
+      res.file(-1, 0, 0);
+      res.status(500);
+      res.printf("{\"error\":\"response too large\"}");
+    }
+    if (res.status_ >= 400)
+      ++stats_.errors;
+
+    char header[header_reserve];
+    const int hlen = snprintf(header,
+                              sizeof(header),
+                              "HTTP/1.1 %d %s\r\n"
+                              "Content-Type: %s\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: %s\r\n\r\n",
+                              res.status_,
+                              reason(res.status_),
+                              res.type_,
+                              res.content_length(),
+                              req.keep_alive ? "keep-alive" : "close");
+    assert(hlen > 0 && size_t(hlen) < header_reserve);
+
+    // Header is placed right in front of the body, no copy of the body
+    c.tx_off = header_reserve - hlen;
+    c.tx_end = header_reserve + res.size_;
+    std::memcpy(c.tx.data() + c.tx_off, header, hlen);
+    std::copy(res.iov_, res.iov_ + res.attached_, c.iov);
+    c.attached    = res.attached_;
+    c.file_fd     = res.file_fd_;
+    c.file_off    = res.file_off_;
+    c.file_left   = res.file_len_;
+    c.close_after = !req.keep_alive;
+    c.sending     = true;
+  }
+
+  void fail(connection &c, int code, const char *text) {
+    const int n = snprintf(c.tx.data(),
+                           tx_size,
+                           "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n"
+                           "Connection: close\r\n\r\n",
+                           code,
+                           text);
+    ++stats_.errors;
+    c.tx_off      = 0;
+    c.tx_end      = n;
+    c.attached    = 0;
+    c.close_after = true;
+    c.sending     = true;
+    c.started     = clock::now();
+    flush(c);
+  }
+
+  void flush(connection &c) {
+    // Header, inline body and attached segments go out in one writev
+    while (c.tx_off < c.tx_end || c.attached > 0) {
+      iovec iov[1 + max_attached];
+      size_t n = 0;
+      if (c.tx_off < c.tx_end)
+        iov[n++] = {c.tx.data() + c.tx_off, c.tx_end - c.tx_off};
+      for (size_t i = 0; i < c.attached; ++i)
+        iov[n++] = c.iov[i];
+
+      ssize_t sent = writev(c.fd, iov, int(n));
+      if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return wait_writable(c);
+        return drop(c);
+      }
+
+      const size_t inline_sent = std::min(size_t(sent), c.tx_end - c.tx_off);
+      c.tx_off += inline_sent;
+      sent -= inline_sent;
+      while (sent > 0 && c.attached > 0) {
+        const size_t part = std::min(size_t(sent), c.iov[0].iov_len);
+        c.iov[0].iov_base = (char *)c.iov[0].iov_base + part;
+        c.iov[0].iov_len -= part;
+        sent -= part;
+        if (c.iov[0].iov_len == 0) {
+          std::copy(c.iov + 1, c.iov + c.attached, c.iov);
+          --c.attached;
+        }
+      }
+    }
+
+    while (c.file_left > 0) {
+      const ssize_t sent = sendfile(c.fd, c.file_fd, &c.file_off, c.file_left);
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return wait_writable(c);
+      if (sent <= 0)
+        return drop(c);
+      c.file_left -= sent;
+    }
+    if (c.file_fd >= 0) {
+      close(c.file_fd);
+      c.file_fd = -1;
+    }
+
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        clock::now() - c.started)
+                        .count();
+    ++stats_.requests;
+    ++stats_.latency_log2_us[std::min(31, 64 - __builtin_clzll(us | 1))];
+    c.fresh = false;
+
+    if (c.close_after)
+      return drop(c);
+    c.sending = false;
+    reactor_.modify(c.fd, EPOLLIN | EPOLLRDHUP);
+  }
+
+  // Without EPOLLRDHUP, a peer that shut down its side would otherwise
+  // wake the loop over and over until the response is out
+  void wait_writable(connection &c) {
+    reactor_.modify(c.fd, EPOLLOUT);
+  }
+
+  // Compares in constant time
+  bool authorized(std::string_view header) const {
+    constexpr std::string_view scheme = "Bearer ";
+    if (header.size() != scheme.size() + token_.size() || header.substr(0, scheme.size()) != scheme)
+      return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < token_.size(); ++i)
+      diff |= header[scheme.size() + i] ^ token_[i];
+    return diff == 0;
+  }
+
+  static const char *reason(int code) {
+    switch (code) {
+      case 200:
+        return "OK";
+      case 400:
+        return "Bad Request";
+      case 401:
+        return "Unauthorized";
+      case 404:
+        return "Not Found";
+      case 405:
+        return "Method Not Allowed";
+      case 409:
+        return "Conflict";
+      default:
+        return code < 500 ? "Client Error" : "Internal Server Error";
+    }
+  }
+
+  io::reactor &reactor_;
+  int listen_fd_{-1};
+  std::string token_;
+  std::vector<route_entry> routes_;
+  std::array<connection, max_connections> conns_{};
+  http::stats stats_;
+};
+}  // namespace http
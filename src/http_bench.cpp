@@ -0,0 +1,131 @@
+/**
+ * Loopback throughput and latency of the HTTP API.
+ *
+ * Runs the controller with --http and keeps --connections keep-alive
+ * connections busy with GET /status, one request in flight on each, for
+ * --seconds. Reports requests per second and the client side latency
+ * percentiles next to the ones the server keeps in /metrics. Every
+ * response must be a 200 with the status body.
+ *
+ *   http_bench CONTROLLER [--connections=N] [--seconds=S] [--port=PORT]
+ **/
+
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+struct connection {
+  int fd{-1};
+  std::string in;
+  int64_t sent_ns{};
+};
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: http_bench CONTROLLER [--connections=N] [--seconds=S] [--port=PORT]\n");
+    return 1;
+  }
+  const auto count   = std::stoul(option(args, "connections").value_or("8"));
+  const auto seconds = std::stod(option(args, "seconds").value_or("3"));
+  const auto port    = uint16_t(std::stoul(option(args, "port").value_or("18360")));
+
+  harness::child lc;
+  if (!lc.start({args[1], "07:00", "--http=" + std::to_string(port), "--vgpio=http_bench.sock"},
+                "http_bench.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see http_bench.log\n");
+    return 1;
+  }
+
+  static constexpr char get[] = "GET /status HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  const int ep                = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<connection> conns(count);
+  auto send_one = [&](connection &c) {
+    c.sent_ns = harness::monotonic_ns();
+    return send(c.fd, get, sizeof(get) - 1, MSG_NOSIGNAL) == ssize_t(sizeof(get) - 1);
+  };
+  for (size_t i = 0; i < count; ++i) {
+    conns[i].fd = harness::connect_local(port);
+    epoll_event ev{};
+    ev.events   = EPOLLIN;
+    ev.data.u64 = i;
+    if (conns[i].fd < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].fd, &ev) != 0 || !send_one(conns[i])) {
+      printf("  Connection %zu failed\n", i);
+      return 1;
+    }
+  }
+
+  std::vector<double> latency;
+  size_t bad       = 0;
+  const auto start = harness::monotonic_ns();
+  const auto until = start + int64_t(seconds * 1e9);
+  epoll_event events[64];
+  while (harness::monotonic_ns() < until && !bad) {
+    const int n = epoll_wait(ep, events, 64, 1000);
+    for (int e = 0; e < n; ++e) {
+      auto &c = conns[events[e].data.u64];
+      char buf[4096];
+      const auto got = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+      if (got <= 0) {
+        ++bad;
+        break;
+      }
+      c.in.append(buf, size_t(got));
+      // One response in flight, complete once its Content-Length arrived
+      const auto head = c.in.find("\r\n\r\n");
+      if (head == std::string::npos)
+        continue;
+      const auto at   = c.in.find("Content-Length: ");
+      const auto body = at == std::string::npos ? 0 : std::stoul(c.in.substr(at + 16));
+      if (c.in.size() < head + 4 + body)
+        continue;
+      latency.push_back((harness::monotonic_ns() - c.sent_ns) / 1e3);
+      bad += c.in.compare(0, 12, "HTTP/1.1 200") != 0 || c.in.find("\"state\":") == std::string::npos;
+      c.in.clear();
+      if (!send_one(c))
+        ++bad;
+    }
+  }
+  const auto elapsed = (harness::monotonic_ns() - start) / 1e9;
+  for (auto &c : conns)
+    close(c.fd);
+  close(ep);
+
+  std::sort(latency.begin(), latency.end());
+  auto pct           = [&](double q) { return latency.empty() ? 0.0 : latency[size_t(q * (latency.size() - 1))]; };
+  const auto metrics = harness::request(port, "GET", "/metrics");
+  printf("  %zu connections, %zu requests in %.1f s: %.0f req/s\n",
+         size_t(count),
+         latency.size(),
+         elapsed,
+         latency.size() / elapsed);
+  printf("  Client latency: p50 %.0f us, p90 %.0f us, p99 %.0f us, max %.0f us\n",
+         pct(0.5),
+         pct(0.9),
+         pct(0.99),
+         pct(1.0));
+  if (metrics)
+    printf("  Server /metrics: %s\n", metrics->c_str());
+  remove("http_bench.sock");
+  if (bad || latency.empty()) {
+    printf("  FAILED: %zu connections broke or answered wrong\n", bad);
+    return 1;
+  }
+  return 0;
+}
@@ -2,141 +2,150 @@
  *
  **/
 
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <csignal>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #define USING_THREAD
 #ifdef USING_THREAD
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #endif
 
 #include "boost/sml.hpp"
 namespace sml = boost::sml;
 
-#if __has_include("wiringPi.h")
-#include "wiringPi.h"
-#define ON_RPI
-#endif
+#include "bitslice.hpp"
+#include "bringup.hpp"
+#include "busypoll.hpp"
+#include "envelope.hpp"
+#include "fade.hpp"
+#include "feed.hpp"
+#include "forecast.hpp"
+#include "gpio.hpp"
+#include "history.hpp"
+#include "http.hpp"
+#include "outputs.hpp"
+#include "pins.hpp"
+#include "pipeline.hpp"
+#include "pool.hpp"
+#include "reactor.hpp"
+#include "recorder.hpp"
+#include "rules.hpp"
+#include "sampler.hpp"
+#include "schedules.hpp"
+#include "standby.hpp"
+#include "storage.hpp"
+#include "tariff.hpp"
+#include "upgrade.hpp"
+#include "vgpio.hpp"
+#include "zonefile.hpp"
 
 namespace logger {
 struct fsm_logger {
+  using transition_sink =
+      std::function<void(const char *sm, const char *src, const char *dst)>;
+  std::vector<transition_sink> transition_sinks;
+
   template <class SM, class TEvent>
   void log_process_event(const TEvent &) {
-    printf("%s[event] %s\n",
-           sml::aux::get_type_name<SM>(),
-           sml::aux::get_type_name<TEvent>());
+    if (auto *rec = recorder::active)
+      rec->write(recorder::EVENT, name_id<SM>(), name_id<TEvent>());
+    else
+      printf("%s[event] %s\n",
+             sml::aux::get_type_name<SM>(),
+             sml::aux::get_type_name<TEvent>());
   }
   template <class SM, class TGuard, class TEvent>
   void log_guard(const TGuard &, const TEvent &, bool result) {
-    printf("%s[guard] %s %s %s\n",
-           sml::aux::get_type_name<SM>(),
-           sml::aux::get_type_name<TGuard>(),
-           sml::aux::get_type_name<TEvent>(),
-           (result ? "[OK]" : "[REJECTED]"));
+    if (auto *rec = recorder::active)
+      rec->write(recorder::GUARD, name_id<SM>(), name_id<TGuard>(), name_id<TEvent>(), result);
+    else
+      printf("%s[guard] %s %s %s\n",
+             sml::aux::get_type_name<SM>(),
+             sml::aux::get_type_name<TGuard>(),
+             sml::aux::get_type_name<TEvent>(),
+             (result ? "[OK]" : "[REJECTED]"));
   }
   template <class SM, class TAction, class TEvent>
   void log_action(const TAction &, const TEvent &) {
-    printf("%s[action] %s %s\n",
-           sml::aux::get_type_name<SM>(),
-           sml::aux::get_type_name<TAction>(),
-           sml::aux::get_type_name<TEvent>());
+    if (auto *rec = recorder::active)
+      rec->write(recorder::ACTION, name_id<SM>(), name_id<TAction>(), name_id<TEvent>());
+    else
+      printf("%s[action] %s %s\n",
+             sml::aux::get_type_name<SM>(),
+             sml::aux::get_type_name<TAction>(),
+             sml::aux::get_type_name<TEvent>());
   }
   template <class SM, class TSrcState, class TDstState>
   void log_state_change(const TSrcState &src, const TDstState &dst) {
-    printf("%s[transition] %s -> %s\n",
-           sml::aux::get_type_name<SM>(),
-           src.c_str(),
-           dst.c_str());
+    if (auto *rec = recorder::active)
+      rec->write(recorder::TRANSITION,
+                 name_id<SM>(),
+                 recorder::id_of<TSrcState>(src.c_str()),
+                 recorder::id_of<TDstState>(dst.c_str()));
+    else
+      printf("%s[transition] %s -> %s\n",
+             sml::aux::get_type_name<SM>(),
+             src.c_str(),
+             dst.c_str());
+    for (const auto &sink : transition_sinks)
+      sink(sml::aux::get_type_name<SM>(), src.c_str(), dst.c_str());
   }
-};
-}  // namespace logger
-
-namespace hw {
-enum LEVEL { LOW, HIGH };
-enum INPUT_MODE { PULL_DOWN, PULL_UP };
 
-template <auto Name, int Pin>
-struct output {
-  inline static bool last_value{false};
-
-  static constexpr auto setup = [] {
-#ifdef ON_RPI
-    pinMode(uint8_t(Pin), OUTPUT);
-#endif
-  };
-
-  static constexpr auto on = [] {
-#ifdef ON_RPI
-    digitalWrite(uint8_t(Pin), HIGH);
-#endif
-    if (!last_value) {
-      last_value = !last_value;
-      printf("  Output [%s] (%d) toggled HIGH\n", Name, Pin);
-    }
-  };
-
-  static constexpr auto off = [] {
-#ifdef ON_RPI
-    digitalWrite(uint8_t(Pin), LOW);
-#endif
-    if (last_value) {
-      last_value = !last_value;
-      printf("  Output [%s] (%d) toggled LOW\n", Name, Pin);
-    }
-  };
+ private:
+  template <class T>
+  static uint16_t name_id() {
+    return recorder::id_of<T>(sml::aux::get_type_name<T>());
+  }
 };
+}  // namespace logger
 
-template <auto Name, int Pin, INPUT_MODE Mode>
-struct input {
-  inline static bool last_value{false};
-
-  static constexpr auto setup = [] {
-#ifdef ON_RPI
-    pinMode(Pin, INPUT);
-    pullUpDnControl(Pin, Mode);
-#endif
-  };
+namespace ctrl {
+enum TIMESLOT { LONG, SHORT };
 
-  static constexpr auto toggled = [] {
-    bool is_pressed{};
-#ifdef ON_RPI
-    is_pressed = digitalRead(Pin);
+// STATE VARIABLES
+// Schedule of one light, the fsm actions work on the zone they are given
+struct zone {
+#ifdef USING_THREAD
+  std::atomic<TIMESLOT> active_timeslot = TIMESLOT::LONG;
+  std::atomic<int64_t> start_time_minutes{};
 #else
-    is_pressed = rand() % 1000 ? false : true;
+  TIMESLOT active_timeslot = TIMESLOT::LONG;
+  int64_t start_time_minutes{};
 #endif
-    if (last_value != is_pressed) {
-      last_value = is_pressed;
-      printf("  Input [%s] (%d) toggled '%s'\n",
-             Name,
-             Pin,
-             is_pressed ? "HIGH" : "LOW");
-      return true;
-    } else {
-      return false;
-    }
-  };
+  // Drives do_light and reports what it does, pool zones stay quiet
+  bool drives_light{false};
 };
 
-}  // namespace hw
-
-namespace ctrl {
-enum TIMESLOT { LONG, SHORT };
-
-// STATE VARIABLES
+static zone light{.drives_light = true};
 #ifdef USING_THREAD
-static std::atomic<TIMESLOT> active_timeslot = TIMESLOT::LONG;
-static std::atomic<int64_t> start_time_minutes{};
 static std::atomic<bool> task_running{false};
 static std::thread task_thread;
-#else
-static TIMESLOT active_timeslot = TIMESLOT::LONG;
-static int64_t start_time_minutes{};
+// Held by the task thread's passes and the main loop's light writes,
+// the task's wait between passes wakes when it is stopped
+static std::mutex light_mutex;
+static std::condition_variable task_wake;
 #endif
 
 // CONSTANTS
@@ -150,6 +159,8 @@ static constexpr const char do_light_name[6] = "light";
 using di_onoff = hw::input<di_onoff_name, 8, hw::INPUT_MODE::PULL_DOWN>;
 using di_mode  = hw::input<di_mode_name, 9, hw::INPUT_MODE::PULL_DOWN>;
 using do_light = hw::output<do_light_name, 10>;
+using inputs   = hw::input_group<di_onoff, di_mode>;
+enum INPUT_BIT : uint32_t { ONOFF = 1 << 0, MODE = 1 << 1 };
 
 // EVENTS
 struct turn_on {
@@ -157,16 +168,49 @@ struct turn_on {
 };
 struct turn_off {};
 struct change_on_time {};
+}  // namespace ctrl
+
+// A turn_on travels as its start minute, an unparsable start time as an
+// empty one that the guard rejects
+template <>
+struct events::codec<ctrl::turn_on> {
+  static constexpr uint16_t invalid = 0xffff;
+
+  // HH:MM or HH.MM, range checks are left to the guard
+  static uint16_t pack(const ctrl::turn_on &e) {
+    const auto &t = e.time_on;
+    auto digit    = [&](size_t i) { return unsigned(t[i] - '0') < 10; };
+    if (t.size() != 5 || (t[2] != ':' && t[2] != '.') || !digit(0) || !digit(1) || !digit(3) ||
+        !digit(4))
+      return invalid;
+    return uint16_t(((t[0] - '0') * 10 + t[1] - '0') * 60 + (t[3] - '0') * 10 + t[4] - '0');
+  }
+  static ctrl::turn_on unpack(uint16_t minute) {
+    if (minute == invalid)
+      return {};
+    const unsigned hour  = std::min(minute / 60u, 99u);  // Out of range, the guard rejects it
+    const char time_on[] = {char('0' + hour / 10),
+                            char('0' + hour % 10),
+                            ':',
+                            char('0' + minute % 60u / 10),
+                            char('0' + minute % 10),
+                            '\0'};
+    return {time_on};
+  }
+};
+
+namespace ctrl {
+using event_dispatch = events::dispatcher<turn_on, turn_off, change_on_time>;
 
 // EVENT GUARDS
 struct turn_on_guard {
   bool operator()(const turn_on &e) const {
-    if (e.time_on.length() < 5) {
-      printf("  Start time field too short: %s\n", e.time_on.c_str());
+    // Exactly HH:MM or HH.MM, the time is echoed into JSON and logs as is
+    if (e.time_on.length() != 5) {
+      printf("  Start time field not HH:MM\n");
       return false;
     }
-    if (e.time_on.find(":") == std::string::npos &&
-        e.time_on.find(".") == std::string::npos) {
+    if (e.time_on[2] != ':' && e.time_on[2] != '.') {
       printf("  Missing start time separator: %s\n", e.time_on.c_str());
       return false;
     }
@@ -199,22 +243,12 @@ class on;
 class off;
 
 // TASKS
-void iterate_task() {
-  std::time_t now;
-  std::time(&now);
-  std::tm *curtime    = std::localtime(&now);
-  const auto now_time = curtime->tm_hour * 60L + curtime->tm_min;
-
-#ifdef USING_THREAD
-  const auto start_time = start_time_minutes.load();
-#else
-  const auto start_time = start_time_minutes;
-#endif
-
+// Minutes past 00:00 the timeslot started at 'start_time' ends
+int64_t stop_minute(int64_t start_time, TIMESLOT slot) {
   std::string dur_time_s;
-  if (active_timeslot == TIMESLOT::LONG) {
+  if (slot == TIMESLOT::LONG) {
     dur_time_s = long_on_time;
-  } else if (active_timeslot == TIMESLOT::SHORT) {
+  } else if (slot == TIMESLOT::SHORT) {
     dur_time_s = short_on_time;
   } else {
     assert(false);
@@ -223,79 +257,128 @@ void iterate_task() {
   const auto duration_hour   = std::stoi(dur_time_s.substr(0, 2));
   const auto duration_minute = std::stoi(dur_time_s.substr(3, 2));
   const auto duration_time   = duration_hour * 60 + duration_minute;
-  const auto stop_time       = (start_time + duration_time) % (24L * 60L);
-  const auto stop_next_day   = (stop_time < start_time);
+  return (start_time + duration_time) % (24L * 60L);
+}
 
-  if (stop_next_day) {
-    if (start_time < now_time)
-      do_light::on();
-    else
-      do_light::off();
-  } else {
-    if (now_time < stop_time)
-      do_light::on();
-    else
-      do_light::off();
-  }
+// Whether the schedule of 'z' has the light on 'now_time' minutes past 00:00
+bool scheduled_on(const zone &z, int64_t now_time) {
+#ifdef USING_THREAD
+  const auto start_time = z.start_time_minutes.load();
+#else
+  const auto start_time = z.start_time_minutes;
+#endif
+
+  const auto stop_time     = stop_minute(start_time, z.active_timeslot);
+  const auto stop_next_day = (stop_time < start_time);
+
+  // On from the start minute until the timeslot ran out, across
+  // midnight if it has to
+  if (stop_next_day)
+    return start_time <= now_time || now_time < stop_time;
+  else
+    return start_time <= now_time && now_time < stop_time;
+}
+
+// Minutes past 00:00, local time, from any thread
+int64_t minutes_now() {
+  std::time_t now;
+  std::time(&now);
+  std::tm curtime{};
+  localtime_r(&now, &curtime);
+  return curtime.tm_hour * 60L + curtime.tm_min;
+}
+
+void iterate_task(const zone &z) {
+  if (scheduled_on(z, minutes_now()))
+    do_light::on();
+  else
+    do_light::off();
 }
 
 // ACTIONS
 struct on_action {
-  void operator()(const turn_on &a) {
-    printf("  Starting with 'on_time=%s'\n", a.time_on.c_str());
+  void operator()(const turn_on &a, zone &z) {
+    if (z.drives_light) {
+      printf("  Starting with 'on_time=%s'\n", a.time_on.c_str());
 #ifdef USING_THREAD
-    if (!task_running.load()) {
-      task_running.exchange(true);
-      // task_thread = std::thread(&timer_task);
-      task_thread = std::thread([&]() {
-        while (task_running.load()) {
-          iterate_task();
-          using namespace std::chrono_literals;
-          std::this_thread::sleep_for(1ms);
-        }
-      });
-      printf("  Task thread started\n");
-    }
+      if (!task_running.load()) {
+        task_running.exchange(true);
+        // task_thread = std::thread(&timer_task);
+        task_thread = std::thread([&z]() {
+          std::unique_lock lock{light_mutex};
+          while (task_running.load()) {
+            iterate_task(z);
+            using namespace std::chrono_literals;
+            task_wake.wait_for(lock, 1ms);
+          }
+        });
+        printf("  Task thread started\n");
+      }
 #endif
+    }
     const auto on_hour   = std::stoi(a.time_on.substr(0, 2));
     const auto on_minute = std::stoi(a.time_on.substr(3, 2));
-    start_time_minutes   = on_hour * 60 + on_minute;
+    z.start_time_minutes = on_hour * 60 + on_minute;
   };
 } on_action;
 
-struct off_action {
-  void operator()() {
+// Stops driving the light from the task thread, leaves the output as is
+void stop_task() {
 #ifdef USING_THREAD
-    if (task_running.load()) {
+  if (task_running.load()) {
+    {
+      const std::lock_guard lock{light_mutex};
       task_running.exchange(false);
-      task_thread.join();
-      printf("  Task thread joined\n");
     }
+    task_wake.notify_one();
+    task_thread.join();
+    printf("  Task thread joined\n");
+  }
 #endif
+}
+
+struct off_action {
+  void operator()(zone &z) {
+    if (!z.drives_light)
+      return;
+    stop_task();
     do_light::off();
   };
 } off_action;
 
+// The light as the main loop drives it, right away on an edge. The task
+// thread decides the same level from the same zone, and the lock keeps
+// its decision and write together, so it never writes back an older one.
+struct main_light {
+  static void on() {
+#ifdef USING_THREAD
+    const std::lock_guard lock{light_mutex};
+#endif
+    do_light::on();
+  }
+  static void off() {
+#ifdef USING_THREAD
+    const std::lock_guard lock{light_mutex};
+#endif
+    do_light::off();
+  }
+};
+
 struct change_on_time_action {
-  void operator()() {
-    if (active_timeslot == TIMESLOT::SHORT)
-      active_timeslot = TIMESLOT::LONG;
+  void operator()(zone &z) {
+    if (z.active_timeslot == TIMESLOT::SHORT)
+      z.active_timeslot = TIMESLOT::LONG;
     else
-      active_timeslot = TIMESLOT::SHORT;
+      z.active_timeslot = TIMESLOT::SHORT;
 
-    printf("  Set TIMESLOT=%s\n",
-           active_timeslot == TIMESLOT::SHORT ? "SHORT" : "LONG");
+    if (z.drives_light)
+      printf("  Set TIMESLOT=%s\n",
+             z.active_timeslot == TIMESLOT::SHORT ? "SHORT" : "LONG");
   }
 } change_on_time_action;
 
 // TABLE
 struct fsm {
-  constexpr fsm() {
-    di_onoff::setup();
-    di_mode::setup();
-    do_light::setup();
-  }
-
   auto operator()() const noexcept {
     using namespace sml;
     // clang-format off
@@ -303,14 +386,901 @@ struct fsm {
     // STATE ------ EVENT ---------------- GUARD ---------- ACTION ---------------- STATE ----- //
       *state<off> + event<turn_on>        [turn_on_guard] / on_action             = state<on>,
        state<on>  + event<turn_off>                       / off_action            = state<off>,
+       state<on>  + event<turn_on>        [turn_on_guard] / on_action             = state<on>,
     // ---------------------------------------------------------------------------------------- //
        state<on>  + event<change_on_time>                 / change_on_time_action = state<on>);
     // ---------------------------------------------------------------------------------------- //
     // clang-format on
   }
 };
+
+// HARDWARE SETUP
+void setup() {
+  di_onoff::setup();
+  di_mode::setup();
+  do_light::setup();
+}
+
+// ZONE POOL
+// Zones beyond the physical light, driven in batches through zones::pool
+struct pool_traits {
+  using zone_type = zone;
+  using sm_type   = sml::sm<fsm>;
+
+  enum EVENT : uint16_t {
+    TURN_ON        = event_dispatch::tag<turn_on>,
+    TURN_OFF       = event_dispatch::tag<turn_off>,
+    CHANGE_ON_TIME = event_dispatch::tag<change_on_time>
+  };
+  static constexpr size_t event_types   = 3;
+  static constexpr size_t states        = 2;
+  static constexpr size_t default_state = 0;
+
+  static size_t state(sm_type &sm) { return sm.is(sml::state<on>); }
+
+  // The start time is rewritten by every turn_on, only the timeslot sticks
+  static bool is_default(sm_type &sm, const zone &z) {
+    return sm.is(sml::state<off>) && z.active_timeslot == TIMESLOT::LONG;
+  }
+  static void reset(zone &z) { z.start_time_minutes = 0; }
+
+  static bool dispatch(sm_type &sm, const zones::event &e) {
+    return event_dispatch::process(sm, {e.type, e.arg, e.zone, 0});
+  }
+};
+using zone_pool = zones::pool<pool_traits>;
+
+static_assert(int(pool_traits::TURN_ON) == bitslice::TURN_ON &&
+              int(pool_traits::TURN_OFF) == bitslice::TURN_OFF &&
+              int(pool_traits::CHANGE_ON_TIME) == bitslice::CHANGE_ON_TIME);
+
+// Zones where the bit-sliced engine disagrees with the sml pool. Start
+// times only count while on, the pool drops them when reclaiming a zone.
+size_t mismatches(zone_pool &pool, const bitslice::engine &bits) {
+  size_t count = 0;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    const auto &z   = pool.zone(i);
+    const bool on   = pool.state(i);
+    const bool diff = on != bits.is_on(i) ||
+                      (z.active_timeslot == TIMESLOT::SHORT) != bits.is_short(i) ||
+                      (on && z.start_time_minutes != bits.start(i));
+    count += diff;
+  }
+  return count;
+}
+
+// Output level of zone 'i' from whichever engine runs the zones
+bool zone_output(zone_pool *pool, const bitslice::engine *bits, size_t i, int64_t now_time) {
+  if (pool)
+    return i < pool->size() && pool->state(i) && scheduled_on(pool->zone(i), now_time);
+  zone z;
+  z.active_timeslot    = bits->is_short(i) ? TIMESLOT::SHORT : TIMESLOT::LONG;
+  z.start_time_minutes = bits->start(i);
+  return i < bits->size() && bits->is_on(i) && scheduled_on(z, now_time);
+}
+
+bool scheduled_on(schedules::key k, int64_t now_time) {
+  zone z;
+  z.active_timeslot    = k.short_slot ? TIMESLOT::SHORT : TIMESLOT::LONG;
+  z.start_time_minutes = k.start;
+  return scheduled_on(z, now_time);
+}
+
+// Minutes of the day the schedule 'k' can switch at, scheduled_on()
+// compares against its start and stop minute
+std::vector<uint16_t> schedule_edges(schedules::key k) {
+  const auto stop = uint16_t(stop_minute(k.start, k.short_slot ? TIMESLOT::SHORT : TIMESLOT::LONG));
+  return {k.start, uint16_t(k.start + 1), stop, uint16_t(stop + 1)};
+}
+
+// Schedule of zone 'i' while it is on
+std::optional<schedules::key> zone_schedule(zone_pool *pool, const bitslice::engine *bits, size_t i) {
+  if (pool) {
+    if (i >= pool->size() || !pool->state(i))
+      return std::nullopt;
+    const auto &z = pool->zone(i);
+    return schedules::key{uint16_t(z.start_time_minutes), z.active_timeslot == TIMESLOT::SHORT};
+  }
+  if (i >= bits->size() || !bits->is_on(i))
+    return std::nullopt;
+  return schedules::key{bits->start(i), bits->is_short(i)};
+}
+
+// Zones that differ from the default, to carry them across an upgrade
+std::vector<upgrade::zone_state> zone_states(zone_pool *pool, const bitslice::engine *bits) {
+  std::vector<upgrade::zone_state> states;
+  if (pool) {
+    pool->for_each_touched([&](size_t i, const zone &z, pool_traits::sm_type &sm) {
+      const bool on         = pool_traits::state(sm);
+      const bool short_slot = z.active_timeslot == TIMESLOT::SHORT;
+      if (on || short_slot)
+        states.push_back({uint32_t(i), uint16_t(z.start_time_minutes), on, short_slot});
+    });
+  } else if (bits) {
+    for (size_t i = 0; i < bits->size(); ++i)
+      if (bits->is_on(i) || bits->is_short(i))
+        states.push_back({uint32_t(i), bits->start(i), bits->is_on(i), bits->is_short(i)});
+  }
+  return states;
+}
+
+// The events that take default zones to 'states'
+std::vector<zones::event> replay(const std::vector<upgrade::zone_state> &states) {
+  std::vector<zones::event> events;
+  for (const auto &s : states) {
+    events.push_back({s.zone, pool_traits::TURN_ON, s.start});
+    if (s.short_slot)
+      events.push_back({s.zone, pool_traits::CHANGE_ON_TIME, 0});
+    if (!s.on)
+      events.push_back({s.zone, pool_traits::TURN_OFF, 0});
+  }
+  return events;
+}
 }  // namespace ctrl
 
+namespace api {
+using recent_history = logger::history<64 * 1024>;
+
+// Too big for the inline body, sent from a memfd
+inline void send_large(http::response &res, const std::string &body) {
+  const int fd = memfd_create("light_controller-response", MFD_CLOEXEC);
+  if (fd < 0 || !upgrade::write_all(fd, body.data(), body.size())) {
+    if (fd >= 0)
+      close(fd);
+    res.status(500);
+    res.type("application/json");
+    res.printf("{\"error\":\"no memory for the response\"}");
+    return;
+  }
+  res.file(fd, 0, body.size());
+}
+
+// Formats the status object like snprintf, shared by the API and the feed
+template <class SM>
+int status(SM &sm, const std::string &on_time, char *buf, size_t capacity) {
+  using namespace ctrl;
+  return snprintf(buf,
+                  capacity,
+                  "{\"state\":\"%s\",\"on_time\":\"%s\","
+                  "\"timeslot\":\"%s\",\"light\":%s}",
+                  sm.is(sml::state<on>) ? "on" : "off",
+                  on_time.c_str(),
+                  light.active_timeslot == TIMESLOT::SHORT ? "SHORT" : "LONG",
+                  do_light::last_value ? "true" : "false");
+}
+
+template <class SM>
+void status(SM &sm, const std::string &on_time, http::response &res) {
+  res.format([&](char *buf, size_t capacity) {
+    return status(sm, on_time, buf, capacity);
+  });
+}
+
+template <class SM>
+void install(http::server &server,
+             SM &sm,
+             std::string &on_time,
+             const recent_history &recent,
+             const std::optional<std::string> &history_file) {
+  using namespace ctrl;
+
+  server.route("GET", "/status", [&](const http::request &, http::response &res) {
+    status(sm, on_time, res);
+  });
+
+  server.route("GET", "/metrics", [&](const http::request &, http::response &res) {
+    const auto &st = server.stats();
+    res.printf(
+        "{\"requests\":%llu,\"errors\":%llu,\"latency_us\":"
+        "{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu}}",
+        (unsigned long long)st.requests,
+        (unsigned long long)st.errors,
+        (unsigned long long)st.percentile_us(0.50),
+        (unsigned long long)st.percentile_us(0.90),
+        (unsigned long long)st.percentile_us(0.99));
+  });
+
+  // Body '{"on_time":"HH:MM","timeslot":"LONG|SHORT"}', both optional
+  server.route("PUT", "/schedule", [&](const http::request &req, http::response &res) {
+    const auto time_on  = http::json_field(req.body, "on_time");
+    const auto timeslot = http::json_field(req.body, "timeslot");
+
+    if (!time_on.empty()) {
+      const turn_on event{std::string(time_on)};
+      if (!turn_on_guard(event)) {
+        res.status(400);
+        res.printf("{\"error\":\"invalid on_time\"}");
+        return;
+      }
+      on_time = event.time_on;
+      if (sm.is(sml::state<on>))
+        sm.process_event(event);
+    }
+
+    if (!timeslot.empty()) {
+      if (timeslot != "LONG" && timeslot != "SHORT") {
+        res.status(400);
+        res.printf("{\"error\":\"invalid timeslot\"}");
+        return;
+      }
+      const auto wanted = timeslot == "SHORT" ? TIMESLOT::SHORT : TIMESLOT::LONG;
+      if (wanted != light.active_timeslot && !sm.process_event(change_on_time{})) {
+        res.status(409);
+        res.printf("{\"error\":\"timeslot can only change while on\"}");
+        return;
+      }
+    }
+    status(sm, on_time, res);
+  });
+
+  server.route("POST", "/event/*", [&](const http::request &req, http::response &res) {
+    const auto name = req.path.substr(req.path.rfind('/') + 1);
+    bool handled{};
+    if (name == "turn_on") {
+      const auto time_on = http::json_field(req.body, "on_time");
+      const turn_on event{time_on.empty() ? on_time : std::string(time_on)};
+      handled = sm.process_event(event);
+      if (handled)
+        on_time = event.time_on;
+    } else if (name == "turn_off") {
+      handled = sm.process_event(turn_off{});
+    } else if (name == "change_on_time") {
+      handled = sm.process_event(change_on_time{});
+    } else {
+      res.status(404);
+      res.printf("{\"error\":\"unknown event\"}");
+      return;
+    }
+    if (!handled)
+      res.status(409);
+    status(sm, on_time, res);
+  });
+
+  // A body of raw events::envelope records, processed in order. Only zone
+  // 0, the light, is served here, pool zones go through /zones/events.
+  server.route("POST", "/events", [&](const http::request &req, http::response &res) {
+    const size_t count = req.body.size() / sizeof(events::envelope);
+    size_t handled = 0, rejected = 0;
+    for (size_t i = 0; i < count; ++i) {
+      events::envelope env;
+      std::memcpy(&env, req.body.data() + i * sizeof(env), sizeof(env));
+      if (env.zone != 0) {
+        ++rejected;
+        continue;
+      }
+      if (!event_dispatch::process(sm, env))
+        continue;
+      ++handled;
+      if (env.type == event_dispatch::tag<turn_on>)
+        on_time = events::codec<turn_on>::unpack(env.arg).time_on;
+    }
+    res.printf("{\"events\":%zu,\"handled\":%zu,\"rejected\":%zu}", count, handled, rejected);
+  });
+
+  // Recent transitions from memory, '?all' streams the history file
+  server.route("GET", "/history", [&](const http::request &req, http::response &res) {
+    res.type("application/x-ndjson");
+    if (req.query == "all" && history_file) {
+      const int fd = open(history_file->c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st {};
+      if (fd >= 0 && fstat(fd, &st) == 0) {
+        res.file(fd, 0, st.st_size);
+        return;
+      }
+      if (fd >= 0)
+        close(fd);
+    }
+    // A copy, the ring can move on while a slow client still reads
+    iovec iov[2];
+    const size_t n = recent.segments(iov);
+    std::string out;
+    for (size_t i = 0; i < n; ++i)
+      out.append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+    send_large(res, out);
+  });
+}
+
+inline void install_feed(http::server &server, const feed::publisher &publisher) {
+  server.route("GET", "/feed", [&](const http::request &, http::response &res) {
+    const auto &st = publisher.stats();
+    res.printf(
+        "{\"subscribers\":%llu,\"published\":%llu,\"bytes_sent\":%llu,"
+        "\"resyncs\":%llu,\"oversized\":%llu}",
+        (unsigned long long)st.subscribers,
+        (unsigned long long)st.published,
+        (unsigned long long)st.bytes_sent,
+        (unsigned long long)st.resyncs,
+        (unsigned long long)st.oversized);
+  });
+}
+
+inline void install_store(http::server &server, const storage::store &store) {
+  server.route("GET", "/store", [&](const http::request &, http::response &res) {
+    const auto st  = store.stats();
+    const auto now = storage::now_ns();
+    res.printf(
+        "{\"logical_bytes\":%llu,\"physical_bytes\":%llu,\"flushes\":%llu,"
+        "\"write_amplification\":%.3f,\"bytes_per_day\":%.0f,"
+        "\"compacted_segments\":%llu,\"segments\":[",
+        (unsigned long long)st.logical_bytes,
+        (unsigned long long)st.physical_bytes,
+        (unsigned long long)st.flushes,
+        st.write_amplification(),
+        st.bytes_per_day(now),
+        (unsigned long long)st.compacted_segments);
+    const auto ids = store.segments();
+    for (size_t i = 0; i < ids.size(); ++i)
+      res.printf("%s%u", i ? "," : "", ids[i]);
+    res.printf("]}");
+  });
+
+  // Raw segment file, '/store/segment?ID', for offline analysis
+  server.route("GET", "/store/segment", [&](const http::request &req, http::response &res) {
+    const auto id = std::strtoul(std::string(req.query).c_str(), nullptr, 10);
+    const int fd  = open(store.segment_path(uint32_t(id)).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0)
+        close(fd);
+      res.status(404);
+      res.printf("{\"error\":\"no such segment\"}");
+      return;
+    }
+    res.type("application/octet-stream");
+    res.file(fd, 0, st.st_size);
+  });
+}
+
+inline void install_sampler(http::server &server, const hw::adaptive_sampler &sampler) {
+  server.route("GET", "/inputs", [&](const http::request &, http::response &res) {
+    const auto &st = sampler.stats();
+    res.printf(
+        "{\"wakeups\":%llu,\"wakeups_per_hour\":%.0f,\"edges\":%llu,"
+        "\"detection_latency_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%lld}}",
+        (unsigned long long)st.wakeups,
+        st.wakeups_per_hour(hw::adaptive_sampler::clock::now()),
+        (unsigned long long)st.edges,
+        (unsigned long long)st.percentile_us(0.50),
+        (unsigned long long)st.percentile_us(0.99),
+        (long long)st.max_latency.count());
+  });
+}
+
+inline void install_mirror(http::server &server, const standby::mirror &mirror) {
+  server.route("GET", "/standby", [&](const http::request &, http::response &res) {
+    res.printf("{\"owner\":%s,\"takeovers\":%llu,\"last_gap_us\":%llu}",
+               mirror.owned() ? "true" : "false",
+               (unsigned long long)mirror.takeovers(),
+               (unsigned long long)mirror.last_gap_us());
+  });
+}
+
+// The main loop upgrades once the current request is answered
+inline void install_upgrade(http::server &server, volatile std::sig_atomic_t &requested) {
+  server.route("POST", "/upgrade", [&](const http::request &, http::response &res) {
+    requested = 1;
+    res.printf("{\"upgrading\":true}");
+  });
+}
+
+inline void install_bringup(http::server &server, const bringup::plan &plan) {
+  server.route("GET", "/bringup", [&](const http::request &, http::response &res) {
+    res.printf("{\"total_ms\":%.3f,\"tasks\":[", bringup::plan::ms(plan.total()));
+    const auto reports = plan.reports();
+    for (size_t i = 0; i < reports.size(); ++i) {
+      const auto &r = reports[i];
+      res.printf("%s{\"name\":\"%s\",\"after\":\"%s\",\"state\":\"%s\","
+                 "\"waited_ms\":%.3f,\"ready_ms\":%.3f}",
+                 i ? "," : "",
+                 r.name.c_str(),
+                 r.after.empty() ? "" : r.after.front().c_str(),
+                 r.skipped ? "skipped" : r.ok ? "ready" : "failed",
+                 bringup::plan::ms(r.waited),
+                 bringup::plan::ms(r.ready_at));
+    }
+    res.printf("]}");
+  });
+}
+
+inline void install_schedules(http::server &server, const schedules::table &table) {
+  server.route("GET", "/schedules", [&](const http::request &, http::response &res) {
+    const auto &st = table.stats();
+    res.printf("{\"zones\":%zu,\"unique\":%zu,\"evaluations\":%llu,\"decided\":%llu,"
+               "\"moves\":%llu,\"last_evaluate_ns\":%llu}",
+               table.zones(),
+               table.unique(),
+               (unsigned long long)st.evaluations,
+               (unsigned long long)st.decided,
+               (unsigned long long)st.moves,
+               (unsigned long long)st.last_evaluate_ns);
+  });
+}
+
+inline void install_fades(http::server &server, const fade::engine &fades) {
+  server.route("GET", "/fades", [&](const http::request &, http::response &res) {
+    const auto &st = fades.stats();
+    res.printf("{\"channels\":%zu,\"ramping\":%zu,\"frames\":%llu,\"stepped\":%llu,"
+               "\"emitted\":%llu,\"started\":%llu,\"finished\":%llu,\"last_step_ns\":%llu}",
+               fades.channels(),
+               fades.ramping(),
+               (unsigned long long)st.frames,
+               (unsigned long long)st.stepped,
+               (unsigned long long)st.emitted,
+               (unsigned long long)st.started,
+               (unsigned long long)st.finished,
+               (unsigned long long)st.last_step_ns);
+  });
+}
+
+// Batches of '<zone>[-<zone>] <signal> <0|1>' lines set the signals the
+// rules read, 'schedule' is the controller's own. 'after_batch' runs
+// after every batch.
+inline void install_rules(http::server &server, rules::engine &gates, const std::function<void()> &after_batch) {
+  server.route("POST", "/rules/signals", [&](const http::request &req, http::response &res) {
+    size_t set = 0, malformed = 0;
+    std::string_view body = req.body;
+    while (!body.empty()) {
+      const auto eol  = body.find('\n');
+      const auto line = body.substr(0, eol);
+      body.remove_prefix(eol == std::string_view::npos ? body.size() : eol + 1);
+      if (line.empty())
+        continue;
+
+      unsigned from, to, value;
+      char name[32];
+      const auto text = std::string(line);
+      int n           = sscanf(text.c_str(), "%u-%u %31s %u", &from, &to, name, &value);
+      if (n != 4) {
+        n  = sscanf(text.c_str(), "%u %31s %u", &from, name, &value) + 1;
+        to = from;
+      }
+      const auto signal = gates.signal(name);
+      if (n != 4 || value > 1 || to < from || to >= gates.zones() || !signal ||
+          std::string_view(name) == "schedule") {
+        ++malformed;
+        continue;
+      }
+      for (size_t z = from; z <= to; ++z)
+        gates.set(*signal, z, value);
+      ++set;
+    }
+    if (set && after_batch)
+      after_batch();
+    res.printf("{\"set\":%zu,\"malformed\":%zu}", set, malformed);
+  });
+
+  server.route("GET", "/rules", [&](const http::request &, http::response &res) {
+    size_t governed = 0, on = 0;
+    for (size_t w = 0; w < gates.governed().size(); ++w) {
+      governed += size_t(__builtin_popcountll(gates.governed()[w]));
+      on += size_t(__builtin_popcountll(gates.governed()[w] & gates.outputs()[w]));
+    }
+    res.printf("{\"rules\":%zu,\"governed\":%zu,\"on\":%zu,\"signals\":[", gates.rules(), governed, on);
+    for (size_t i = 0; i < gates.signals().size(); ++i)
+      res.printf("%s\"%s\"", i ? "," : "", gates.signals()[i].c_str());
+    res.printf("]}");
+  });
+}
+
+inline void install_pins(http::server &server, const hw::pin_table &pins) {
+  server.route("GET", "/pins", [&](const http::request &, http::response &res) {
+    res.printf("[");
+    for (size_t i = 0; i < pins.size(); ++i) {
+      const auto &d = pins.at(i);
+      res.printf("%s{\"name\":\"%s\",\"pin\":%d,\"bank\":%u,\"dir\":\"%s\",\"level\":%s}",
+                 i ? "," : "",
+                 d.name,
+                 d.pin,
+                 unsigned(d.bank),
+                 d.output ? "out" : "in",
+                 pins.level(i) ? "true" : "false");
+    }
+    res.printf("]");
+  });
+}
+
+inline void install_recorder(http::server &server, const recorder::ring &flight) {
+  server.route("GET", "/recorder", [&](const http::request &, http::response &res) {
+    res.printf("{\"written\":%llu,\"capacity\":%llu,\"unnamed\":%u}",
+               (unsigned long long)flight.written(),
+               (unsigned long long)flight.capacity(),
+               flight.overflow());
+  });
+}
+
+inline void install_busy(http::server &server, const hw::busy_poller &busy) {
+  server.route("GET", "/inputs/busy", [&](const http::request &, http::response &res) {
+    const auto &st = busy.stats();
+    res.printf(
+        "{\"reads\":%llu,\"edges\":%llu,\"yields\":%llu,"
+        "\"response_ns\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},"
+        "\"driven\":%llu,\"edge_to_output_ns\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu}}",
+        (unsigned long long)st.reads,
+        (unsigned long long)st.edges,
+        (unsigned long long)st.yields,
+        (unsigned long long)st.percentile_ns(0.50),
+        (unsigned long long)st.percentile_ns(0.99),
+        (unsigned long long)st.max_latency_ns,
+        (unsigned long long)st.driven,
+        (unsigned long long)st.output_percentile_ns(0.50),
+        (unsigned long long)st.output_percentile_ns(0.99),
+        (unsigned long long)st.max_output_ns);
+  });
+}
+
+inline void install_vgpio(http::server &server, const vgpio::backend &lines) {
+  server.route("GET", "/vgpio", [&](const http::request &, http::response &res) {
+    const auto st = lines.stats();
+    res.printf(
+        "{\"requests\":%llu,\"round_trip_ns\":{\"mean\":%llu,\"max\":%llu},"
+        "\"events\":%llu,\"dropped\":%llu,\"event_ns\":{\"p50\":%llu,\"p99\":%llu}}",
+        (unsigned long long)st.requests,
+        (unsigned long long)(st.requests ? st.round_trip_ns / st.requests : 0),
+        (unsigned long long)st.max_round_trip_ns,
+        (unsigned long long)st.events,
+        (unsigned long long)lines.dropped(),
+        (unsigned long long)st.percentile_ns(0.50),
+        (unsigned long long)st.percentile_ns(0.99));
+  });
+}
+
+// Batches of '<zone> <turn_on|turn_off|change_on_time> [HH:MM]' lines, lines
+// that do not parse or hold no valid time are counted as malformed.
+// Either engine may be null, with both every batch is cross-checked.
+// 'after_batch' runs after every batch, once it is set.
+using zone_batch_hook = std::function<void(const std::vector<zones::event> &)>;
+inline void install_zones(http::server &server,
+                          ctrl::zone_pool *pool,
+                          bitslice::engine *bits,
+                          const zone_batch_hook &after_batch) {
+  using traits = ctrl::pool_traits;
+  using clock  = std::chrono::steady_clock;
+  static std::vector<zones::event> batch;
+  static uint64_t pool_ns, bits_ns;
+
+  server.route("POST", "/zones/events", [=, &after_batch](const http::request &req, http::response &res) {
+    batch.clear();
+    size_t malformed      = 0;
+    std::string_view body = req.body;
+    while (!body.empty()) {
+      const auto eol = body.find('\n');
+      const auto line = body.substr(0, eol);
+      body.remove_prefix(eol == std::string_view::npos ? body.size() : eol + 1);
+      if (line.empty())
+        continue;
+
+      unsigned zone, hour = 0, minute = 0;
+      char name[16];
+      const int n = sscanf(std::string(line).c_str(), "%u %15s %u:%u", &zone, name, &hour, &minute);
+      if (n < 2 || hour >= 24 || minute >= 60) {
+        ++malformed;
+        continue;
+      }
+      const std::string_view type = name;
+      zones::event e{zone, 0, uint16_t(hour * 60 + minute)};
+      if (type == "turn_on" && n == 4)
+        e.type = traits::TURN_ON;
+      else if (type == "turn_off")
+        e.type = traits::TURN_OFF;
+      else if (type == "change_on_time")
+        e.type = traits::CHANGE_ON_TIME;
+      else {
+        ++malformed;
+        continue;
+      }
+      batch.push_back(e);
+    }
+
+    size_t handled = 0;
+    auto timed     = [&](uint64_t &total, auto &&run) {
+      const auto start = clock::now();
+      handled          = run();
+      total += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    };
+    if (bits)
+      timed(bits_ns, [&] { return bits->process_events(batch); });
+    if (pool)
+      timed(pool_ns, [&] { return pool->process_events(batch); });
+    if (after_batch)
+      after_batch(batch);
+    res.printf("{\"events\":%zu,\"handled\":%zu,\"malformed\":%zu}", batch.size(), handled, malformed);
+  });
+
+  server.route("GET", "/zones", [=](const http::request &, http::response &res) {
+    res.printf("{\"zones\":%zu", pool ? pool->size() : bits->size());
+    if (pool) {
+      size_t on = 0;
+      pool->for_each_touched([&](size_t, const ctrl::zone &, traits::sm_type &sm) {
+        on += traits::state(sm);
+      });
+      const auto &st = pool->stats();
+      res.printf(
+          ",\"on\":%zu,\"materialized\":%zu,\"memory_bytes\":%zu,"
+          "\"first_touch_ns\":%llu,\"batches\":%llu,\"events\":%llu,"
+          "\"handled\":%llu,\"rounds\":%llu,\"process_ns\":%llu",
+          on,
+          pool->live(),
+          pool->memory_bytes(),
+          (unsigned long long)(st.materialized ? st.first_touch_ns / st.materialized : 0),
+          (unsigned long long)st.batches,
+          (unsigned long long)st.events,
+          (unsigned long long)st.handled,
+          (unsigned long long)st.rounds,
+          (unsigned long long)pool_ns);
+    }
+    if (bits)
+      res.printf(",\"bitslice\":{\"on\":%zu,\"memory_bytes\":%zu,\"process_ns\":%llu}",
+                 bits->count_on(),
+                 bits->memory_bytes(),
+                 (unsigned long long)bits_ns);
+    if (pool && bits)
+      res.printf(",\"mismatches\":%zu", ctrl::mismatches(*pool, *bits));
+    res.printf("}");
+  });
+}
+
+// Upcoming transitions over '/forecast?days=7', one line per zone, or of
+// one zone with 'zone=N'. Zones on the same schedule share theirs.
+inline void install_forecast(http::server &server, ctrl::zone_pool *pool, bitslice::engine *bits) {
+  server.route("GET", "/forecast", [=](const http::request &req, http::response &res) {
+    const auto zones    = pool ? pool->size() : bits->size();
+    const auto zone_arg = http::query_field(req.query, "zone");
+    const auto days_arg = http::query_field(req.query, "days");
+    const auto days     = days_arg.empty() ? 7 : std::strtoul(std::string(days_arg).c_str(), nullptr, 10);
+    size_t first = 0, last = zones;
+    if (!zone_arg.empty()) {
+      first = std::strtoul(std::string(zone_arg).c_str(), nullptr, 10);
+      last  = first + 1;
+    }
+    if (first >= zones || days < 1 || days > 366) {
+      res.status(400);
+      res.printf("{\"error\":\"zone below %zu and 1 to 366 days\"}", zones);
+      return;
+    }
+
+    forecast::calendar cal{int64_t(std::time(nullptr)), unsigned(days)};
+    struct schedule_forecast {
+      bool on;
+      std::vector<forecast::transition> transitions;
+    };
+    std::unordered_map<uint32_t, schedule_forecast> by_schedule;
+    std::string out;
+    auto append = [&out](const char *fmt, auto... args) {
+      char line[96];
+      const int n = snprintf(line, sizeof(line), fmt, args...);
+      out.append(line, std::min(size_t(std::max(n, 0)), sizeof(line) - 1));
+    };
+    for (size_t i = first; i < last; ++i) {
+      const auto k = ctrl::zone_schedule(pool, bits, i);
+      if (!k) {
+        append("{\"zone\":%zu,\"on\":false,\"transitions\":[]}\n", i);
+        continue;
+      }
+      auto [it, added] = by_schedule.try_emplace(k->packed());
+      if (added) {
+        const auto p = forecast::make_profile([&](uint16_t m) { return ctrl::scheduled_on(*k, m); },
+                                              ctrl::schedule_edges(*k));
+        it->second.on = forecast::on_at(p, cal.minute_now());
+        forecast::transitions(p, cal, it->second.transitions);
+      }
+      const auto &f = it->second;
+      append("{\"zone\":%zu,\"on\":%s,\"transitions\":[", i, f.on ? "true" : "false");
+      for (size_t t = 0; t < f.transitions.size(); ++t) {
+        const auto &tr = f.transitions[t];
+        const auto &d  = cal.date(tr.day);
+        append("%s{\"at\":%lld,\"local\":\"%04d-%02d-%02d %02d:%02d\",\"on\":%s}",
+               t ? "," : "",
+               (long long)tr.at,
+               d.tm_year + 1900,
+               d.tm_mon + 1,
+               d.tm_mday,
+               tr.minute / 60,
+               tr.minute % 60,
+               tr.on ? "true" : "false");
+      }
+      out.append("]}\n");
+    }
+
+    res.type("application/x-ndjson");
+    send_large(res, out);
+  });
+}
+
+// Plans start times from a price curve, POST lines of
+//   prices P0 P1 ...  one per slot, e.g. 96 of 15 minutes
+//   group N           zones per circuit, 1000 without
+//   limit N           zones of a circuit on at once, no limit without
+//   threads N         0 or none for one per core
+//   apply             turns the zones on at their planned start
+// Zones that are on keep their timeslot. 'starts' holds each zone's
+// planned minute of the day, -1 for zones left as they are. Those still
+// load their circuit, 'over_limit' counts the circuits they keep over.
+inline void install_tariff(http::server &server,
+                           ctrl::zone_pool *pool,
+                           bitslice::engine *bits,
+                           const zone_batch_hook &after_batch) {
+  server.route("POST", "/tariff/plan", [=, &after_batch](const http::request &req, http::response &res) {
+    tariff::problem p;
+    bool apply            = false;
+    std::string_view body = req.body;
+    while (!body.empty()) {
+      const auto eol  = body.find('\n');
+      const auto line = std::string(body.substr(0, eol));
+      body.remove_prefix(eol == std::string_view::npos ? body.size() : eol + 1);
+      char name[16];
+      int at = 0;
+      if (sscanf(line.c_str(), "%15s%n", name, &at) != 1)
+        continue;
+      const std::string_view key = name;
+      const char *rest           = line.c_str() + at;
+      if (key == "prices") {
+        for (char *end; ; rest = end) {
+          const double v = std::strtod(rest, &end);
+          if (end == rest)
+            break;
+          p.prices.push_back(v);
+        }
+      } else if (key == "group") {
+        p.group = std::strtoul(rest, nullptr, 10);
+      } else if (key == "limit") {
+        p.limit = uint32_t(std::strtoul(rest, nullptr, 10));
+      } else if (key == "threads") {
+        p.threads = unsigned(std::strtoul(rest, nullptr, 10));
+      } else if (key == "apply") {
+        apply = true;
+      }
+    }
+    if (p.prices.empty() || p.prices.size() > tariff::max_slots || 24 * 60 % p.prices.size()) {
+      res.status(400);
+      res.printf("{\"error\":\"prices needs up to 128 slots that divide the day\"}");
+      return;
+    }
+    p.slot_minutes = unsigned(24 * 60 / p.prices.size());
+
+    // One kind per timeslot, long and short, with an option per slot
+    auto profile = [](schedules::key k) {
+      return forecast::make_profile([&](uint16_t m) { return ctrl::scheduled_on(k, m); }, ctrl::schedule_edges(k));
+    };
+    p.kinds.resize(2);
+    for (uint8_t slot = 0; slot < 2; ++slot) {
+      for (size_t s = 0; s < p.prices.size(); ++s) {
+        const schedules::key k{uint16_t(s * p.slot_minutes), bool(slot)};
+        p.kinds[slot].push_back(tariff::make_option(profile(k), k.start, p.prices, p.slot_minutes));
+      }
+      tariff::sort_kind(p.kinds[slot]);
+    }
+
+    const auto zones = pool ? pool->size() : bits->size();
+    std::vector<std::optional<schedules::key>> current(zones);
+    std::unordered_map<uint32_t, tariff::option> baseline_of;
+    double baseline = 0;
+    p.kind_of.assign(zones, tariff::no_kind);
+    p.current.resize(zones);
+    for (size_t i = 0; i < zones; ++i) {
+      current[i] = ctrl::zone_schedule(pool, bits, i);
+      if (!current[i])
+        continue;
+      p.kind_of[i]     = current[i]->short_slot;
+      auto [it, added] = baseline_of.try_emplace(current[i]->packed());
+      if (added)
+        it->second = tariff::make_option(profile(*current[i]), current[i]->start, p.prices, p.slot_minutes);
+      p.current[i] = it->second;
+      baseline += it->second.cost;
+    }
+
+    const auto plan = tariff::solve(p);
+    std::vector<zones::event> moves;
+    for (size_t i = 0; i < zones; ++i)
+      if (plan.start[i] != tariff::plan::kept && plan.start[i] != current[i]->start)
+        moves.push_back({uint32_t(i), ctrl::pool_traits::TURN_ON, uint16_t(plan.start[i])});
+    if (apply && !moves.empty()) {
+      if (bits)
+        bits->process_events(moves);
+      if (pool)
+        pool->process_events(moves);
+      if (after_batch)
+        after_batch(moves);
+    }
+
+    std::string out;
+    char head[512];
+    out.append(head,
+               size_t(snprintf(head,
+                               sizeof(head),
+                               "{\"zones\":%zu,\"placed\":%zu,\"repaired\":%zu,\"unplaced\":%zu,\"peak\":%u,\"over_limit\":%zu,"
+                               "\"cost\":%.3f,\"baseline_cost\":%.3f,\"moves\":%zu,\"applied\":%s,"
+                               "\"solve_ms\":%.3f,\"starts\":[",
+                               zones,
+                               plan.placed,
+                               plan.repaired,
+                               plan.unplaced,
+                               plan.peak,
+                               plan.over_limit,
+                               plan.cost,
+                               baseline,
+                               moves.size(),
+                               apply ? "true" : "false",
+                               plan.solve_us / 1000.0)));
+    for (size_t i = 0; i < zones; ++i) {
+      if (i)
+        out += ',';
+      out += std::to_string(plan.start[i]);
+    }
+    out += "]}";
+    send_large(res, out);
+  });
+}
+
+inline void install_zone_file(http::server &server, zonefile::mapped_zones &file) {
+  server.route("GET", "/zones/file", [&](const http::request &, http::response &res) {
+    const auto &st = file.stats();
+    res.printf(
+        "{\"restored_from\":\"%s\",\"open_us\":%llu,\"first_output_us\":%llu,"
+        "\"checkpoints\":%llu,\"generation\":%llu,\"checkpoint_max_us\":%llu}",
+        zonefile::origin_name(st.from),
+        (unsigned long long)st.open_us,
+        (unsigned long long)st.first_output_us,
+        (unsigned long long)st.checkpoints,
+        (unsigned long long)st.generation,
+        (unsigned long long)st.checkpoint_max_us);
+  });
+}
+
+inline void install_outputs(http::server &server, outputs::layer &out) {
+  server.route("GET", "/outputs", [&](const http::request &, http::response &res) {
+    const auto &st = out.stats();
+    res.printf(
+        "{\"channels\":%zu,\"commits\":%llu,\"staged\":%llu,\"changed\":%llu,"
+        "\"writes\":%llu,\"writes_saved\":%llu,\"failures\":%llu,"
+        "\"commit_p50_us\":%llu,\"commit_p99_us\":%llu,\"commit_max_us\":%llu,"
+        "\"deferred\":%llu,\"bursts\":%llu,\"drain_ms\":{\"last\":%llu,\"max\":%llu},"
+        "\"interactive\":{\"count\":%llu,\"in_burst\":%llu,\"p50_us\":%llu,\"p99_us\":%llu,"
+        "\"max_us\":%llu},\"backends\":[",
+        out.channels(),
+        (unsigned long long)st.commits,
+        (unsigned long long)st.staged,
+        (unsigned long long)st.changed,
+        (unsigned long long)st.writes,
+        (unsigned long long)st.writes_saved(),
+        (unsigned long long)st.failures,
+        (unsigned long long)st.percentile_us(0.5),
+        (unsigned long long)st.percentile_us(0.99),
+        (unsigned long long)st.max_latency_us,
+        (unsigned long long)st.deferred,
+        (unsigned long long)st.bursts,
+        (unsigned long long)st.last_drain_ms,
+        (unsigned long long)st.max_drain_ms,
+        (unsigned long long)st.interactive,
+        (unsigned long long)st.interactive_in_burst,
+        (unsigned long long)st.interactive_percentile_us(0.5),
+        (unsigned long long)st.interactive_percentile_us(0.99),
+        (unsigned long long)st.interactive_max_us);
+    for (size_t i = 0; i < out.backends(); ++i)
+      res.printf(
+          "%s{\"type\":\"%s\",\"channels\":%zu,\"writes\":%llu,\"failures\":%llu,"
+          "\"channels_per_s\":%.0f,\"deferred\":%zu}",
+          i ? "," : "",
+          out.backend_at(i).name(),
+          out.backend_at(i).channels(),
+          (unsigned long long)out.backend_writes(i),
+          (unsigned long long)out.backend_failures(i),
+          out.backend_rate(i),
+          out.backend_deferred(i));
+    res.printf("]}");
+  });
+}
+}  // namespace api
+
+// Value of a '--name=value' argument
+static std::optional<std::string> option(const std::vector<std::string> &args,
+                                         const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.compare(0, prefix.size(), prefix) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
 int main(int argc, char *argv[]) {
 #ifndef ON_RPI
   // Initialize rand for faking inputs
@@ -322,30 +1292,628 @@ int main(int argc, char *argv[]) {
   using namespace std::chrono_literals;
 
   fsm_logger logger;
-  sml::sm<fsm, sml::logger<fsm_logger>> sm{logger};
+  sml::sm<fsm, sml::logger<fsm_logger>> sm{logger, light};
 
+  // Usage: light_controller HH:MM [--http=PORT] [--history=FILE]
+  //                         [--http-bind=ADDR] [--http-token=TOKEN]
+  //                         [--feed=PATH|PORT] [--store=DIR]
+  //                         [--store-sync=none|fdatasync|direct]
+  //                         [--poll-latency=MS] [--zones=N]
+  //                         [--zone-engine=sml|bitslice|check] [--zone-file=PATH]
+  //                         [--outputs=BACKEND[;BACKEND...]] [--debounce=SAMPLES]
+  //                         [--busy-poll=CPU] [--gpio-file=PATH] [--busy-spin-us=US]
+  //                         [--mirror=NAME | --standby=NAME] [--takeover-ms=MS]
+  //                         [--vgpio=SOCKET] [--bus-slice-us=US] [--pacing-window-ms=MS]
+  //                         [--recorder=PATH] [--recorder-size=RECORDS] [--pins=FILE]
+  //                         [--rules=FILE]
+  // --upgrade-fd=FD is added by an in-place upgrade, see upgrade.hpp
   auto args = std::vector<std::string>(argv, argv + argc);
-  assert(args.size() == 2);
+  assert(args.size() >= 2);
+  std::string on_time = args[1];
+  if (!turn_on_guard(turn_on{on_time}))
+    return 1;
+
+  // Busy polling only passes on changed levels, a debounce over more than
+  // one sample would never see them settle
+  const auto debounce_samples = std::stoul(option(args, "debounce").value_or("1"));
+  if (debounce_samples > 1 && option(args, "busy-poll")) {
+    printf("  --busy-poll takes no --debounce above 1\n");
+    return 1;
+  }
 
-  sm.process_event(turn_on{args[1]});
-  assert(sm.is(sml::state<on>));
+  static volatile std::sig_atomic_t running = 1;
+  std::signal(SIGINT, [](int) { running = 0; });
+  std::signal(SIGTERM, [](int) { running = 0; });
 
-  while (1) {
-    if (di_onoff::toggled() && sm.is(sml::state<off>))
-      sm.process_event(turn_on{args[1]});
-    else if (di_onoff::toggled() && sm.is(sml::state<on>))
-      sm.process_event(turn_off{});
+  // SIGUSR2 or POST /upgrade execs the binary now at this path, the
+  // state handed over replaces the fsm start from HH:MM
+  static volatile std::sig_atomic_t upgrade_requested = 0;
+  std::signal(SIGUSR2, [](int) { upgrade_requested = 1; });
+  const auto exe = upgrade::self_path();
+  std::optional<upgrade::image> handover;
+  if (const auto fd = option(args, "upgrade-fd"))
+    handover = upgrade::load(std::stoi(*fd));
 
-    if (di_mode::toggled())
-      sm.process_event(change_on_time{});
+  // --recorder=PATH keeps the last --recorder-size records of fsm
+  // activity, input edges and output changes, flight_decode prints them.
+  // They are no longer printed as they happen.
+  recorder::ring flight;
+  if (const auto path = option(args, "recorder"))
+    if (flight.open(*path, std::stoull(option(args, "recorder-size").value_or("16384"))))
+      recorder::active = &flight;
+
+  // A primary started with --mirror=NAME shares its state with a standby
+  // started with --standby=NAME. The standby waits here without touching
+  // the hardware until the primary's heartbeat stops. Both take the same
+  // --zones, for the zone states to carry over.
+  standby::mirror mirror;
+  std::optional<standby::snapshot> inherited;
+  std::optional<std::vector<standby::zone_state>> inherited_zones;
+  if (handover)
+    inherited = handover->state;
+  const auto standby_name = option(args, "standby");
+  const auto mirror_name  = standby_name ? standby_name : option(args, "mirror");
+  if (mirror_name && !mirror.open(*mirror_name, std::stoul(option(args, "zones").value_or("0"))))
+    return 1;
+  if (standby_name && !handover) {
+    const auto timeout = std::chrono::milliseconds(std::stoi(option(args, "takeover-ms").value_or("5")));
+    if (!mirror.wait_for_takeover(timeout, running))
+      return 0;
+    if (mirror.has_state() && !(inherited = mirror.read()))
+      printf("  Mirrored state did not settle, starting cold\n");
+    if (inherited && option(args, "zones") && !(inherited_zones = mirror.read_zones()))
+      printf("  Mirrored zones did not settle, zones start cold\n");
+  } else if (mirror_name) {
+    mirror.claim();
+  }
+
+  // --vgpio=SOCKET puts every pin on a virtual gpiochip, driven through
+  // SOCKET by e.g. gpio_storm. Line offsets are the wiringPi pin numbers.
+  std::unique_ptr<vgpio::chip> chip;
+  std::unique_ptr<vgpio::backend> vgpio_lines;
+  if (const auto path = option(args, "vgpio")) {
+    chip = std::make_unique<vgpio::chip>();
+    if (!chip->start(*path))
+      return 1;
+    vgpio_lines = std::make_unique<vgpio::backend>(*chip);
+    hw::backend = vgpio_lines.get();
+  }
+
+  // --pins=FILE adds pins described at runtime, see pins.hpp. Inputs act
+  // as a second on/off or mode input, the roles in INPUT_BIT order.
+  hw::pin_table pins;
+  if (const auto path = option(args, "pins"))
+    if (!pins.load(*path, {"onoff", "mode"}))
+      return 1;
+
+  // Each bus comes up on its own thread, backends of --outputs sharing a
+  // bus in the order given. gpio: backends share the GPIO block with the
+  // pins and wait for them. No output is written before all are done.
+  std::vector<std::string> output_specs;
+  if (const auto spec = option(args, "outputs")) {
+    std::string_view list = *spec;
+    while (!list.empty()) {
+      const auto sep = list.find(';');
+      output_specs.emplace_back(list.substr(0, sep));
+      list.remove_prefix(sep == std::string_view::npos ? list.size() : sep + 1);
+    }
+  }
+  std::vector<std::unique_ptr<outputs::backend>> backends(output_specs.size());
+  bringup::plan bring;
+  bring.add("gpio", {}, [&] {
+    setup();
+    pins.setup();
+    return true;
+  });
+  std::map<std::string, std::string> last_on_bus{{outputs::bus_of("gpio:"), "gpio"}};
+  for (size_t i = 0; i < output_specs.size(); ++i) {
+    const auto bus   = outputs::bus_of(output_specs[i]);
+    const auto after = last_on_bus.count(bus) ? std::vector{last_on_bus[bus]} : std::vector<std::string>{};
+    bring.add(output_specs[i], after, [&, i] {
+      backends[i] = outputs::make_backend(output_specs[i]);
+      if (!backends[i])
+        printf("  Unknown output backend: %s\n", output_specs[i].c_str());
+      return backends[i] != nullptr;
+    });
+    last_on_bus[bus] = output_specs[i];
+  }
+  bring.run();
+  if (inherited) {
+    if (inherited->light)
+      do_light::on();
+    else
+      do_light::off();
+    // Shared memory is trusted no further than the API
+    const std::string mirrored(inherited->on_time, strnlen(inherited->on_time, sizeof(inherited->on_time)));
+    if (turn_on_guard(turn_on{mirrored}))
+      on_time = mirrored;
+    light.active_timeslot = TIMESLOT(inherited->timeslot);
+    if (!handover)
+      mirror.restored();
+    else
+      printf("  Upgraded in place, outputs restored %lldus after exec\n",
+             (long long)(standby::monotonic_ns() - handover->exec_ns) / 1000);
+  }
+
+  io::reactor reactor;
+  if (recorder::active)
+    reactor.every(1000ms, [&] { flight.calibrate(); });
+
+  // Log output and history are batched into the store instead of stdout
+  std::unique_ptr<storage::store> store;
+  FILE *const console = stdout;
+  if (const auto dir = option(args, "store")) {
+    storage::config cfg;
+    cfg.dir         = *dir;
+    const auto sync = option(args, "store-sync").value_or("fdatasync");
+    cfg.sync        = sync == "direct" ? storage::sync_mode::direct
+                      : sync == "none" ? storage::sync_mode::none
+                                       : storage::sync_mode::fdatasync;
+    store           = std::make_unique<storage::store>(cfg);
+    if (store->open()) {
+      const bool tty = isatty(STDOUT_FILENO);
+      stdout = storage::open_stream(*store, storage::kind::log, tty ? STDOUT_FILENO : -1);
+      setvbuf(stdout, nullptr, tty ? _IOLBF : _IOFBF, 16 * 1024);
+      reactor.every(1s, [&] {
+        fflush(stdout);
+        store->tick();
+      });
+    } else {
+      store.reset();
+    }
+  }
+
+  api::recent_history recent;
+  const auto history_file = option(args, "history");
+  const int history_fd =
+      history_file ? open(history_file->c_str(),
+                          O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                          0644)
+                   : -1;
+  logger.transition_sinks.push_back(
+      [&](const char *sm_name, const char *src, const char *dst) {
+        char line[256];
+        const int n = snprintf(line,
+                               sizeof(line),
+                               "{\"time\":%lld,\"sm\":\"%s\",\"from\":\"%s\","
+                               "\"to\":\"%s\"}\n",
+                               (long long)std::time(nullptr),
+                               sm_name,
+                               src,
+                               dst);
+        if (n <= 0 || size_t(n) >= sizeof(line))
+          return;
+        recent.append({line, size_t(n)});
+        if (store)
+          store->append(storage::kind::history, 0, line, n);
+        if (history_fd >= 0 && write(history_fd, line, n) != n)
+          printf("  History write failed\n");
+      });
+
+  // Transitions are pushed to subscribers, late joiners get a snapshot.
+  // A snapshot that does not fit is not sent at all.
+  uint64_t feed_seq{};
+  auto publisher = std::make_unique<feed::publisher>(
+      reactor, 256, [&](char *buf, size_t capacity) -> size_t {
+        const auto seq = (unsigned long long)feed_seq;
+        size_t used    = 0;
+        auto fits      = [&](int n) { return n > 0 && (used += size_t(n)) < capacity; };
+        if (!fits(snprintf(buf, capacity, "{\"snapshot\":true,\"seq\":%llu,\"status\":", seq)) ||
+            !fits(api::status(sm, on_time, buf + used, capacity - used)) ||
+            !fits(snprintf(buf + used, capacity - used, "}\n")))
+          return 0;
+        return used;
+      });
+  if (const auto where = option(args, "feed")) {
+    if (!publisher->listen(*where))
+      return 1;
+    logger.transition_sinks.push_back(
+        [&](const char *sm_name, const char *src, const char *dst) {
+          publisher->publish(
+              "{\"seq\":%llu,\"time\":%lld,\"sm\":\"%s\",\"from\":\"%s\","
+              "\"to\":\"%s\"}\n",
+              (unsigned long long)++feed_seq,
+              (long long)std::time(nullptr),
+              sm_name,
+              src,
+              dst);
+        });
+  }
+
+  auto server = std::make_unique<http::server>(reactor);
+  if (const auto port = option(args, "http")) {
+    api::install(*server, sm, on_time, recent, history_file);
+    api::install_feed(*server, *publisher);
+    if (store)
+      api::install_store(*server, *store);
+    if (recorder::active)
+      api::install_recorder(*server, flight);
+    api::install_upgrade(*server, upgrade_requested);
+    api::install_bringup(*server, bring);
+    // Loopback only unless --http-bind says otherwise, the API can exec
+    if (const auto token = option(args, "http-token"))
+      server->require_token(*token);
+    if ((!handover || handover->http_fd < 0 || !server->adopt(handover->http_fd)) &&
+        !server->listen(uint16_t(std::stoi(*port)), option(args, "http-bind").value_or("127.0.0.1")))
+      return 1;
+  } else if (handover && handover->http_fd >= 0) {
+    close(handover->http_fd);
+  }
+
+  // Edge events wake the loop, the next sample reads the new levels
+  if (vgpio_lines) {
+    reactor.add(vgpio_lines->event_fd(), EPOLLIN, [&](uint32_t) { vgpio_lines->drain(); });
+    if (option(args, "http"))
+      api::install_vgpio(*server, *vgpio_lines);
+  }
+
+  if (!inherited || inherited->on)
+    sm.process_event(turn_on{on_time});
+  assert(sm.is(sml::state<on>) || !inherited->on);
+
+  // Inputs are polled, quickly while active and backing off while idle
+  hw::adaptive_sampler::config poll;
+  if (const auto ms = option(args, "poll-latency"))
+    poll.max_latency = std::chrono::milliseconds(std::stoi(*ms));
+  hw::adaptive_sampler sampler{poll};
+  if (const auto port = option(args, "http"))
+    api::install_sampler(*server, sampler);
+
+  // 'check' feeds both engines and reports where they disagree. With
+  // --zone-file the bit-sliced zones run on a mapped file and survive
+  // restarts, checkpointed every second while they change.
+  zonefile::mapped_zones zone_file;
+  bool on_file = false;
+  std::unique_ptr<zone_pool> pool;
+  std::unique_ptr<bitslice::engine> bits;
+  api::zone_batch_hook zone_batch;
+  if (const auto count = option(args, "zones")) {
+    const auto zones  = std::stoul(*count);
+    const auto engine = option(args, "zone-engine").value_or("sml");
+    const auto path   = option(args, "zone-file");
+    if (engine != "bitslice")
+      pool = std::make_unique<zone_pool>(zones);
+    on_file = engine == "bitslice" && path && zone_file.open(*path, zones);
+    if (on_file)
+      bits = std::make_unique<bitslice::engine>(zones, zone_file.state());
+    else if (engine != "sml")
+      bits = std::make_unique<bitslice::engine>(zones);
+    // Zones on a file are already where the previous process left them
+    if (const auto *carried = handover ? &handover->zones : inherited_zones ? &*inherited_zones : nullptr;
+        carried && !on_file) {
+      const auto events = ctrl::replay(*carried);
+      if (pool)
+        pool->process_events(events);
+      if (bits)
+        bits->process_events(events);
+    }
+    if (path && engine != "bitslice")
+      printf("  --zone-file needs --zone-engine=bitslice\n");
+
+    if (on_file) {
+      reactor.every(1000ms, [&, batches = uint64_t(-1)]() mutable {
+        if (bits->count().batches != batches) {
+          batches = bits->count().batches;
+          zone_file.checkpoint();
+        }
+      });
+    }
+    if (option(args, "http")) {
+      api::install_zones(*server, pool.get(), bits.get(), zone_batch);
+      api::install_zone_file(*server, zone_file);
+      api::install_forecast(*server, pool.get(), bits.get());
+      api::install_tariff(*server, pool.get(), bits.get(), zone_batch);
+    }
+  }
+
+  // Zone i drives output channel i, every pass is committed as a whole.
+  // The outputs of --pins come first, then the backends of --outputs:
+  // gpio:PIN,... i2c:DEV:ADDR,... spi:DEV:REGISTERS dmx:DEV:CHANNELS
+  // Bursts are paced to --bus-slice-us of bus time per backend and pass,
+  // and drain within --pacing-window-ms.
+  outputs::layer out;
+  if (pins.size())
+    out.attach(std::make_unique<hw::pin_outputs>(pins));
+  outputs::pacing pacing;
+  if (const auto us = option(args, "bus-slice-us"))
+    pacing.bus_slice = std::chrono::microseconds(std::stoul(*us));
+  if (const auto ms = option(args, "pacing-window-ms"))
+    pacing.window = std::chrono::milliseconds(std::stoul(*ms));
+  out.pace(pacing);
+  for (auto &backend : backends)
+    if (backend)
+      out.attach(std::move(backend));
+  // Zones that are on share interned schedules, a pass decides each
+  // distinct schedule once and stages all channels from the result.
+  // With --fade-minutes a channel ramps up when its schedule starts and
+  // down when it ends instead of switching, stepped at --fade-hz. Zones
+  // changed over the API still switch at once.
+  // With --rules a zone that follows a rule is on when its rule holds,
+  // 'schedule' in a rule is the zone's schedule and the other signals
+  // are set over POST /rules/signals. See rules.hpp.
+  std::optional<schedules::table> shared;
+  std::optional<rules::engine> gates;
+  std::optional<size_t> schedule_signal;
+  std::function<void()> rules_changed;
+  std::optional<fade::engine> fades;
+  std::vector<uint64_t> levels;
+  std::vector<uint64_t> wanted;  // Levels the fades ramp towards
+  const auto fade_hz     = std::max(1ul, std::stoul(option(args, "fade-hz").value_or("44")));
+  const auto fade_period = std::chrono::milliseconds(1000 / std::min(fade_hz, 1000ul));
+  const auto fade_frames =
+      uint32_t(std::stod(option(args, "fade-minutes").value_or("0")) * 60000 / fade_period.count());
+  if (out.channels() && (pool || bits)) {
+    shared.emplace(pool ? pool->size() : bits->size());
+    auto sync = [&](size_t i) {
+      if (const auto k = ctrl::zone_schedule(pool.get(), bits.get(), i))
+        shared->assign(i, *k);
+      else
+        shared->release(i);
+    };
+    for (size_t i = 0; i < shared->zones(); ++i)
+      sync(i);
+    if (const auto path = option(args, "rules")) {
+      gates.emplace(shared->zones());
+      if (!rules::load(*path, *gates))
+        return 1;
+      schedule_signal = gates->signal("schedule");
+    }
+    // Zones that follow a rule take its decision over their schedule
+    auto decide = [&](int64_t now_time) {
+      shared->evaluate([&](schedules::key k) { return ctrl::scheduled_on(k, now_time); }, levels);
+      if (!gates)
+        return;
+      for (size_t w = 0; schedule_signal && w < levels.size(); ++w)
+        gates->set_word(*schedule_signal, w, levels[w]);
+      gates->evaluate();
+      for (size_t w = 0; w < levels.size(); ++w)
+        levels[w] = (levels[w] & ~gates->governed()[w]) | (gates->outputs()[w] & gates->governed()[w]);
+    };
+    if (fade_frames)
+      fades.emplace(out.channels());
+    // Starts a ramp on every channel whose level changed, the first pass
+    // and a restore put channels at their level right away
+    auto ramp = [&](bool at_once) {
+      wanted.resize(levels.size());
+      for (size_t w = 0; w < levels.size(); ++w)
+        for (auto diff = levels[w] ^ wanted[w]; diff; diff &= diff - 1) {
+          const auto ch = w * 64 + size_t(__builtin_ctzll(diff));
+          const auto to = levels[w] >> (ch % 64) & 1 ? fades->max() : uint16_t(0);
+          if (ch >= fades->channels())
+            break;
+          if (at_once)
+            fades->set(ch, to);
+          else
+            fades->start(ch, to, fade_frames);
+        }
+      wanted = levels;
+    };
+    auto pass = [&, ramp, decide] {
+      decide(ctrl::minutes_now());
+      if (fades)
+        ramp(false);
+      else
+        out.stage_all(levels);
+      out.commit();
+      zone_file.output_committed();
+    };
+    // The inherited levels go out at once, pacing them would leave the
+    // deferred channels at their initial level for a while
+    if (inherited) {
+      for (size_t i = 0; i < std::min<size_t>(out.channels(), inherited->channels); ++i)
+        out.stage(i, inherited->shadow[i / 64] >> (i % 64) & 1, outputs::priority::urgent);
+      out.commit();
+      if (fades) {
+        const auto words = (inherited->channels + 63) / 64;
+        levels.assign(std::begin(inherited->shadow), std::begin(inherited->shadow) + words);
+        ramp(true);
+      }
+    } else if (fades) {
+      decide(ctrl::minutes_now());
+      ramp(true);
+    } else {
+      pass();
+    }
+    reactor.every(100ms, pass);
+    if (fades) {
+      auto frame = [&] {
+        if (fades->step([&](size_t ch, uint16_t v) { out.stage_value(ch, uint8_t(v)); }))
+          out.commit();
+      };
+      frame();
+      zone_file.output_committed();
+      reactor.every(fade_period, frame);
+    }
+    // Zones changed over the API are interactive, they skip the pacing
+    auto switch_now = [&](size_t zone, bool on) {
+      out.stage(zone, on, outputs::priority::urgent);
+      if (fades && zone / 64 < wanted.size()) {
+        fades->set(zone, on ? fades->max() : 0);
+        const auto b = uint64_t(1) << (zone % 64);
+        wanted[zone / 64] = on ? wanted[zone / 64] | b : wanted[zone / 64] & ~b;
+      }
+    };
+    zone_batch = [&, sync, switch_now](const std::vector<zones::event> &batch) {
+      const auto now_time = ctrl::minutes_now();
+      for (const auto &e : batch)
+        sync(e.zone);
+      for (const auto &e : batch) {
+        if (e.zone >= out.channels())
+          continue;
+        bool on = ctrl::zone_output(pool.get(), bits.get(), e.zone, now_time);
+        if (gates && gates->governed()[e.zone / 64] >> (e.zone % 64) & 1) {
+          if (schedule_signal)
+            gates->set(*schedule_signal, e.zone, on);
+          gates->evaluate();
+          on = gates->output(e.zone);
+        }
+        switch_now(e.zone, on);
+      }
+      out.commit();
+    };
+    // A signal set over the API switches the zones its rules decide
+    rules_changed = [&, switch_now] {
+      for (const auto w : gates->evaluate())
+        for (auto g = gates->governed()[w]; g; g &= g - 1)
+          if (const auto z = w * 64 + size_t(__builtin_ctzll(g)); z < out.channels())
+            switch_now(z, gates->output(z));
+      out.commit();
+    };
+    if (option(args, "http")) {
+      api::install_outputs(*server, out);
+      api::install_schedules(*server, *shared);
+      if (gates)
+        api::install_rules(*server, *gates, rules_changed);
+      if (fades)
+        api::install_fades(*server, *fades);
+    }
+  }
+  if (pins.size() && option(args, "http")) {
+    api::install_pins(*server, pins);
+  }
+
+  // State a standby or an upgraded binary continues from
+  auto snapshot = [&] {
+    standby::snapshot s{};
+    s.on            = sm.is(sml::state<on>);
+    s.timeslot      = uint8_t(TIMESLOT(light.active_timeslot));
+    s.light         = do_light::last_value;
+    s.start_minutes = int32_t(light.start_time_minutes);
+    snprintf(s.on_time, sizeof(s.on_time), "%s", on_time.c_str());
+    s.channels = uint32_t(std::min(out.channels(), standby::shadow_words * 64));
+    std::copy_n(out.shadow().begin(), (s.channels + 63) / 64, s.shadow);
+    return s;
+  };
+
+  // Mirror and heartbeat every millisecond, a primary that finds itself
+  // replaced stops and leaves the outputs to the new owner. Zone states
+  // go along after every batch of zone events.
+  bool owns_outputs = true;
+  if (mirror_name) {
+    reactor.every(1ms, [&, batches = uint64_t(-1)]() mutable {
+      if (!mirror.owned()) {
+        printf("  Outputs taken over by the standby, stopping\n");
+        owns_outputs = false;
+        running      = 0;
+        return;
+      }
+      mirror.publish(snapshot());
+      if (const auto now = pool ? pool->stats().batches : bits ? bits->count().batches : 0; now != batches) {
+        batches = now;
+        mirror.publish_zones(ctrl::zone_states(pool.get(), bits.get()));
+      }
+      mirror.beat();
+    });
+    if (option(args, "http"))
+      api::install_mirror(*server, mirror);
+  }
+
+  // --busy-poll=CPU spins on the GPIO level register instead of sampling,
+  // --gpio-file stands in for /dev/gpiomem. BCM 2 and 3 are wiringPi 8, 9.
+  std::optional<hw::busy_poller> busy;
+  if (const auto cpu = option(args, "busy-poll")) {
+    hw::busy_poller::config cfg{.pins = {2, 3}, .cpu = std::stoi(*cpu)};
+    if (const auto path = option(args, "gpio-file")) {
+      cfg.path   = *path;
+      cfg.create = true;
+    }
+    if (const auto us = option(args, "busy-spin-us"))
+      cfg.max_spin = std::chrono::microseconds(std::stoul(*us));
+    if (!busy.emplace().open(std::move(cfg))) {
+      ctrl::stop_task();
+      return 1;
+    }
+    if (option(args, "http"))
+      api::install_busy(*server, *busy);
+  }
+
+  // Inputs to light: sample, debounce, latch changes, map them to fsm
+  // events and drive the light whenever the fsm handled one
+  auto light_events = [&](uint32_t changed, auto &emit) {
+    if ((changed & ONOFF) && sm.is(sml::state<off>))
+      emit(turn_on{on_time});
+    else if ((changed & ONOFF) && sm.is(sml::state<on>))
+      emit(turn_off{});
+    if (changed & MODE)
+      emit(change_on_time{});
+  };
+  auto light_level = [&] { return sm.is(sml::state<on>) && ctrl::scheduled_on(light, ctrl::minutes_now()); };
+  bool edge        = false;
+  auto input_path  = pipeline::compose(pipeline::from([&] { return busy ? busy->levels() : inputs::sample(); }),
+                                      pipeline::debounce(uint32_t(debounce_samples)),
+                                      pipeline::coalesce<inputs>(),
+                                      pipeline::tap([&](uint32_t) { edge = true; }),
+                                      pipeline::map_events(light_events),
+                                      pipeline::to_sm(sm),
+                                      pipeline::to_output<ctrl::main_light>(light_level));
+
+  // Inputs of --pins join in after the fixed inputs, latched by the table
+  if (pins.inputs().size()) {
+    reactor.every(100ms,
+                  [&, path = pipeline::compose(pipeline::map_events(light_events),
+                                               pipeline::to_sm(sm),
+                                               pipeline::to_output<ctrl::main_light>(light_level))]() mutable {
+                    if (const auto changed = pins.sample_roles())
+                      path(changed);
+                  });
+  }
+
+  while (running) {
+    if (busy) {
+      // An edge that switched the light was timed up to the pin
+      busy->spin([&] {
+        const bool was = do_light::last_value;
+        input_path();
+        return do_light::last_value != was;
+      });
+    } else {
+      edge = false;
+      input_path();
+      sampler.sampled(hw::adaptive_sampler::clock::now(), edge);
+    }
 
 #ifndef USING_THREAD
     if (sm.is(sml::state<on>))
-      ctrl::iterate_task();
+      ctrl::iterate_task(light);
 #endif
-    usleep(1000);  // Only to avoid 100% core load
+    reactor.run_once(busy ? 0us : sampler.next(hw::adaptive_sampler::clock::now()));
+
+    // Everything the new binary does not read from the image is flushed
+    // first, the task thread ends with exec. Requests already accepted are
+    // answered, the new binary accepts the rest
+    if (upgrade_requested) {
+      upgrade_requested = 0;
+      printf("  Upgrading to %s\n", exe.c_str());
+      server->finish(100ms);
+      if (on_file)
+        zone_file.checkpoint();
+      if (store) {
+        fflush(stdout);
+        store->flush();
+      }
+      upgrade::image img;
+      img.state   = snapshot();
+      img.http_fd = server->listen_fd();
+      img.zones   = ctrl::zone_states(pool.get(), bits.get());
+      img.exec_ns = standby::monotonic_ns();
+      std::vector<int> inherit;
+      if (img.http_fd >= 0)
+        inherit.push_back(img.http_fd);
+      if (const int fd = exe.empty() ? -1 : upgrade::save(img); fd >= 0)
+        upgrade::exec(exe, args, fd, inherit);
+      server->resume();
+    }
   }
 
-  sm.process_event(turn_off{});
+  // With a mirror the outputs are left as they are for the standby
+  if (owns_outputs && !mirror_name)
+    sm.process_event(turn_off{});
+  else
+    ctrl::stop_task();
+  recorder::active = nullptr;
+  if (stdout != console) {
+    fclose(stdout);
+    stdout = console;
+  }
   return 0;
 }
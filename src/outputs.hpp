@@ -0,0 +1,684 @@
+/**
+ * Transactional output layer.
+ *
+ * An evaluation pass stages the level of every output channel, commit
+ * then diffs the staged levels against the shadow of what the hardware
+ * was last told. Each backend owns a consecutive range of channels and
+ * only sees the changed bits of its range, the backends with changes
+ * flush one after the other. A backend that fails keeps its shadow, so
+ * the same changes are retried by the next commit.
+ *
+ * Commits are paced per backend. Each commit hands a backend at most the
+ * changes its bus moves in one slice of bus time, going by its measured
+ * throughput, but never fewer than it takes to drain a burst within the
+ * pacing window. What is held back stays in the diff for the next commit.
+ * Urgent changes, interactive and safety writes, go out right away.
+ *
+ * Backends that dim take a value of 0 to 255 per channel. Their changed
+ * values go out with every commit, unpaced, as fades step them a frame
+ * at a time. On/off backends see a value as on from half up.
+ **/
+
+#pragma once
+
+#include <asm/termbits.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace outputs {
+using bits = std::span<const uint64_t>;
+
+inline bool bit(bits b, size_t i) { return b[i / 64] >> (i % 64) & 1; }
+
+// Any bit set in [first, first + count)
+inline bool any(bits b, size_t first, size_t count) {
+  for (size_t i = first; i < first + count; ++i)
+    if (bit(b, i))
+      return true;
+  return false;
+}
+
+class backend {
+ public:
+  virtual ~backend() = default;
+  virtual const char *name() const = 0;
+  virtual size_t channels() const  = 0;
+
+  // 'levels' and 'changed' hold one bit per channel of this backend.
+  // Returns the number of bus writes issued, nothing if the flush failed.
+  virtual std::optional<size_t> flush(bits levels, bits changed) = 0;
+
+  // Dimming backends take every value of their channels instead
+  virtual bool dims() const { return false; }
+  virtual std::optional<size_t> flush_values(std::span<const uint8_t>, bits) { return std::nullopt; }
+
+ protected:
+  // Without the device the backend keeps running, writes go nowhere
+  static int open_device(const std::string &path, int flags) {
+    const int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0)
+      printf("  Outputs %s: %s, dry run\n", path.c_str(), strerror(errno));
+    return fd;
+  }
+};
+
+// BCM283x GPIO through /dev/gpiomem, one set and one clear register
+// write per bank of 32 pins
+class gpio_registers : public backend {
+ public:
+  explicit gpio_registers(std::vector<unsigned> pins) : pins_{std::move(pins)} {
+    const int fd = open_device("/dev/gpiomem", O_RDWR | O_SYNC);
+    void *map    = MAP_FAILED;
+    if (fd >= 0) {
+      map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+    }
+    if (map == MAP_FAILED)
+      map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    regs_ = static_cast<volatile uint32_t *>(map);
+
+    // Function select 001 makes a pin an output
+    for (const auto pin : pins_) {
+      const auto shift = pin % 10 * 3;
+      regs_[pin / 10]  = (regs_[pin / 10] & ~(7u << shift)) | (1u << shift);
+    }
+  }
+  ~gpio_registers() override { munmap((void *)regs_, map_size); }
+
+  const char *name() const override { return "gpio"; }
+  size_t channels() const override { return pins_.size(); }
+
+  std::optional<size_t> flush(bits levels, bits changed) override {
+    uint32_t set[banks]{}, clear[banks]{};
+    for (size_t i = 0; i < pins_.size(); ++i)
+      if (bit(changed, i))
+        (bit(levels, i) ? set : clear)[pins_[i] / 32] |= 1u << (pins_[i] % 32);
+
+    size_t writes = 0;
+    for (size_t b = 0; b < banks; ++b) {
+      if (set[b]) {
+        regs_[gpset0 + b] = set[b];
+        ++writes;
+      }
+      if (clear[b]) {
+        regs_[gpclr0 + b] = clear[b];
+        ++writes;
+      }
+    }
+    return writes;
+  }
+
+ private:
+  static constexpr size_t map_size = 4096;
+  static constexpr size_t banks    = 2;
+  static constexpr size_t gpset0   = 0x1c / 4;
+  static constexpr size_t gpclr0   = 0x28 / 4;
+
+  std::vector<unsigned> pins_;
+  volatile uint32_t *regs_;
+};
+
+// MCP23017 expanders on one I2C bus, 16 channels each. Both output
+// latches of a device go out in a single sequential write.
+class i2c_expanders : public backend {
+ public:
+  i2c_expanders(const std::string &path, std::vector<uint8_t> addresses)
+      : addresses_{std::move(addresses)},
+        fd_{open_device(path, O_RDWR)} {
+    for (size_t d = 0; d < addresses_.size(); ++d) {
+      const uint8_t all_outputs[] = {iodira, 0x00, 0x00};
+      transfer(d, all_outputs, sizeof(all_outputs));
+    }
+  }
+  ~i2c_expanders() override {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  const char *name() const override { return "i2c"; }
+  size_t channels() const override { return addresses_.size() * 16; }
+
+  std::optional<size_t> flush(bits levels, bits changed) override {
+    size_t writes = 0;
+    for (size_t d = 0; d < addresses_.size(); ++d) {
+      const bool a = any(changed, d * 16, 8);
+      const bool b = any(changed, d * 16 + 8, 8);
+      if (!a && !b)
+        continue;
+
+      uint16_t latch = 0;
+      for (size_t i = 0; i < 16; ++i)
+        latch |= uint16_t(bit(levels, d * 16 + i)) << i;
+
+      const uint8_t msg[] = {uint8_t(a ? olata : olatb),
+                             uint8_t(a ? latch : latch >> 8),
+                             uint8_t(latch >> 8)};
+      if (!transfer(d, msg, a && b ? 3 : 2))
+        return std::nullopt;
+      ++writes;
+    }
+    return writes;
+  }
+
+ private:
+  static constexpr uint8_t iodira = 0x00;
+  static constexpr uint8_t olata  = 0x14;
+  static constexpr uint8_t olatb  = 0x15;
+
+  bool transfer(size_t device, const uint8_t *data, size_t len) {
+    if (fd_ < 0)
+      return true;
+    return ioctl(fd_, I2C_SLAVE, addresses_[device]) == 0 && write(fd_, data, len) == ssize_t(len);
+  }
+
+  std::vector<uint8_t> addresses_;
+  int fd_;
+};
+
+// Daisy chained 74HC595 shift registers on spidev. A shift register
+// chain cannot be partially updated, any change shifts out the chain.
+class spi_chain : public backend {
+ public:
+  spi_chain(const std::string &path, size_t registers)
+      : frame_(registers), fd_{open_device(path, O_WRONLY)} {}
+  ~spi_chain() override {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  const char *name() const override { return "spi"; }
+  size_t channels() const override { return frame_.size() * 8; }
+
+  std::optional<size_t> flush(bits levels, bits) override {
+    // The first byte out ends up in the last register of the chain
+    for (size_t r = 0; r < frame_.size(); ++r) {
+      uint8_t byte = 0;
+      for (size_t i = 0; i < 8; ++i)
+        byte |= uint8_t(bit(levels, r * 8 + i)) << i;
+      frame_[frame_.size() - 1 - r] = byte;
+    }
+    if (fd_ >= 0 && write(fd_, frame_.data(), frame_.size()) != ssize_t(frame_.size()))
+      return std::nullopt;
+    return 1;
+  }
+
+ private:
+  std::vector<uint8_t> frame_;
+  int fd_;
+};
+
+// One DMX512 universe on a UART, channels dim from 0 to 255. A frame
+// is only sent when a channel changed.
+class dmx_universe : public backend {
+ public:
+  dmx_universe(const std::string &path, size_t channels)
+      : frame_(1 + std::min<size_t>(channels, 512)), fd_{open_device(path, O_WRONLY | O_NOCTTY)} {
+    // 250 kbaud 8N2 needs the arbitrary rate termios2 interface
+    termios2 tio{};
+    if (fd_ >= 0 && ioctl(fd_, TCGETS2, &tio) == 0) {
+      tio.c_cflag = BOTHER | CS8 | CSTOPB | CLOCAL;
+      tio.c_iflag = tio.c_oflag = tio.c_lflag = 0;
+      tio.c_ispeed = tio.c_ospeed = 250000;
+      ioctl(fd_, TCSETS2, &tio);
+    }
+  }
+  ~dmx_universe() override {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  const char *name() const override { return "dmx"; }
+  size_t channels() const override { return frame_.size() - 1; }
+
+  bool dims() const override { return true; }
+
+  std::optional<size_t> flush(bits levels, bits) override {
+    for (size_t i = 1; i < frame_.size(); ++i)
+      frame_[i] = bit(levels, i - 1) ? 255 : 0;
+    return send();
+  }
+
+  std::optional<size_t> flush_values(std::span<const uint8_t> values, bits) override {
+    std::copy_n(values.begin(), std::min(values.size(), frame_.size() - 1), frame_.begin() + 1);
+    return send();
+  }
+
+ private:
+  std::optional<size_t> send() {
+    if (fd_ < 0)
+      return 1;
+
+    // Break of at least 88us and mark after break before the start code
+    ioctl(fd_, TIOCSBRK);
+    usleep(100);
+    ioctl(fd_, TIOCCBRK);
+    usleep(12);
+    if (write(fd_, frame_.data(), frame_.size()) != ssize_t(frame_.size()))
+      return std::nullopt;
+    return 1;
+  }
+
+  std::vector<uint8_t> frame_;  // Start code 0 followed by the channels
+  int fd_;
+};
+
+// gpio:17,27,22 i2c:/dev/i2c-1:0x20,0x21 spi:/dev/spidev0.0:4 dmx:/dev/ttyAMA0:512
+inline std::unique_ptr<backend> make_backend(std::string_view spec) {
+  const auto colon = spec.find(':');
+  const auto type  = spec.substr(0, colon);
+  const auto rest  = colon == std::string_view::npos ? "" : std::string(spec.substr(colon + 1));
+
+  auto numbers = [](std::string_view list) {
+    std::vector<unsigned> out;
+    while (!list.empty()) {
+      const auto comma = list.find(',');
+      out.push_back(unsigned(std::stoul(std::string(list.substr(0, comma)), nullptr, 0)));
+      list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    }
+    return out;
+  };
+  // Device paths have no colon, the last field is the parameter list
+  const auto last   = rest.rfind(':');
+  const auto device = last == std::string::npos ? rest : rest.substr(0, last);
+  const auto params = last == std::string::npos ? std::string() : rest.substr(last + 1);
+
+  if (type == "gpio" && !rest.empty()) {
+    auto pins = numbers(rest);
+    if (std::any_of(pins.begin(), pins.end(), [](unsigned p) { return p > 53; }))
+      return nullptr;
+    return std::make_unique<gpio_registers>(std::move(pins));
+  }
+  if (type == "i2c" && !params.empty()) {
+    const auto list = numbers(params);
+    return std::make_unique<i2c_expanders>(device, std::vector<uint8_t>(list.begin(), list.end()));
+  }
+  if (type == "spi" && !params.empty())
+    return std::make_unique<spi_chain>(device, std::stoul(params));
+  if (type == "dmx" && !params.empty())
+    return std::make_unique<dmx_universe>(device, std::stoul(params));
+  return nullptr;
+}
+
+// Bus a backend spec drives, backends sharing one come up one by one
+inline std::string bus_of(std::string_view spec) {
+  const auto colon = spec.find(':');
+  if (spec.substr(0, colon) == "gpio")
+    return "/dev/gpiomem";
+  const auto rest = colon == std::string_view::npos ? std::string_view() : spec.substr(colon + 1);
+  return std::string(rest.substr(0, rest.rfind(':')));
+}
+
+// Value below which a fraction 'q' of a log2 histogram falls
+inline uint64_t percentile(const uint64_t (&log2)[32], uint64_t count, double q) {
+  uint64_t seen{};
+  for (size_t i = 0; i < 32; ++i) {
+    seen += log2[i];
+    if (count && seen >= q * count)
+      return uint64_t(1) << i;
+  }
+  return 0;
+}
+
+inline void record(uint64_t (&log2)[32], uint64_t value) {
+  ++log2[std::min(31, 64 - __builtin_clzll(value | 1))];
+}
+
+enum class priority { paced, urgent };
+
+struct pacing {
+  std::chrono::microseconds bus_slice{2000};  // Bus time per backend and commit
+  std::chrono::milliseconds window{1000};     // Bursts drain within this
+};
+
+struct commit_stats {
+  uint64_t commits{};
+  uint64_t staged{};   // Level changes staged, each a write of the old per-call outputs
+  uint64_t changed{};  // Channels whose level actually changed
+  uint64_t writes{};   // Bus writes issued by the backends
+  uint64_t dimmed{};   // Values flushed to dimming backends
+  uint64_t failures{};
+  uint64_t max_latency_us{};
+  uint64_t latency_log2_us[32]{};
+
+  uint64_t deferred{};  // Changes held back right now
+  uint64_t bursts{};
+  uint64_t last_drain_ms{};
+  uint64_t max_drain_ms{};
+
+  uint64_t interactive{};  // Commits that flushed urgent changes
+  uint64_t interactive_in_burst{};
+  uint64_t interactive_max_us{};
+  uint64_t interactive_log2_us[32]{};  // From the first urgent stage() to flushed
+
+  uint64_t writes_saved() const { return staged > writes ? staged - writes : 0; }
+  uint64_t percentile_us(double q) const { return percentile(latency_log2_us, commits, q); }
+  uint64_t interactive_percentile_us(double q) const {
+    return percentile(interactive_log2_us, interactive, q);
+  }
+};
+
+class layer {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr uint8_t half = 128;
+
+  void pace(pacing p) { pacing_ = p; }
+
+  // Backends take consecutive channels, in the order they are attached
+  void attach(std::unique_ptr<backend> b) {
+    ranges_.push_back({channels_, b->channels(), {}, {}, 0, 0, 0, 0, 0, 0, 0});
+    const auto first = channels_;
+    channels_ += b->channels();
+    staged_.resize((channels_ + 63) / 64);
+    shadow_.resize(staged_.size());
+    urgent_.resize(staged_.size());
+    dims_.resize(staged_.size());
+    dimmed_.resize(staged_.size());
+    values_.resize(channels_);
+    if (b->dims())
+      for (size_t c = first; c < channels_; ++c)
+        dims_[c / 64] |= uint64_t(1) << (c % 64);
+    backends_.push_back(std::move(b));
+  }
+
+  size_t channels() const { return channels_; }
+  size_t backends() const { return backends_.size(); }
+  const backend &backend_at(size_t i) const { return *backends_[i]; }
+  uint64_t backend_writes(size_t i) const { return ranges_[i].writes; }
+  uint64_t backend_failures(size_t i) const { return ranges_[i].failures; }
+  double backend_rate(size_t i) const { return ranges_[i].rate; }
+  size_t backend_deferred(size_t i) const { return ranges_[i].backlog; }
+  bool level(size_t channel) const { return bit(shadow_, channel); }
+  uint8_t value(size_t channel) const { return values_[channel]; }
+  const std::vector<uint64_t> &shadow() const { return shadow_; }
+  const commit_stats &stats() const { return stats_; }
+
+  // An urgent change stays urgent until it was flushed
+  void stage(size_t channel, bool level, priority p = priority::paced) {
+    if (channel >= channels_)
+      return;
+    if (bit(dims_, channel) && level != (values_[channel] >= half))
+      dim(channel, level ? 255 : 0);
+    const auto b = uint64_t(1) << (channel % 64);
+    pending_ += bit(staged_, channel) != level;
+    staged_[channel / 64] = level ? staged_[channel / 64] | b : staged_[channel / 64] & ~b;
+    if (level == bit(shadow_, channel)) {
+      urgent_[channel / 64] &= ~b;
+    } else if (p == priority::urgent) {
+      urgent_[channel / 64] |= b;
+      if (!urgent_since_)
+        urgent_since_ = clock::now();
+    }
+  }
+
+  // Stages every channel from one bit each, as paced changes
+  void stage_all(bits levels) {
+    for (size_t w = 0; w < staged_.size(); ++w) {
+      const auto tail = channels_ - w * 64 < 64 ? (uint64_t(1) << (channels_ - w * 64)) - 1 : ~uint64_t(0);
+      const auto was  = staged_[w];
+      staged_[w]      = w < levels.size() ? levels[w] & tail : 0;
+      pending_ += size_t(__builtin_popcountll(was ^ staged_[w]));
+      urgent_[w] &= staged_[w] ^ shadow_[w];
+      for (auto d = dims_[w]; d; d &= d - 1) {
+        const auto c = w * 64 + size_t(__builtin_ctzll(d));
+        if (bit(staged_, c) != (values_[c] >= half))
+          dim(c, bit(staged_, c) ? 255 : 0);
+      }
+    }
+  }
+
+  // Stages the value of a dimmed channel, other channels are on from
+  // half up. A dimmed channel's value goes out with the next commit.
+  void stage_value(size_t channel, uint8_t value, priority p = priority::paced) {
+    if (channel >= channels_)
+      return;
+    if (bit(dims_, channel))
+      dim(channel, value);
+    stage(channel, value >= half, p);
+  }
+
+  // Returns the number of bus writes. The backends flush in turn on the
+  // calling thread, a commit is a handful of short bus writes.
+  size_t commit() {
+    const auto start = clock::now();
+    since_last_us_   = elapsed_us(last_commit_, start);
+    last_commit_     = start;
+
+    changed_.resize(staged_.size());
+    for (size_t w = 0; w < staged_.size(); ++w)
+      changed_[w] = staged_[w] ^ shadow_[w];
+
+    std::vector<std::optional<size_t>> results;
+    std::vector<size_t> flushed;
+    const bool in_burst = stats_.deferred > 0;
+    bool urgent_sent    = false;
+    size_t deferred     = 0;
+    for (size_t i = 0; i < backends_.size(); ++i) {
+      auto &r = ranges_[i];
+      if (backends_[i]->dims()) {
+        if (!any(dimmed_, r.first, r.count))
+          continue;
+        urgent_sent |= select_values(r);
+        flushed.push_back(i);
+        const auto values = std::span<const uint8_t>(values_).subspan(r.first, r.count);
+        results.push_back(backends_[i]->flush_values(values, r.changed));
+        continue;
+      }
+      if (!any(changed_, r.first, r.count)) {
+        r.backlog   = 0;
+        r.credit_us = 0;
+        continue;
+      }
+      urgent_sent |= select(r, budget(r));
+      deferred += r.backlog;
+      flushed.push_back(i);
+      const auto t0 = clock::now();
+      results.push_back(backends_[i]->flush(r.levels, r.changed));
+      r.flush_us = elapsed_us(t0);
+    }
+
+    size_t writes = 0;
+    for (size_t k = 0; k < results.size(); ++k) {
+      auto &r            = ranges_[flushed[k]];
+      const auto &result = results[k];
+      if (!result) {
+        ++r.failures;
+        ++stats_.failures;
+        continue;
+      }
+      writes += *result;
+      r.writes += *result;
+      if (backends_[flushed[k]]->dims()) {
+        settle_values(r);
+        continue;
+      }
+      size_t sent = 0;
+      for (size_t i = 0; i < r.count; ++i)
+        if (bit(r.changed, i)) {
+          const auto b = uint64_t(1) << ((r.first + i) % 64);
+          shadow_[(r.first + i) / 64] ^= b;
+          urgent_[(r.first + i) / 64] &= ~b;
+          ++sent;
+        }
+      stats_.changed += sent;
+      // Channels per second the bus sustained, a flush too short to
+      // time tells nothing
+      if (r.flush_us > 0) {
+        const double rate = sent * 1e6 / r.flush_us;
+        r.rate            = r.rate > 0 ? (r.rate * 3 + rate) / 4 : rate;
+      }
+    }
+
+    const auto end = clock::now();
+    const auto us  = elapsed_us(start);
+    record(stats_.latency_log2_us, us);
+    stats_.max_latency_us = std::max(stats_.max_latency_us, us);
+    ++stats_.commits;
+    stats_.staged += pending_;
+    stats_.writes += writes;
+    pending_ = 0;
+
+    if (urgent_sent && urgent_since_) {
+      const auto waited = elapsed_us(*urgent_since_, end);
+      record(stats_.interactive_log2_us, waited);
+      stats_.interactive_max_us = std::max(stats_.interactive_max_us, waited);
+      ++stats_.interactive;
+      stats_.interactive_in_burst += in_burst;
+      urgent_since_.reset();
+      if (any(urgent_, 0, channels_))
+        urgent_since_ = end;
+    }
+
+    if (deferred && !burst_start_) {
+      burst_start_ = start;
+      ++stats_.bursts;
+    } else if (!deferred && burst_start_) {
+      stats_.last_drain_ms = elapsed_us(*burst_start_, end) / 1000;
+      stats_.max_drain_ms  = std::max(stats_.max_drain_ms, stats_.last_drain_ms);
+      burst_start_.reset();
+    }
+    stats_.deferred = deferred;
+    return writes;
+  }
+
+ private:
+  struct range {
+    size_t first;
+    size_t count;
+    std::vector<uint64_t> levels;
+    std::vector<uint64_t> changed;
+    uint64_t writes;
+    uint64_t failures;
+    double rate;     // Channels per second, 0 until measured
+    size_t burst;    // Changes pending when the current burst began
+    size_t backlog;  // Changes held back by the last commit
+    uint64_t credit_us;  // Time the paced changes are owed
+    uint64_t flush_us;
+  };
+
+  static uint64_t elapsed_us(clock::time_point since, clock::time_point until = clock::now()) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(until - since).count();
+  }
+
+  // A dimming backend takes all changed values of its range. Returns
+  // whether any of them is urgent.
+  bool select_values(range &r) {
+    r.changed.assign((r.count + 63) / 64, 0);
+    r.backlog   = 0;
+    bool urgent = false;
+    for (size_t i = 0; i < r.count; ++i) {
+      r.changed[i / 64] |= uint64_t(bit(dimmed_, r.first + i)) << (i % 64);
+      urgent |= bit(dimmed_, r.first + i) && bit(urgent_, r.first + i);
+    }
+    return urgent;
+  }
+
+  // After a flush the values flushed are what the hardware shows
+  void settle_values(range &r) {
+    for (size_t i = 0; i < r.count; ++i) {
+      if (!bit(r.changed, i))
+        continue;
+      const size_t c = r.first + i;
+      const auto b   = uint64_t(1) << (c % 64);
+      shadow_[c / 64] = values_[c] >= half ? shadow_[c / 64] | b : shadow_[c / 64] & ~b;
+      urgent_[c / 64] &= ~b;
+      dimmed_[c / 64] &= ~b;
+      ++stats_.dimmed;
+    }
+  }
+
+  void dim(size_t channel, uint8_t value) {
+    if (values_[channel] == value)
+      return;
+    values_[channel] = value;
+    dimmed_[channel / 64] |= uint64_t(1) << (channel % 64);
+  }
+
+  // Paced changes a backend takes in this commit: a slice of bus time at
+  // its measured rate, and at least the share of the burst due for the
+  // time owed to drain it within the window. Urgent changes go out on
+  // their own, the paced ones keep their time for the next commit.
+  size_t budget(range &r) {
+    size_t pending = 0, urgent = 0;
+    for (size_t i = r.first; i < r.first + r.count; ++i) {
+      pending += bit(changed_, i) && !bit(urgent_, i);
+      urgent += bit(changed_, i) && bit(urgent_, i);
+    }
+    if (!r.backlog)
+      r.burst = pending;
+    // After a quiet spell a burst still starts out paced
+    const auto window_us = uint64_t(std::chrono::microseconds(pacing_.window).count());
+    r.credit_us          = std::min(r.credit_us + since_last_us_, window_us / 4);
+    if (urgent && r.backlog)
+      return 0;
+    if (r.rate <= 0)
+      return pending;
+
+    const double slice = r.rate * pacing_.bus_slice.count() / 1e6;
+    const double drain = r.burst * double(r.credit_us) / window_us;
+    r.credit_us        = 0;
+    return std::max<size_t>(1, size_t(std::ceil(std::max(slice, drain))));
+  }
+
+  // Fills the range's levels and changed bits with every urgent change
+  // and up to 'budget' paced ones, held back channels keep their shadow
+  // level. Returns whether any urgent change was selected.
+  bool select(range &r, size_t budget) {
+    r.levels.assign((r.count + 63) / 64, 0);
+    r.changed.assign(r.levels.size(), 0);
+    r.backlog   = 0;
+    bool urgent = false;
+    for (size_t i = 0; i < r.count; ++i) {
+      const size_t c = r.first + i;
+      bool send      = false;
+      if (bit(changed_, c) && bit(urgent_, c)) {
+        send = urgent = true;
+      } else if (bit(changed_, c) && budget) {
+        send = true;
+        --budget;
+      } else if (bit(changed_, c)) {
+        ++r.backlog;
+      }
+      r.levels[i / 64] |= uint64_t(send ? bit(staged_, c) : bit(shadow_, c)) << (i % 64);
+      r.changed[i / 64] |= uint64_t(send) << (i % 64);
+    }
+    return urgent;
+  }
+
+  size_t channels_{};
+  size_t pending_{};
+  std::vector<std::unique_ptr<backend>> backends_;
+  std::vector<range> ranges_;
+  std::vector<uint64_t> staged_;
+  std::vector<uint64_t> shadow_;
+  std::vector<uint64_t> changed_;
+  std::vector<uint64_t> urgent_;
+  std::vector<uint64_t> dims_;    // Channels of dimming backends
+  std::vector<uint64_t> dimmed_;  // Values changed since the last flush
+  std::vector<uint8_t> values_;
+  pacing pacing_;
+  uint64_t since_last_us_{};
+  clock::time_point last_commit_;
+  std::optional<clock::time_point> urgent_since_;
+  std::optional<clock::time_point> burst_start_;
+  commit_stats stats_;
+};
+}  // namespace outputs
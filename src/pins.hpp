@@ -0,0 +1,345 @@
+/**
+ * Pin descriptors and the one code path that drives them.
+ *
+ * A descriptor holds what the hw templates bake into their type: name,
+ * pin, bank, direction and pull. The hw templates pass constant
+ * descriptors to the routines below, which inline to the same code as
+ * before. A pin_table holds descriptors loaded at runtime, e.g.
+ *
+ *   # name     pin  dir  [pull]      [bank]  [role]
+ *   porch      0    out
+ *   garden     2    out              1
+ *   doorbell   7    in   pull_up     1       onoff
+ *
+ * and runs them through the same routines. Inputs of one bank are
+ * sampled together, like an hw::input_group. Every input takes one of
+ * the roles the caller names, sample_roles() reports the roles whose
+ * inputs changed. As an output backend the table's outputs take output
+ * layer channels, in table order.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gpio.hpp"
+#include "outputs.hpp"
+#include "recorder.hpp"
+
+#if __has_include("wiringPi.h")
+#include "wiringPi.h"
+#define ON_RPI
+#endif
+
+namespace hw {
+enum LEVEL { LOW, HIGH };
+enum INPUT_MODE { PULL_DOWN, PULL_UP };
+
+struct pin_desc {
+  const char *name;
+  int pin;
+  uint8_t bank;
+  bool output;
+  INPUT_MODE mode;
+};
+
+// SHARED ROUTINES
+inline void setup_pin(const pin_desc &d) {
+  if (backend)
+    return d.output ? backend->setup_output(d.pin) : backend->setup_input(d.pin, d.mode == PULL_UP);
+#ifdef ON_RPI
+  if (d.output) {
+    pinMode(uint8_t(d.pin), OUTPUT);
+  } else {
+    pinMode(d.pin, INPUT);
+    pullUpDnControl(d.pin, d.mode);
+  }
+#endif
+}
+
+inline bool read_pin(const pin_desc &d) {
+  if (backend)
+    return backend->read(d.pin);
+#ifdef ON_RPI
+  return digitalRead(d.pin);
+#else
+  return rand() % 1000 ? false : true;
+#endif
+}
+
+inline void write_pin(const pin_desc &d, bool level) {
+  if (backend)
+    backend->write(d.pin, level);
+#ifdef ON_RPI
+  else
+    digitalWrite(uint8_t(d.pin), level ? HIGH : LOW);
+#endif
+}
+
+// Records a level change, or prints it when nothing records, 'id' is
+// the name's recorder index
+inline void log_change(const pin_desc &d, bool level, uint16_t id) {
+  if (auto *rec = recorder::active)
+    rec->write(d.output ? recorder::OUTPUT : recorder::INPUT, id, uint16_t(d.pin), 0, level);
+  else if (d.output)
+    printf("  Output [%s] (%d) toggled %s\n", d.name, d.pin, level ? "HIGH" : "LOW");
+  else
+    printf("  Input [%s] (%d) toggled '%s'\n", d.name, d.pin, level ? "HIGH" : "LOW");
+}
+
+// COMPILE-TIME FRONT END
+template <auto Name, int Pin>
+struct output {
+  static constexpr pin_desc desc{Name, Pin, 0, true, PULL_DOWN};
+  // Written by the thread driving the output, read by any
+  inline static std::atomic<bool> last_value{false};
+
+  static uint16_t record_id() { return recorder::active ? recorder::id_of<output>(Name) : 0; }
+
+  static constexpr auto setup = [] { setup_pin(desc); };
+
+  static constexpr auto on = [] {
+    write_pin(desc, true);
+    if (!last_value.exchange(true))
+      log_change(desc, true, record_id());
+  };
+
+  static constexpr auto off = [] {
+    write_pin(desc, false);
+    if (last_value.exchange(false))
+      log_change(desc, false, record_id());
+  };
+};
+
+template <auto Name, int Pin, INPUT_MODE Mode>
+struct input {
+  static constexpr pin_desc desc{Name, Pin, 0, false, Mode};
+  inline static bool last_value{false};
+
+  static uint16_t record_id() { return recorder::active ? recorder::id_of<input>(Name) : 0; }
+
+  static constexpr auto setup = [] { setup_pin(desc); };
+
+  static bool read() { return read_pin(desc); }
+
+  // Latches a sampled level, true when it differs from the previous one
+  static bool update(bool is_pressed) {
+    if (last_value != is_pressed) {
+      last_value = is_pressed;
+      log_change(desc, is_pressed, record_id());
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  static constexpr auto toggled = [] { return update(read()); };
+};
+
+// Inputs sampled together, bit 'i' belongs to the i-th input
+template <class... Inputs>
+struct input_group {
+  static_assert(sizeof...(Inputs) <= 32);
+
+  // Reads every input once, in one pass
+  static uint32_t sample() {
+    uint32_t levels{};
+    uint32_t bit{1};
+    ((levels |= Inputs::read() ? bit : 0, bit <<= 1), ...);
+    return levels;
+  }
+
+  // Latches a sample, returns the mask of inputs that changed
+  static uint32_t update(uint32_t levels) {
+    uint32_t changed{};
+    uint32_t bit{1};
+    ((changed |= Inputs::update(levels & bit) ? bit : 0, bit <<= 1), ...);
+    return changed;
+  }
+};
+
+// RUNTIME FRONT END
+class pin_table {
+ public:
+  // One descriptor per line, see above, inputs take one of 'roles'.
+  // Returns false on the first bad line.
+  bool load(const std::string &path, const std::vector<std::string> &roles = {}) {
+    std::ifstream in(path);
+    if (!in) {
+      printf("  Pins %s: cannot open\n", path.c_str());
+      return false;
+    }
+    std::string line;
+    for (size_t n = 1; std::getline(in, line); ++n) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream fields(line);
+      std::string name, dir, word;
+      int pin;
+      if (!(fields >> name))
+        continue;
+      auto bad = [&](const char *what) {
+        printf("  Pins %s:%zu: %s\n", path.c_str(), n, what);
+        return false;
+      };
+      if (!(fields >> pin >> dir) || (dir != "in" && dir != "out") || pin < 0)
+        return bad("expected 'name pin in|out [pull_up|pull_down] [bank] [role]'");
+      INPUT_MODE mode = PULL_DOWN;
+      uint8_t bank    = 0;
+      uint8_t role    = no_role;
+      while (fields >> word) {
+        const auto named = std::find(roles.begin(), roles.end(), word);
+        const auto last  = word.data() + word.size();
+        if (word == "pull_up" || word == "pull_down")
+          mode = word == "pull_up" ? PULL_UP : PULL_DOWN;
+        else if (named != roles.end() && dir == "in")
+          role = uint8_t(named - roles.begin());
+        else if (const auto [end, ec] = std::from_chars(word.data(), last, bank); ec != std::errc{} || end != last)
+          return bad(("bank or role expected, not '" + word + "'").c_str());
+      }
+      if (dir == "in" && role == no_role)
+        return bad("an input needs a role, nothing reads it otherwise");
+      add(name, pin, dir == "out", mode, bank, role);
+    }
+    printf("  Pins %s: %zu pins\n", path.c_str(), pins_.size());
+    return true;
+  }
+
+  size_t add(std::string name,
+             int pin,
+             bool output,
+             INPUT_MODE mode = PULL_DOWN,
+             uint8_t bank    = 0,
+             uint8_t role    = no_role) {
+    names_.push_back(std::move(name));
+    pins_.push_back({{names_.back().c_str(), pin, bank, output, mode}, false, none, role});
+    (output ? outputs_ : inputs_).push_back(pins_.size() - 1);
+    banks_ = std::max(banks_, bank + 1u);
+    return pins_.size() - 1;
+  }
+
+  size_t size() const { return pins_.size(); }
+  const pin_desc &at(size_t i) const { return pins_[i].desc; }
+  bool level(size_t i) const { return pins_[i].level; }
+  const std::vector<size_t> &outputs() const { return outputs_; }
+  const std::vector<size_t> &inputs() const { return inputs_; }
+  unsigned banks() const { return banks_; }
+
+  std::optional<size_t> find(const std::string &name) const {
+    for (size_t i = 0; i < names_.size(); ++i)
+      if (names_[i] == name)
+        return i;
+    return std::nullopt;
+  }
+
+  void setup() {
+    for (const auto &p : pins_)
+      setup_pin(p.desc);
+  }
+
+  void write(size_t i, bool level) {
+    auto &p = pins_[i];
+    write_pin(p.desc, level);
+    if (p.level != level) {
+      p.level = level;
+      log_change(p.desc, level, record_id(p));
+    }
+  }
+
+  // Latches a sampled input level, true when it changed
+  bool update(size_t i, bool level) {
+    auto &p = pins_[i];
+    if (p.level == level)
+      return false;
+    p.level = level;
+    log_change(p.desc, level, record_id(p));
+    return true;
+  }
+
+  // Samples every input of 'bank', returns the mask of the ones that
+  // changed, bit 'k' is the k-th input of the bank in table order
+  uint64_t sample(uint8_t bank) {
+    uint64_t changed{}, bit{1};
+    for (const auto i : inputs_) {
+      if (pins_[i].desc.bank != bank)
+        continue;
+      changed |= update(i, read_pin(pins_[i].desc)) ? bit : 0;
+      bit <<= 1;
+    }
+    return changed;
+  }
+
+  // Samples every bank, returns the mask of roles with an input that
+  // changed, bit 'r' is the r-th role passed to load()
+  uint32_t sample_roles() {
+    uint32_t changed{};
+    for (unsigned bank = 0; bank < banks_; ++bank) {
+      const auto inputs = sample(uint8_t(bank));
+      uint64_t bit{1};
+      for (const auto i : inputs_) {
+        if (pins_[i].desc.bank != bank)
+          continue;
+        if ((inputs & bit) && pins_[i].role < 32)
+          changed |= uint32_t(1) << pins_[i].role;
+        bit <<= 1;
+      }
+    }
+    return changed;
+  }
+
+  static constexpr uint8_t no_role = 0xff;
+
+ private:
+  static constexpr uint16_t none = 0xffff;
+
+  struct entry {
+    pin_desc desc;
+    bool level;
+    uint16_t id;  // Recorder name index, interned on the first change
+    uint8_t role;
+  };
+
+  static uint16_t record_id(entry &p) {
+    if (p.id == none && recorder::active)
+      p.id = recorder::active->intern(p.desc.name);
+    return p.id;
+  }
+
+  std::deque<std::string> names_;  // Stay in place, descriptors point at them
+  std::vector<entry> pins_;
+  std::vector<size_t> outputs_;
+  std::vector<size_t> inputs_;
+  unsigned banks_{};
+};
+
+class pin_outputs : public outputs::backend {
+ public:
+  explicit pin_outputs(pin_table &table) : table_{table} {}
+
+  const char *name() const override { return "pins"; }
+  size_t channels() const override { return table_.outputs().size(); }
+
+  std::optional<size_t> flush(outputs::bits levels, outputs::bits changed) override {
+    size_t writes = 0;
+    for (size_t i = 0; i < channels(); ++i)
+      if (outputs::bit(changed, i)) {
+        table_.write(table_.outputs()[i], outputs::bit(levels, i));
+        ++writes;
+      }
+    return writes;
+  }
+
+ private:
+  pin_table &table_;
+};
+}  // namespace hw
@@ -0,0 +1,135 @@
+/**
+ * Code size and per-pin cost of the hw templates against a pin_table.
+ *
+ * Drives 32 outputs, once as hw::output templates, one type per pin,
+ * and once as the outputs of a runtime hw::pin_table, both through a
+ * backend that only counts writes. Each front end runs in a function of
+ * its own, whose size this binary reads back from its own symbol table,
+ * next to the shared routines both call out of line. The per-pin cost is
+ * the time per write at an unchanged level, changed levels print and
+ * record the same way in both. Both must write every pin every round.
+ *
+ *   pins_bench [--rounds=N]
+ **/
+
+#include <elf.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pins.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct counting_backend : hw::gpio_backend {
+  void setup_input(int, bool) override {}
+  void setup_output(int) override {}
+  bool read(int) override { return false; }
+  void write(int, bool) override { ++writes; }
+  uint64_t writes{};
+};
+
+static constexpr int pin_count = 32;
+
+template <int Pin>
+struct pin_name {
+  static constexpr char value[] = {'o', 'u', 't', char('0' + Pin / 10), char('0' + Pin % 10), '\0'};
+};
+template <int Pin>
+using template_pin = hw::output<pin_name<Pin>::value, Pin>;
+
+extern "C" __attribute__((noinline)) void drive_templates(bool level) {
+  [&]<int... Pin>(std::integer_sequence<int, Pin...>) {
+    ((level ? template_pin<Pin>::on() : template_pin<Pin>::off()), ...);
+  }(std::make_integer_sequence<int, pin_count>{});
+}
+
+extern "C" __attribute__((noinline)) void drive_table(hw::pin_table &table, bool level) {
+  for (const auto i : table.outputs())
+    table.write(i, level);
+}
+
+// Sizes of the function symbols of this binary whose names contain 'part'
+static size_t code_size(const std::string &part) {
+  std::ifstream in("/proc/self/exe", std::ios::binary);
+  const std::string image{std::istreambuf_iterator<char>(in), {}};
+  if (image.size() < sizeof(Elf64_Ehdr))
+    return 0;
+  const auto *eh       = reinterpret_cast<const Elf64_Ehdr *>(image.data());
+  const auto *sections = reinterpret_cast<const Elf64_Shdr *>(image.data() + eh->e_shoff);
+  size_t total         = 0;
+  for (size_t s = 0; s < eh->e_shnum; ++s) {
+    if (sections[s].sh_type != SHT_SYMTAB)
+      continue;
+    const auto *syms    = reinterpret_cast<const Elf64_Sym *>(image.data() + sections[s].sh_offset);
+    const char *strings = image.data() + sections[sections[s].sh_link].sh_offset;
+    for (size_t i = 0; i < sections[s].sh_size / sizeof(Elf64_Sym); ++i)
+      if (ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC && strstr(strings + syms[i].st_name, part.c_str()))
+        total += syms[i].st_size;
+  }
+  return total;
+}
+
+int main(int argc, char *argv[]) {
+  auto args         = std::vector<std::string>(argv, argv + argc);
+  const auto rounds = std::stoul(option(args, "rounds").value_or("1000000"));
+
+  counting_backend backend;
+  hw::backend = &backend;
+  hw::pin_table table;
+  for (int pin = 0; pin < pin_count; ++pin)
+    table.add("out" + std::to_string(pin), pin, true);
+
+  // Every pin starts low in both front ends and stays low
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; ++r)
+    drive_templates(false);
+  const auto templates_ns    = since_ns(start);
+  const auto template_writes = backend.writes;
+
+  backend.writes = 0;
+  start          = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; ++r)
+    drive_table(table, false);
+  const auto table_ns     = since_ns(start);
+  const auto table_writes = backend.writes;
+
+  const auto writes = double(rounds) * pin_count;
+  printf("  %d output pins, %zu rounds\n", pin_count, size_t(rounds));
+  printf("  templates   %6.2f ns per pin write %6zu bytes of code\n",
+         templates_ns / writes,
+         code_size("drive_templates") + code_size("N2hw6outputI"));
+  printf("  pin_table   %6.2f ns per pin write %6zu bytes of code\n",
+         table_ns / writes,
+         code_size("drive_table") + code_size("N2hw9pin_table5write"));
+  printf("  shared      %6s                    %6zu bytes of code (write_pin, log_change)\n",
+         "",
+         code_size("hw9write_pin") + code_size("hw10log_change"));
+  hw::backend = nullptr;
+
+  if (template_writes != writes || table_writes != writes) {
+    printf("  FAILED: %llu and %llu writes, %.0f expected\n",
+           (unsigned long long)template_writes,
+           (unsigned long long)table_writes,
+           writes);
+    return 1;
+  }
+  return 0;
+}
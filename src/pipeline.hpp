@@ -0,0 +1,157 @@
+/**
+ * Input to output pipelines composed at compile time.
+ *
+ * Every stage binds to the stage after it and calls it directly, so a
+ * composed pipeline is a single nested callable: one sample runs through
+ * all stages in one go, without buffers or virtual calls in between.
+ *
+ *   auto path = pipeline::compose(pipeline::sample<inputs>(),
+ *                                 pipeline::debounce(3),
+ *                                 pipeline::coalesce<inputs>(),
+ *                                 pipeline::map_events(fn),
+ *                                 pipeline::to_sm(sm),
+ *                                 pipeline::to_output<do_light>(level));
+ *   path();  // One sample, start to finish
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+namespace pipeline {
+// Swallows whatever reaches the end of a pipeline
+struct end {
+  template <class... T>
+  void operator()(T &&...) const {}
+};
+
+// Binds the stages back to front, the first stage is the entry point
+template <class Stage, class... Rest>
+auto compose(Stage first, Rest... rest) {
+  if constexpr (sizeof...(Rest) == 0)
+    return first.bind(end{});
+  else
+    return first.bind(compose(rest...));
+}
+
+// SOURCES
+// One sample of every input in an hw::input_group, as a level mask
+template <class Group>
+struct sample {
+  template <class Next>
+  auto bind(Next next) const {
+    return [next]() mutable { next(Group::sample()); };
+  }
+};
+
+// Whatever fn() returns, e.g. levels read some other way
+template <class Fn>
+struct from {
+  explicit from(Fn fn) : fn{std::move(fn)} {}
+  Fn fn;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, fn = fn]() mutable { next(fn()); };
+  }
+};
+
+// STAGES
+// A new level mask is passed on once it was sampled 'count' times in a row
+struct debounce {
+  explicit debounce(uint32_t count) : count{count} {}
+  uint32_t count;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, count = count, candidate = uint32_t{}, stable = uint32_t{}, seen = uint32_t{}](
+               uint32_t levels) mutable {
+      if (levels != candidate) {
+        candidate = levels;
+        seen      = 0;
+      }
+      if (++seen >= count)
+        stable = candidate;
+      next(stable);
+    };
+  }
+};
+
+// Latches levels into the hw::input_group, passes on non-empty change masks
+template <class Group>
+struct coalesce {
+  template <class Next>
+  auto bind(Next next) const {
+    return [next](uint32_t levels) mutable {
+      if (const auto changed = Group::update(levels))
+        next(changed);
+    };
+  }
+};
+
+// Calls fn with whatever passes, then passes it on unchanged
+template <class Fn>
+struct tap {
+  explicit tap(Fn fn) : fn{std::move(fn)} {}
+  Fn fn;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, fn = fn](auto &&...values) mutable {
+      fn(values...);
+      next(std::forward<decltype(values)>(values)...);
+    };
+  }
+};
+
+// fn(changed, emit) calls emit with zero or more events of any type
+template <class Fn>
+struct map_events {
+  explicit map_events(Fn fn) : fn{std::move(fn)} {}
+  Fn fn;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, fn = fn](uint32_t changed) mutable { fn(changed, next); };
+  }
+};
+
+// Feeds events to a state machine, continues for every handled event
+template <class SM>
+struct to_sm {
+  explicit to_sm(SM &sm) : sm{sm} {}
+  SM &sm;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, &sm = sm](const auto &event) mutable {
+      if (sm.process_event(event))
+        next();
+    };
+  }
+};
+
+// SINKS
+// Drives an hw::output to the level fn() decides
+template <class Output, class Fn>
+struct drive {
+  Fn fn;
+
+  template <class Next>
+  auto bind(Next next) const {
+    return [next, fn = fn]() mutable {
+      if (fn())
+        Output::on();
+      else
+        Output::off();
+      next();
+    };
+  }
+};
+
+template <class Output, class Fn>
+auto to_output(Fn fn) {
+  return drive<Output, Fn>{std::move(fn)};
+}
+}  // namespace pipeline
@@ -0,0 +1,161 @@
+/**
+ * Cost per sample of a fused pipeline against the same stages unfused.
+ *
+ * Runs --samples recorded levels of two inputs, flipping on about one
+ * sample in --flip-every, through source, debounce, coalesce, event map,
+ * state machine and output. The fused path is one pipeline::compose()
+ * called per sample. The unfused path runs each stage over the whole
+ * recording and hands a buffer to the next, as stages that do not know
+ * each other would. Both must end in the same state and drive the output
+ * the same number of times.
+ *
+ *   pipeline_bench [--samples=N] [--flip-every=N] [--debounce=N] [--seed=N]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "pipeline.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+namespace bench {
+enum INPUT_BIT : uint32_t { ONOFF = 1 << 0, MODE = 1 << 1 };
+
+// Latches levels like an hw::input_group, without pins or logs
+struct inputs {
+  inline static uint32_t last{};
+  static uint32_t update(uint32_t levels) {
+    const auto changed = levels ^ last;
+    last               = levels;
+    return changed;
+  }
+};
+
+struct turn_on {};
+struct turn_off {};
+struct change_on_time {};
+using event = std::variant<turn_on, turn_off, change_on_time>;
+
+// The controller's table: off -> on -> off, the timeslot flips while on
+struct light_sm {
+  bool on{false};
+  bool short_slot{false};
+  bool process_event(turn_on) { return !on && (on = true); }
+  bool process_event(turn_off) { return on && !(on = false); }
+  bool process_event(change_on_time) { return on && ((short_slot = !short_slot), true); }
+};
+
+struct light {
+  inline static uint64_t writes{};
+  inline static bool level{};
+  static void on() { level = true, ++writes; }
+  static void off() { level = false, ++writes; }
+};
+}  // namespace bench
+
+int main(int argc, char *argv[]) {
+  auto args          = std::vector<std::string>(argv, argv + argc);
+  const auto samples = std::stoul(option(args, "samples").value_or("10000000"));
+  const auto every   = std::max(1ul, std::stoul(option(args, "flip-every").value_or("50")));
+  const auto count   = uint32_t(std::stoul(option(args, "debounce").value_or("3")));
+  std::mt19937_64 rng{std::stoul(option(args, "seed").value_or("1"))};
+
+  std::vector<uint32_t> recording(samples);
+  uint32_t levels = 0;
+  for (auto &l : recording) {
+    if (rng() % every == 0)
+      levels ^= rng() % 2 ? bench::ONOFF : bench::MODE;
+    l = levels;
+  }
+
+  using namespace bench;
+  auto map = [](light_sm &sm) {
+    return [&sm](uint32_t changed, auto &emit) {
+      if (changed & ONOFF)
+        sm.on ? emit(turn_off{}) : emit(turn_on{});
+      if (changed & MODE)
+        emit(change_on_time{});
+    };
+  };
+
+  // Fused, one call per sample runs every stage
+  light_sm fused_sm;
+  size_t at  = 0;
+  auto path  = pipeline::compose(pipeline::from([&] { return recording[at]; }),
+                                pipeline::debounce(count),
+                                pipeline::coalesce<inputs>(),
+                                pipeline::map_events(map(fused_sm)),
+                                pipeline::to_sm(fused_sm),
+                                pipeline::to_output<light>([&] { return fused_sm.on; }));
+  auto start = std::chrono::steady_clock::now();
+  for (at = 0; at < samples; ++at)
+    path();
+  const auto fused_ns     = since_ns(start);
+  const auto fused_writes = light::writes;
+  const bool fused_level  = light::level;
+
+  // Unfused, every stage makes a pass over the output of the one before
+  light_sm sm;
+  inputs::last  = 0;
+  light::writes = 0;
+  light::level  = false;
+  start         = std::chrono::steady_clock::now();
+  std::vector<uint32_t> sampled(recording.begin(), recording.end());
+  std::vector<uint32_t> stable(samples);
+  uint32_t candidate = 0, steady = 0, seen = 0;
+  for (size_t i = 0; i < samples; ++i) {
+    if (sampled[i] != candidate) {
+      candidate = sampled[i];
+      seen      = 0;
+    }
+    if (++seen >= count)
+      steady = candidate;
+    stable[i] = steady;
+  }
+  std::vector<uint32_t> changes;
+  for (const auto l : stable)
+    if (const auto changed = inputs::update(l))
+      changes.push_back(changed);
+  std::vector<event> events;
+  for (const auto changed : changes) {
+    // Each mask sees the state its events left behind, like the fused path
+    auto emit = [&](auto e) { events.push_back(e); };
+    map(sm)(changed, emit);
+    for (const auto &e : events)
+      if (std::visit([&](auto ev) { return sm.process_event(ev); }, e))
+        sm.on ? light::on() : light::off();
+    events.clear();
+  }
+  const auto unfused_ns = since_ns(start);
+
+  printf("  %zu samples, a flip every %zu, debounce %u\n", size_t(samples), size_t(every), count);
+  printf("  fused    %6.2f ns per sample %8llu output writes\n",
+         fused_ns / samples,
+         (unsigned long long)fused_writes);
+  printf("  unfused  %6.2f ns per sample %8llu output writes\n",
+         unfused_ns / samples,
+         (unsigned long long)light::writes);
+
+  if (fused_writes != light::writes || fused_level != light::level || fused_sm.on != sm.on ||
+      fused_sm.short_slot != sm.short_slot) {
+    printf("  FAILED: the fused and unfused pipelines disagree\n");
+    return 1;
+  }
+  return 0;
+}
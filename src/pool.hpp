@@ -0,0 +1,257 @@
+/**
+ * Pool of per-zone state machines with batched event dispatch.
+ *
+ * Zones in the default state are not stored at all: a bitset marks the
+ * zones that were touched, everything else reads as the shared default.
+ * State machine and zone storage is materialized on the first event for
+ * a zone and reclaimed once the zone is back in the default state.
+ *
+ * A batch is split into rounds so that every zone sees its events in
+ * order, the n-th event of a zone lands in round n. Within a round the
+ * events are grouped by event type and current state, so the same
+ * transition runs back-to-back over many zones.
+ *
+ * Traits supplies the zone and state machine types and:
+ *   static constexpr size_t event_types, states, default_state;
+ *   static size_t state(sm_type &);
+ *   static bool dispatch(sm_type &, const zones::event &);
+ *   static bool is_default(sm_type &, const zone_type &);
+ *   static void reset(zone_type &);
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <vector>
+
+namespace zones {
+struct event {
+  uint32_t zone;
+  uint16_t type;
+  uint16_t arg;  // Event payload, e.g. the start minute of a turn_on
+};
+
+struct pool_stats {
+  uint64_t batches{};
+  uint64_t events{};
+  uint64_t handled{};
+  uint64_t rounds{};
+  uint64_t materialized{};
+  uint64_t reclaimed{};
+  uint64_t first_touch_ns{};  // Total time spent materializing zones
+};
+
+template <class Traits>
+class pool {
+ public:
+  using zone_type = typename Traits::zone_type;
+  using sm_type   = typename Traits::sm_type;
+
+  explicit pool(size_t size)
+      : size_{size}, touched_((size + 63) / 64), page_of_((size + 63) / 64, none) {}
+
+  size_t size() const { return size_; }
+  size_t live() const { return slots_.size() - free_slots_.size(); }
+  const pool_stats &stats() const { return stats_; }
+
+  bool touched(size_t zone) const { return touched_[zone / 64] >> (zone % 64) & 1; }
+
+  size_t state(size_t zone) {
+    return touched(zone) ? Traits::state(slot_of(zone).sm) : Traits::default_state;
+  }
+
+  // Untouched zones all read as the same default zone
+  const zone_type &zone(size_t i) {
+    return touched(i) ? slot_of(i).zone : default_zone_;
+  }
+
+  // Visits only materialized zones: fn(zone id, zone_type &, sm_type &)
+  template <class Fn>
+  void for_each_touched(Fn &&fn) {
+    for (auto &s : slots_)
+      if (s.id != none)
+        fn(size_t(s.id), s.zone, s.sm);
+  }
+
+  // Bytes held by the pool, default zones cost one bit each
+  size_t memory_bytes() const {
+    return sizeof(*this) + touched_.capacity() * sizeof(uint64_t) +
+           page_of_.capacity() * sizeof(uint32_t) + pages_.size() * sizeof(page) +
+           slots_.size() * sizeof(slot) +
+           (free_slots_.capacity() + free_pages_.capacity()) * sizeof(uint32_t);
+  }
+
+  bool process_event(const event &e) {
+    ++stats_.events;
+    const bool handled = e.zone < size_ && e.type < Traits::event_types &&
+                         dispatch(e);
+    stats_.handled += handled;
+    return handled;
+  }
+
+  // Returns the number of events the state machines handled
+  size_t process_events(std::span<const event> events) {
+    ++stats_.batches;
+
+    // Round of every event: how many events of its zone came before it
+    by_zone_.clear();
+    for (size_t i = 0; i < events.size(); ++i)
+      if (events[i].zone < size_ && events[i].type < Traits::event_types)
+        by_zone_.push_back(uint64_t(events[i].zone) << 32 | i);
+    std::sort(by_zone_.begin(), by_zone_.end());
+
+    size_t rounds = 0;
+    round_.resize(by_zone_.size());
+    for (size_t i = 0; i < by_zone_.size(); ++i) {
+      const bool same = i > 0 && (by_zone_[i] >> 32) == (by_zone_[i - 1] >> 32);
+      round_[i]       = same ? round_[i - 1] + 1 : 0;
+      rounds          = std::max(rounds, size_t(round_[i]) + 1);
+    }
+
+    // Counting sort by round, zones stay in ascending order within a round
+    by_round_.assign(rounds + 1, 0);
+    for (const auto r : round_)
+      ++by_round_[r + 1];
+    for (size_t r = 0; r < rounds; ++r)
+      by_round_[r + 1] += by_round_[r];
+    order_.resize(by_zone_.size());
+    {
+      auto next = by_round_;
+      for (size_t i = 0; i < by_zone_.size(); ++i)
+        order_[next[round_[i]]++] = uint32_t(by_zone_[i]);
+    }
+
+    size_t handled = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+      const auto first = order_.begin() + by_round_[r];
+      const auto last  = order_.begin() + by_round_[r + 1];
+
+      // A zone appears at most once per round, so states are stable here
+      constexpr size_t groups = Traits::event_types * Traits::states;
+      size_t start[groups + 1]{};
+      group_.resize(last - first);
+      keys_.resize(last - first);
+      for (auto it = first; it != last; ++it) {
+        const auto &e     = events[*it];
+        keys_[it - first] = uint8_t(e.type * Traits::states + state(e.zone));
+        ++start[keys_[it - first] + 1];
+      }
+      for (size_t g = 0; g < groups; ++g)
+        start[g + 1] += start[g];
+      for (auto it = first; it != last; ++it)
+        group_[start[keys_[it - first]]++] = *it;
+
+      for (const auto i : group_)
+        handled += dispatch(events[i]);
+    }
+
+    stats_.rounds += rounds;
+    stats_.events += events.size();
+    stats_.handled += handled;
+    return handled;
+  }
+
+ private:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct slot {
+    slot() : sm{zone} {}
+    zone_type zone;
+    sm_type sm;
+    uint32_t id{none};
+  };
+
+  // Slot indices of 64 neighbouring zones
+  struct page {
+    std::array<uint32_t, 64> slots;
+    uint32_t used;
+  };
+
+  slot &slot_of(size_t zone) {
+    return slots_[pages_[page_of_[zone / 64]].slots[zone % 64]];
+  }
+
+  bool dispatch(const event &e) {
+    auto &s            = materialize(e.zone);
+    const bool handled = Traits::dispatch(s.sm, e);
+    if (Traits::is_default(s.sm, s.zone))
+      reclaim(e.zone);
+    return handled;
+  }
+
+  slot &materialize(size_t zone) {
+    if (touched(zone))
+      return slot_of(zone);
+    const auto start = std::chrono::steady_clock::now();
+
+    auto &p = page_of_[zone / 64];
+    if (p == none) {
+      if (free_pages_.empty()) {
+        p = uint32_t(pages_.size());
+        pages_.emplace_back();
+      } else {
+        p = free_pages_.back();
+        free_pages_.pop_back();
+      }
+      pages_[p].used = 0;
+    }
+
+    uint32_t index;
+    if (free_slots_.empty()) {
+      index = uint32_t(slots_.size());
+      slots_.emplace_back();
+    } else {
+      index = free_slots_.back();
+      free_slots_.pop_back();
+    }
+    pages_[p].slots[zone % 64] = index;
+    ++pages_[p].used;
+    slots_[index].id = uint32_t(zone);
+    touched_[zone / 64] |= uint64_t(1) << (zone % 64);
+
+    ++stats_.materialized;
+    stats_.first_touch_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+    return slots_[index];
+  }
+
+  // The state machine is back in its initial state, only the zone resets
+  void reclaim(size_t zone) {
+    auto &p          = page_of_[zone / 64];
+    const auto index = pages_[p].slots[zone % 64];
+    Traits::reset(slots_[index].zone);
+    slots_[index].id = none;
+    free_slots_.push_back(index);
+    touched_[zone / 64] &= ~(uint64_t(1) << (zone % 64));
+    if (--pages_[p].used == 0) {
+      free_pages_.push_back(p);
+      p = none;
+    }
+    ++stats_.reclaimed;
+  }
+
+  size_t size_;
+  std::vector<uint64_t> touched_;
+  std::vector<uint32_t> page_of_;
+  std::deque<page> pages_;
+  std::deque<slot> slots_;
+  std::vector<uint32_t> free_pages_;
+  std::vector<uint32_t> free_slots_;
+  zone_type default_zone_{};
+  pool_stats stats_;
+
+  // Scratch space, kept between batches to avoid allocations
+  std::vector<uint64_t> by_zone_;
+  std::vector<uint32_t> round_;
+  std::vector<size_t> by_round_;
+  std::vector<uint32_t> order_;
+  std::vector<uint8_t> keys_;
+  std::vector<uint32_t> group_;
+};
+}  // namespace zones
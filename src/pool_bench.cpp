@@ -0,0 +1,221 @@
+/**
+ * Events per second of the zone pool, batched against one at a time.
+ *
+ * Drives --zones zones of a state machine with the controller's table and
+ * guard through zones::pool, with the same --events random events (about
+ * a third each of turn_on, turn_off and change_on_time) once in batches
+ * of --batch through process_events() and once one at a time through
+ * process_event(). A plain vector with one state machine per zone is the
+ * baseline the pool replaced. All three must end with the same states.
+ *
+ * The plain machines also run the events once through envelopes and the
+ * events::dispatcher jump table and once as typed events, a std::variant
+ * of the three visited straight into process_event(), to show what the
+ * envelope costs per event. Both must end with the same states as well.
+ *
+ *   pool_bench [--zones=N] [--events=N] [--batch=N] [--seed=N]
+ **/
+
+#include <boost/sml.hpp>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "envelope.hpp"
+#include "pool.hpp"
+
+namespace sml = boost::sml;
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_us(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The controller's zone machine without the light, task thread and logs
+namespace bench {
+struct zone {
+  bool short_slot{false};
+  int64_t start_time_minutes{};
+};
+
+struct turn_on {
+  std::string time_on;
+};
+struct turn_off {};
+struct change_on_time {};
+}  // namespace bench
+
+template <>
+struct events::codec<bench::turn_on> {
+  static uint16_t pack(const bench::turn_on &e) {
+    return uint16_t(std::stoi(e.time_on.substr(0, 2)) * 60 + std::stoi(e.time_on.substr(3, 2)));
+  }
+  static bench::turn_on unpack(uint16_t minute) {
+    const char time_on[] = {char('0' + minute / 600),
+                            char('0' + minute / 60 % 10),
+                            ':',
+                            char('0' + minute % 60 / 10),
+                            char('0' + minute % 10),
+                            '\0'};
+    return {time_on};
+  }
+};
+
+namespace bench {
+using event_dispatch = events::dispatcher<turn_on, turn_off, change_on_time>;
+
+class on;
+class off;
+
+struct turn_on_guard {
+  bool operator()(const turn_on &e) const {
+    if (e.time_on.length() != 5 || (e.time_on[2] != ':' && e.time_on[2] != '.'))
+      return false;
+    const auto on_hour   = e.time_on.substr(0, 2);
+    const auto on_minute = e.time_on.substr(3, 2);
+    auto is_number       = [](const std::string &s) {
+      return s.find_first_not_of("0123456789") == std::string::npos;
+    };
+    return is_number(on_hour) && is_number(on_minute) && std::stoi(on_hour) < 24 && std::stoi(on_minute) < 60;
+  }
+} turn_on_guard;
+
+struct on_action {
+  void operator()(const turn_on &a, zone &z) {
+    z.start_time_minutes = std::stoi(a.time_on.substr(0, 2)) * 60 + std::stoi(a.time_on.substr(3, 2));
+  }
+} on_action;
+
+struct off_action {
+  void operator()() {}
+} off_action;
+
+struct change_on_time_action {
+  void operator()(zone &z) { z.short_slot = !z.short_slot; }
+} change_on_time_action;
+
+struct fsm {
+  auto operator()() const noexcept {
+    using namespace sml;
+    // clang-format off
+    return make_transition_table(
+      *state<off> + event<turn_on>        [turn_on_guard] / on_action             = state<on>,
+       state<on>  + event<turn_off>                       / off_action            = state<off>,
+       state<on>  + event<turn_on>        [turn_on_guard] / on_action             = state<on>,
+       state<on>  + event<change_on_time>                 / change_on_time_action = state<on>);
+    // clang-format on
+  }
+};
+
+struct pool_traits {
+  using zone_type = zone;
+  using sm_type   = sml::sm<fsm>;
+
+  static constexpr size_t event_types   = 3;
+  static constexpr size_t states        = 2;
+  static constexpr size_t default_state = 0;
+
+  static size_t state(sm_type &sm) { return sm.is(sml::state<on>); }
+  static bool is_default(sm_type &sm, const zone &z) { return sm.is(sml::state<off>) && !z.short_slot; }
+  static void reset(zone &z) { z.start_time_minutes = 0; }
+  static bool dispatch(sm_type &sm, const zones::event &e) {
+    return event_dispatch::process(sm, {e.type, e.arg, e.zone, 0});
+  }
+};
+using zone_pool = zones::pool<pool_traits>;
+
+// A zone with its own state machine, as before the pool
+struct plain {
+  plain() : sm{z} {}
+  zone z;
+  pool_traits::sm_type sm;
+};
+}  // namespace bench
+
+int main(int argc, char *argv[]) {
+  auto args        = std::vector<std::string>(argv, argv + argc);
+  const auto count = std::stoul(option(args, "zones").value_or("100000"));
+  const auto total = std::stoul(option(args, "events").value_or("1000000"));
+  const auto batch = std::max(1ul, std::stoul(option(args, "batch").value_or("4096")));
+  std::mt19937_64 rng{std::stoul(option(args, "seed").value_or("1"))};
+
+  std::vector<zones::event> events(total);
+  for (auto &e : events)
+    e = {uint32_t(rng() % count), uint16_t(rng() % 3), uint16_t(rng() % 1440)};
+
+  printf("  %zu zones, %zu events, batches of %zu\n", size_t(count), size_t(total), size_t(batch));
+  auto report = [&](const char *what, double us, size_t handled) {
+    printf("  %-22s %12.0f events/s %10zu handled\n", what, total / (us / 1e6), handled);
+  };
+
+  bench::zone_pool batched{count};
+  auto start     = std::chrono::steady_clock::now();
+  size_t handled = 0;
+  for (size_t i = 0; i < total; i += batch)
+    handled += batched.process_events(std::span(events).subspan(i, std::min(batch, total - i)));
+  report("pool, batched", since_us(start), handled);
+
+  bench::zone_pool single{count};
+  start   = std::chrono::steady_clock::now();
+  handled = 0;
+  for (const auto &e : events)
+    handled += single.process_event(e);
+  report("pool, one by one", since_us(start), handled);
+
+  std::vector<events::envelope> wrapped(total);
+  for (size_t i = 0; i < total; ++i)
+    wrapped[i] = {events[i].type, events[i].arg, events[i].zone, 0};
+  std::vector<bench::plain> plain(count);
+  start   = std::chrono::steady_clock::now();
+  handled = 0;
+  for (const auto &env : wrapped)
+    handled += bench::event_dispatch::process(plain[env.zone].sm, env);
+  report("sm per zone, envelopes", since_us(start), handled);
+
+  using typed_event = std::variant<bench::turn_on, bench::turn_off, bench::change_on_time>;
+  std::vector<std::pair<uint32_t, typed_event>> typed(total);
+  for (size_t i = 0; i < total; ++i) {
+    const auto &e = events[i];
+    typed[i].first = e.zone;
+    if (e.type == bench::event_dispatch::tag<bench::turn_on>)
+      typed[i].second = events::codec<bench::turn_on>::unpack(e.arg);
+    else if (e.type == bench::event_dispatch::tag<bench::turn_off>)
+      typed[i].second = bench::turn_off{};
+    else
+      typed[i].second = bench::change_on_time{};
+  }
+  std::vector<bench::plain> direct(count);
+  start   = std::chrono::steady_clock::now();
+  handled = 0;
+  for (const auto &[zone, event] : typed)
+    handled += std::visit([&, zone = zone](const auto &ev) { return direct[zone].sm.process_event(ev); }, event);
+  report("sm per zone, typed", since_us(start), handled);
+
+  size_t wrong = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const bool on = bench::pool_traits::state(plain[i].sm);
+    for (auto *p : {&batched, &single}) {
+      const auto &z = p->zone(i);
+      wrong += p->state(i) != on || z.short_slot != plain[i].z.short_slot ||
+               (on && z.start_time_minutes != plain[i].z.start_time_minutes);
+    }
+    wrong += bench::pool_traits::state(direct[i].sm) != on || direct[i].z.short_slot != plain[i].z.short_slot ||
+             direct[i].z.start_time_minutes != plain[i].z.start_time_minutes;
+  }
+  if (wrong) {
+    printf("  FAILED: %zu zones disagree between the pools and the plain machines\n", wrong);
+    return 1;
+  }
+  return 0;
+}
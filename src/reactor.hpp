@@ -0,0 +1,123 @@
+/**
+ * Single threaded epoll event loop, driven from the main loop.
+ **/
+
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace io {
+class reactor {
+ public:
+  using handler = std::function<void(uint32_t events)>;
+  using clock   = std::chrono::steady_clock;
+
+  reactor()
+      : epfd_{epoll_create1(EPOLL_CLOEXEC)},
+        timer_fd_{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)} {
+    assert(epfd_ >= 0 && timer_fd_ >= 0);
+    add(timer_fd_, EPOLLIN, [this](uint32_t) {
+      uint64_t expirations;
+      [[maybe_unused]] auto n = read(timer_fd_, &expirations, sizeof(expirations));
+    });
+  }
+  ~reactor() {
+    close(timer_fd_);
+    close(epfd_);
+  }
+  reactor(const reactor &)            = delete;
+  reactor &operator=(const reactor &) = delete;
+
+  bool add(int fd, uint32_t events, handler h) {
+    epoll_event ev{};
+    ev.events  = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+      return false;
+    if (size_t(fd) >= handlers_.size())
+      handlers_.resize(fd + 1);
+    handlers_[fd] = std::move(h);
+    return true;
+  }
+
+  bool modify(int fd, uint32_t events) {
+    epoll_event ev{};
+    ev.events  = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+  }
+
+  // Handlers may remove themselves (or others) while being dispatched
+  void remove(int fd) {
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    if (size_t(fd) < handlers_.size())
+      handlers_[fd] = nullptr;
+  }
+
+  void every(std::chrono::milliseconds period, std::function<void()> cb) {
+    timers_.push_back({period, clock::now() + period, std::make_shared<std::function<void()>>(std::move(cb))});
+  }
+
+  // Waits at most 'timeout' for readiness, then runs due handlers and timers
+  void run_once(std::chrono::microseconds timeout) {
+    const auto now = clock::now();
+    for (const auto &t : timers_) {
+      const auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+          t.deadline - now);
+      timeout = std::max(std::chrono::microseconds{0}, std::min(timeout, left));
+    }
+
+    // epoll_wait counts milliseconds, finer timeouts go through the timerfd
+    int timeout_ms = int(timeout.count() / 1000);
+    if (timeout.count() % 1000 != 0) {
+      itimerspec its{};
+      its.it_value.tv_sec  = timeout.count() / 1'000'000;
+      its.it_value.tv_nsec = timeout.count() % 1'000'000 * 1000;
+      timerfd_settime(timer_fd_, 0, &its, nullptr);
+      timeout_ms = -1;
+    }
+    epoll_event events[32];
+    const int n = epoll_wait(epfd_, events, 32, timeout_ms);
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+      if (size_t(fd) < handlers_.size() && handlers_[fd]) {
+        // Copy, the handler may remove itself from the table
+        auto h = handlers_[fd];
+        h(events[i].events);
+      }
+    }
+
+    // By index and on a copy, a callback may add timers with every()
+    const auto after = clock::now();
+    for (size_t i = 0; i < timers_.size(); ++i) {
+      if (timers_[i].deadline <= after) {
+        timers_[i].deadline = after + timers_[i].period;
+        const auto cb       = timers_[i].cb;
+        (*cb)();
+      }
+    }
+  }
+
+ private:
+  struct timer {
+    std::chrono::milliseconds period;
+    clock::time_point deadline;
+    std::shared_ptr<std::function<void()>> cb;
+  };
+
+  int epfd_;
+  int timer_fd_;
+  std::vector<handler> handlers_;
+  std::vector<timer> timers_;
+};
+}  // namespace io
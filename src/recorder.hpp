@@ -0,0 +1,222 @@
+/**
+ * Flight recorder of recent events in a file backed ring.
+ *
+ * Fsm events, guard results, actions, transitions, input edges and output
+ * changes are written as fixed-size binary records into a shared mapping
+ * of the file. The kernel owns the pages, so whatever was recorded up to
+ * a crash or kill -9 is in the file afterwards; flight_decode prints it.
+ *
+ * Names are interned once into a table in the same file, records refer
+ * to them by index. A record's sequence number is stored last, a decoder
+ * skips slots whose number does not match their place in the ring.
+ * Records are stamped with the CPU tick counter, cheaper to read than
+ * the clock; calibrate() keeps the header's tick to time mapping current.
+ **/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+namespace recorder {
+static constexpr char magic[8]     = {'L', 'C', 'F', 'L', 'I', 'G', 'H', 'T'};
+static constexpr uint32_t version  = 2;
+static constexpr size_t max_names  = 256;
+static constexpr size_t name_chars = 96;
+
+// Index of every name that did not fit the table, never a name itself
+static constexpr uint16_t unnamed = max_names - 1;
+
+enum kind : uint8_t { EVENT = 1, GUARD, ACTION, TRANSITION, INPUT, OUTPUT };
+
+// 'a', 'b' and 'c' are name indices, or a pin for inputs and outputs
+struct record {
+  std::atomic<uint64_t> seq;  // Position plus one, stored last
+  uint64_t ticks;
+  uint8_t kind;
+  uint8_t value;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+  uint32_t arg;
+  uint32_t reserved;
+};
+static_assert(sizeof(record) == 32, "records are fixed-size");
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;           // Records, a power of two
+  int64_t wall_offset_ns;      // CLOCK_REALTIME minus CLOCK_MONOTONIC at open
+  uint64_t base_ticks;         // Taken at CLOCK_MONOTONIC 'base_ns'
+  uint64_t base_ns;
+  double ns_per_tick;
+  std::atomic<uint64_t> head;  // Next position
+  std::atomic<uint32_t> names;
+  uint32_t pid;
+  std::atomic<uint32_t> overflow;  // Names recorded as 'unnamed'
+  uint32_t reserved;
+  char name[max_names][name_chars];
+};
+
+inline uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  return monotonic_ns();
+#endif
+}
+
+// CLOCK_MONOTONIC of a record
+inline uint64_t record_ns(const header &h, uint64_t ticks) {
+  return h.base_ns + int64_t(double(int64_t(ticks - h.base_ticks)) * h.ns_per_tick);
+}
+
+inline size_t file_size(uint64_t capacity) {
+  return (sizeof(header) + 4095) / 4096 * 4096 + capacity * sizeof(record);
+}
+
+class ring {
+ public:
+  ~ring() {
+    if (hdr_)
+      munmap(hdr_, size_);
+  }
+
+  // Starts a fresh recording, 'capacity' is rounded up to a power of two
+  bool open(const std::string &path, uint64_t capacity) {
+    capacity     = capacity < 2 ? 2 : uint64_t(1) << (64 - __builtin_clzll(capacity - 1));
+    path_        = path;
+    size_        = file_size(capacity);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return fail("open");
+    if (ftruncate(fd, off_t(size_)) != 0) {
+      ::close(fd);
+      return fail("ftruncate");
+    }
+    void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      return fail("mmap");
+
+    hdr_ = static_cast<header *>(p);
+    std::memcpy(hdr_->magic, magic, sizeof(magic));
+    hdr_->version     = version;
+    hdr_->record_size = sizeof(record);
+    hdr_->capacity    = capacity;
+    hdr_->pid         = uint32_t(getpid());
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    hdr_->wall_offset_ns =
+        int64_t(wall.tv_sec) * 1'000'000'000 + wall.tv_nsec - int64_t(monotonic_ns());
+    records_ = reinterpret_cast<record *>(reinterpret_cast<char *>(p) + file_size(0));
+    mask_    = capacity - 1;
+
+    // A first estimate of the tick rate, calibrate() refines it
+    first_ticks_ = ticks();
+    first_ns_    = monotonic_ns();
+    const timespec pause{0, 5'000'000};
+    nanosleep(&pause, nullptr);
+    calibrate();
+    printf("  Flight recorder %s: %llu records\n", path.c_str(), (unsigned long long)capacity);
+    return true;
+  }
+
+  // Index of 'name' in the file's name table, the same pointer gives the
+  // same index. Once the table is full new names get 'unnamed' and are
+  // counted. Cache it, this takes a lock.
+  uint16_t intern(const char *name) {
+    const std::lock_guard lock{mutex_};
+    const auto n = hdr_->names.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < n; ++i)
+      if (interned_[i] == name)
+        return uint16_t(i);
+    if (n == unnamed) {
+      hdr_->overflow.fetch_add(1, std::memory_order_relaxed);
+      return unnamed;
+    }
+    strncpy(hdr_->name[n], name, name_chars - 1);
+    interned_[n] = name;
+    hdr_->names.store(n + 1, std::memory_order_release);
+    return uint16_t(n);
+  }
+
+  // Maps ticks to time, measured since open(). Call now and then.
+  void calibrate() {
+    const auto t  = ticks();
+    const auto ns = monotonic_ns();
+    if (t != first_ticks_)
+      hdr_->ns_per_tick = double(ns - first_ns_) / double(t - first_ticks_);
+    hdr_->base_ns    = ns;
+    hdr_->base_ticks = t;
+  }
+
+  // Safe from any thread, no locks and no system calls
+  void write(kind k, uint16_t a, uint16_t b = 0, uint16_t c = 0, uint8_t value = 0, uint32_t arg = 0) {
+    const auto seq = hdr_->head.fetch_add(1, std::memory_order_relaxed);
+    auto &r        = records_[seq & mask_];
+    r.seq.store(0, std::memory_order_relaxed);
+    r.ticks   = ticks();
+    r.kind    = k;
+    r.value   = value;
+    r.a       = a;
+    r.b       = b;
+    r.c       = c;
+    r.arg     = arg;
+    r.seq.store(seq + 1, std::memory_order_release);
+  }
+
+  uint64_t written() const { return hdr_->head.load(std::memory_order_relaxed); }
+  uint64_t capacity() const { return hdr_->capacity; }
+  uint32_t overflow() const { return hdr_->overflow.load(std::memory_order_relaxed); }
+
+ private:
+  bool fail(const char *what) {
+    printf("  Flight recorder %s: %s failed: %s\n", path_.c_str(), what, strerror(errno));
+    return false;
+  }
+
+  std::string path_;
+  header *hdr_{};
+  record *records_{};
+  uint64_t mask_{};
+  size_t size_{};
+  uint64_t first_ticks_{};
+  uint64_t first_ns_{};
+  std::mutex mutex_;
+  const char *interned_[max_names]{};
+};
+
+// Where the fsm logger and the hw templates record to, once set
+inline ring *active{};
+
+// Interned once per distinct T
+template <class T>
+uint16_t id_of(const char *name) {
+  static const uint16_t id = active->intern(name);
+  return id;
+}
+}  // namespace recorder
@@ -0,0 +1,151 @@
+/**
+ * Restart-to-first-correct-output measurement for the mapped zone file.
+ *
+ * Runs the controller on a zone file with a DMX output written to a plain
+ * file, turns zones on so that their schedules have them on now, then
+ * restarts it twice: once after a clean stop and once after kill -9 once
+ * a checkpoint was taken. Each restart is timed from the fork to the first
+ * DMX frame that shows every zone of the first universe as it was, and
+ * the zones that are on must match before and after.
+ *
+ *   restart_check CONTROLLER [--zones=N] [--port=PORT] [--dir=DIR]
+ **/
+
+#include <time.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static std::string read_file(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: restart_check CONTROLLER [--zones=N] [--port=PORT] [--dir=DIR]\n");
+    return 1;
+  }
+  const auto zones   = std::stoul(option(args, "zones").value_or("100000"));
+  const auto port    = uint16_t(std::stoul(option(args, "port").value_or("18310")));
+  const auto dir     = option(args, "dir").value_or(".");
+  const auto file    = dir + "/restart_check.lcz";
+  const auto dmx     = dir + "/restart_check.dmx";
+  const size_t frame = 1 + std::min<size_t>(zones, 512);  // Start code and the first universe
+
+  const std::vector<std::string> controller{args[1],
+                                            "07:00",
+                                            "--http=" + std::to_string(port),
+                                            "--zones=" + std::to_string(zones),
+                                            "--zone-engine=bitslice",
+                                            "--zone-file=" + file,
+                                            "--outputs=dmx:" + dmx + ":512"};
+  remove(file.c_str());
+
+  // Every third zone starts this minute, the rest stay off
+  const auto now = time(nullptr);
+  tm local{};
+  localtime_r(&now, &local);
+  std::string expected(frame, '\0');
+  harness::child lc;
+  std::ofstream{dmx, std::ios::trunc};
+  if (!lc.start(controller, "restart_check.log") || !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see restart_check.log\n");
+    return 1;
+  }
+  for (size_t z = 0; z < zones;) {
+    std::string batch;
+    for (size_t i = 0; i < 150 && z < zones; ++i, z += 3) {
+      char line[48];
+      snprintf(line, sizeof(line), "%zu turn_on %02d:%02d\n", z, local.tm_hour, local.tm_min);
+      batch += line;
+      if (z + 1 < frame)
+        expected[z + 1] = char(255);
+    }
+    if (!harness::request(port, "POST", "/zones/events", batch)) {
+      printf("  Turning zones on failed\n");
+      return 1;
+    }
+  }
+  const auto before = harness::request(port, "GET", "/zones");
+  const auto on     = before ? harness::number(*before, "on") : std::nullopt;
+
+  bool failed = false;
+  for (const bool clean : {true, false}) {
+    if (clean) {
+      lc.signal(SIGTERM);
+    } else {
+      // Killed outright the file is trusted only up to its last checkpoint
+      const auto taken = [&] {
+        const auto st = harness::request(port, "GET", "/zones/file");
+        return st ? harness::number(*st, "checkpoints").value_or(0) : 0;
+      };
+      for (const auto first = taken(); taken() == first;)
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      lc.signal(SIGKILL);
+    }
+    if (lc.wait(std::chrono::seconds(10)) < 0) {
+      printf("  The controller did not stop\n");
+      return 1;
+    }
+    std::ofstream{dmx, std::ios::trunc};
+
+    const auto start = harness::monotonic_ns();
+    if (!lc.start(controller, "restart_check.log"))
+      return 1;
+    int64_t first_ns = -1;
+    size_t frames{};
+    while (first_ns < 0 && harness::monotonic_ns() - start < 10'000'000'000) {
+      const auto written = read_file(dmx);
+      for (; (frames + 1) * frame <= written.size(); ++frames)
+        if (written.compare(frames * frame, frame, expected) == 0) {
+          first_ns = harness::monotonic_ns() - start;
+          break;
+        }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    harness::wait_http(port, std::chrono::seconds(10));
+    const auto after  = harness::request(port, "GET", "/zones");
+    const auto stats  = harness::request(port, "GET", "/zones/file");
+    const auto on_now = after ? harness::number(*after, "on") : std::nullopt;
+    const auto from   = stats ? harness::text(*stats, "restored_from") : "?";
+    printf("  %s restart, %.0f of %zu zones on, restored from %s: first correct output after %.1f ms",
+           clean ? "Clean" : "kill -9",
+           on_now.value_or(-1),
+           zones,
+           from.c_str(),
+           first_ns / 1e6);
+    if (stats)
+      printf(" (open %.0f us, first commit %.0f us in the controller)",
+             harness::number(*stats, "open_us").value_or(0),
+             harness::number(*stats, "first_output_us").value_or(0));
+    printf("\n");
+    if (first_ns < 0 || !on || on_now != on) {
+      printf("  FAILED: %s, %.0f zones on before and %.0f after\n",
+             first_ns < 0 ? "no correct frame" : "zones differ",
+             on.value_or(-1),
+             on_now.value_or(-1));
+      failed = true;
+    }
+  }
+  remove(file.c_str());
+  remove(dmx.c_str());
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,349 @@
+/**
+ * Boolean zone rules compiled to bitwise operations over packed signals.
+ *
+ * Every signal (schedule, occupied, override, door, ...) is a bitset with
+ * one bit per zone. A rule such as "schedule AND (occupied OR override)"
+ * is compiled once to a postfix program, which then decides 64 zones per
+ * machine word. Only words touched by a signal change are re-evaluated.
+ *
+ * load() reads the rules of a controller, one rule per line for a zone
+ * or a range of zones, e.g.
+ *
+ *   # zones    rule
+ *   0-99       schedule AND (occupied OR override)
+ *   100        schedule AND NOT door
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rules {
+enum class op : uint8_t { load, op_and, op_or, op_not };
+
+struct instruction {
+  op code;
+  uint16_t signal;
+};
+
+using program = std::vector<instruction>;
+
+// Recursive descent over: expr = term {OR term}, term = factor {AND factor},
+// factor = NOT factor | '(' expr ')' | signal. '|', '&' and '!' work too.
+class compiler {
+ public:
+  compiler(std::string_view text, std::vector<std::string> &signals)
+      : text_{text}, signals_{signals} {}
+
+  std::optional<program> compile() {
+    program out;
+    if (!expr(out) || !at_end() || depth(out) > max_depth)
+      return std::nullopt;
+    return out;
+  }
+
+  static constexpr size_t max_depth = 32;
+
+ private:
+  void skip_space() {
+    while (pos_ < text_.size() && std::isspace((unsigned char)text_[pos_]))
+      ++pos_;
+  }
+
+  // Nothing but space left, an unknown character is not the end
+  bool at_end() {
+    skip_space();
+    return pos_ == text_.size();
+  }
+
+  // The token at the cursor, empty at the end or on an unknown character
+  std::string_view next() {
+    skip_space();
+    if (pos_ == text_.size())
+      return {};
+    const auto start = pos_;
+    if (std::strchr("()&|!", text_[pos_]))
+      return text_.substr(start, 1);
+    auto end = pos_;
+    while (end < text_.size() &&
+           (std::isalnum((unsigned char)text_[end]) || text_[end] == '_'))
+      ++end;
+    return text_.substr(start, end - start);
+  }
+
+  void take(std::string_view token) { pos_ += token.size(); }
+
+  static size_t depth(const program &code) {
+    size_t top{}, deepest{};
+    for (const auto &i : code) {
+      if (i.code == op::load)
+        deepest = std::max(deepest, ++top);
+      else if (i.code != op::op_not)
+        --top;
+    }
+    return deepest;
+  }
+
+  bool expr(program &out) {
+    if (!term(out))
+      return false;
+    for (auto t = next(); t == "OR" || t == "|"; t = next()) {
+      take(t);
+      if (!term(out))
+        return false;
+      out.push_back({op::op_or, 0});
+    }
+    return true;
+  }
+
+  bool term(program &out) {
+    if (!factor(out))
+      return false;
+    for (auto t = next(); t == "AND" || t == "&"; t = next()) {
+      take(t);
+      if (!factor(out))
+        return false;
+      out.push_back({op::op_and, 0});
+    }
+    return true;
+  }
+
+  bool factor(program &out) {
+    const auto t = next();
+    if (t.empty())
+      return false;
+    take(t);
+    if (t == "NOT" || t == "!") {
+      if (!factor(out))
+        return false;
+      out.push_back({op::op_not, 0});
+      return true;
+    }
+    if (t == "(") {
+      if (!expr(out) || next() != ")")
+        return false;
+      take(")");
+      return true;
+    }
+    if (!std::isalpha((unsigned char)t[0]) || t == "AND" || t == "OR")
+      return false;
+
+    size_t id = 0;
+    while (id < signals_.size() && signals_[id] != t)
+      ++id;
+    if (id == signals_.size())
+      signals_.emplace_back(t);
+    out.push_back({op::load, uint16_t(id)});
+    return true;
+  }
+
+  std::string_view text_;
+  std::vector<std::string> &signals_;
+  size_t pos_{};
+};
+
+class engine {
+ public:
+  explicit engine(size_t zones)
+      : zones_{zones}, words_{(zones + 63) / 64}, out_(words_), governed_(words_), dirty_(words_) {}
+
+  // Returns the rule id, or nothing if 'text' does not parse
+  std::optional<size_t> add_rule(std::string_view text) {
+    auto prog = compiler(text, names_).compile();
+    if (!prog)
+      return std::nullopt;
+    while (signals_.size() < names_.size())
+      signals_.emplace_back(words_);
+    rules_.push_back({std::move(*prog), std::vector<uint64_t>(words_)});
+    return rules_.size() - 1;
+  }
+
+  // A zone follows at most one rule, zones without a rule stay off
+  void assign(size_t zone, size_t rule) {
+    const auto w = zone / 64;
+    const auto b = uint64_t(1) << (zone % 64);
+    for (auto &r : rules_)
+      r.members[w] &= ~b;
+    rules_[rule].members[w] |= b;
+    governed_[w] |= b;
+    mark(w);
+  }
+
+  size_t rules() const { return rules_.size(); }
+  const std::vector<std::string> &signals() const { return names_; }
+
+  std::optional<size_t> signal(std::string_view name) const {
+    for (size_t i = 0; i < names_.size(); ++i)
+      if (names_[i] == name)
+        return i;
+    return std::nullopt;
+  }
+
+  void set(size_t signal, size_t zone, bool value) {
+    auto &word   = signals_[signal][zone / 64];
+    const auto b = uint64_t(1) << (zone % 64);
+    if (bool(word & b) == value)
+      return;
+    word ^= b;
+    mark(zone / 64);
+  }
+
+  // Whole words at once, e.g. a schedule decided for 64 zones together
+  void set_word(size_t signal, size_t word, uint64_t bits) {
+    if (signals_[signal][word] == bits)
+      return;
+    signals_[signal][word] = bits;
+    mark(word);
+  }
+
+  // Re-evaluates the words touched since the last call, returns them
+  const std::vector<size_t> &evaluate() {
+    for (const auto w : pending_) {
+      dirty_[w] = false;
+      uint64_t decided{};
+      for (const auto &r : rules_)
+        if (r.members[w])
+          decided |= r.members[w] & run(r.code, w);
+      out_[w] = decided;
+    }
+    evaluated_.swap(pending_);
+    pending_.clear();
+    return evaluated_;
+  }
+
+  bool output(size_t zone) const { return out_[zone / 64] >> (zone % 64) & 1; }
+  const std::vector<uint64_t> &outputs() const { return out_; }
+  const std::vector<uint64_t> &governed() const { return governed_; }  // Zones that follow a rule
+  size_t zones() const { return zones_; }
+
+  // Scalar reference, one zone and one bool at a time, for cross checks
+  bool reference(size_t zone) const {
+    const auto w = zone / 64;
+    const auto b = uint64_t(1) << (zone % 64);
+    for (const auto &r : rules_) {
+      if (!(r.members[w] & b))
+        continue;
+      std::vector<bool> stack;
+      for (const auto &i : r.code) {
+        switch (i.code) {
+          case op::load:
+            stack.push_back(signals_[i.signal][w] & b);
+            break;
+          case op::op_and: {
+            const bool rhs = stack.back();
+            stack.pop_back();
+            stack.back() = stack.back() && rhs;
+          } break;
+          case op::op_or: {
+            const bool rhs = stack.back();
+            stack.pop_back();
+            stack.back() = stack.back() || rhs;
+          } break;
+          case op::op_not:
+            stack.back() = !stack.back();
+            break;
+        }
+      }
+      return stack.back();
+    }
+    return false;
+  }
+
+ private:
+  struct rule {
+    program code;
+    std::vector<uint64_t> members;
+  };
+
+  void mark(size_t word) {
+    if (!dirty_[word]) {
+      dirty_[word] = true;
+      pending_.push_back(word);
+    }
+  }
+
+  uint64_t run(const program &code, size_t w) const {
+    uint64_t stack[compiler::max_depth];
+    size_t top = 0;
+    for (const auto &i : code) {
+      switch (i.code) {
+        case op::load:
+          stack[top++] = signals_[i.signal][w];
+          break;
+        case op::op_and:
+          --top;
+          stack[top - 1] &= stack[top];
+          break;
+        case op::op_or:
+          --top;
+          stack[top - 1] |= stack[top];
+          break;
+        case op::op_not:
+          stack[top - 1] = ~stack[top - 1];
+          break;
+      }
+    }
+    return stack[0];
+  }
+
+  size_t zones_;
+  size_t words_;
+  std::vector<std::string> names_;
+  std::vector<std::vector<uint64_t>> signals_;
+  std::vector<rule> rules_;
+  std::vector<uint64_t> out_;
+  std::vector<uint64_t> governed_;
+  std::vector<bool> dirty_;
+  std::vector<size_t> pending_;
+  std::vector<size_t> evaluated_;
+};
+
+// Rules from 'path', see above, zones past the engine's are refused.
+// Returns false on the first bad line.
+inline bool load(const std::string &path, engine &e) {
+  std::ifstream in(path);
+  if (!in) {
+    printf("  Rules %s: cannot open\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  for (size_t n = 1; std::getline(in, line); ++n) {
+    line             = line.substr(0, line.find('#'));
+    const auto first = line.find_first_not_of(" \t");
+    if (first == std::string::npos)
+      continue;
+    auto bad = [&](const char *what) {
+      printf("  Rules %s:%zu: %s\n", path.c_str(), n, what);
+      return false;
+    };
+    const char *at   = line.data() + first;
+    const char *last = line.data() + line.size();
+    size_t from = 0, to = 0;
+    auto parsed = std::from_chars(at, last, from);
+    to          = from;
+    if (parsed.ec == std::errc{} && parsed.ptr != last && *parsed.ptr == '-')
+      parsed = std::from_chars(parsed.ptr + 1, last, to);
+    if (parsed.ec != std::errc{} || parsed.ptr == last || !std::isspace((unsigned char)*parsed.ptr))
+      return bad("expected 'zone[-zone] rule'");
+    if (to < from || to >= e.zones())
+      return bad("zones out of range");
+    const auto rule = e.add_rule(std::string_view(parsed.ptr, last - parsed.ptr));
+    if (!rule)
+      return bad("the rule does not parse");
+    for (size_t z = from; z <= to; ++z)
+      e.assign(z, *rule);
+  }
+  printf("  Rules %s: %zu rules over %zu signals\n", path.c_str(), e.rules(), e.signals().size());
+  return true;
+}
+}  // namespace rules
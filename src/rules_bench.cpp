@@ -0,0 +1,146 @@
+/**
+ * Differential check and benchmark of the bitwise rule engine.
+ *
+ * Random rules over random signals decide every zone word-wide and
+ * through the scalar reference after each round of signal flips, a zone
+ * where the two differ fails the run. Rules that must not compile are
+ * checked first. Reported are a full re-evaluation and the evaluation
+ * after a single flip.
+ *
+ *   rules_bench [--zones=N] [--rules=N] [--rounds=N] [--flips=N] [--seed=N]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rules.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_us(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A random rule over 'signals' signals, in both spellings of the operators
+static std::string random_rule(std::mt19937_64 &rng, size_t signals, unsigned depth) {
+  if (!depth || rng() % 4 == 0)
+    return "s" + std::to_string(rng() % signals);
+  switch (rng() % 3) {
+    case 0:
+      return (rng() % 2 ? "NOT " : "!") + random_rule(rng, signals, depth - 1);
+    case 1:
+      return "(" + random_rule(rng, signals, depth - 1) + (rng() % 2 ? " AND " : "&") +
+             random_rule(rng, signals, depth - 1) + ")";
+    default:
+      return "(" + random_rule(rng, signals, depth - 1) + (rng() % 2 ? " OR " : " | ") +
+             random_rule(rng, signals, depth - 1) + ")";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  auto args          = std::vector<std::string>(argv, argv + argc);
+  const auto zones   = std::stoul(option(args, "zones").value_or("100000"));
+  const auto count   = std::stoul(option(args, "rules").value_or("8"));
+  const auto rounds  = std::stoul(option(args, "rounds").value_or("20"));
+  const auto flips   = std::stoul(option(args, "flips").value_or("10000"));
+  const auto signals = size_t(8);
+  std::mt19937_64 rng(std::stoull(option(args, "seed").value_or("1")));
+  unsigned failed{};
+
+  for (const auto *bad : {"a AND b + c", "a AND", "(a OR b", "a b", "AND", "a ) b", "a & #", ""}) {
+    std::vector<std::string> names;
+    if (rules::compiler(bad, names).compile()) {
+      printf("  '%s' compiled\n", bad);
+      ++failed;
+    }
+  }
+  for (const auto *good : {"schedule AND (occupied OR override)", " !door&schedule ", "NOT (a | b) AND c"}) {
+    std::vector<std::string> names;
+    if (!rules::compiler(good, names).compile()) {
+      printf("  '%s' did not compile\n", good);
+      ++failed;
+    }
+  }
+
+  // A plain rule per signal first, so each has its id however the random
+  // rules turn out
+  rules::engine engine{zones};
+  std::vector<std::string> texts;
+  for (size_t s = 0; s < signals; ++s)
+    texts.push_back("s" + std::to_string(s));
+  for (size_t r = 0; r < count; ++r)
+    texts.push_back(random_rule(rng, signals, 4));
+  for (const auto &text : texts)
+    if (!engine.add_rule(text)) {
+      printf("  '%s' did not compile\n", text.c_str());
+      return 1;
+    }
+  std::vector<size_t> ids(signals);
+  for (size_t s = 0; s < signals; ++s)
+    ids[s] = *engine.signal(texts[s]);
+  // One zone in 16 follows no rule
+  for (size_t z = 0; z < zones; ++z)
+    if (rng() % 16)
+      engine.assign(z, rng() % texts.size());
+
+  auto check = [&](size_t round) {
+    for (size_t z = 0; z < zones; ++z)
+      if (engine.output(z) != engine.reference(z)) {
+        printf("  Round %zu: zone %zu is %d, the reference says %d\n",
+               round,
+               z,
+               engine.output(z),
+               engine.reference(z));
+        return false;
+      }
+    return true;
+  };
+
+  // Everything at once: every word of every signal changes
+  for (size_t s = 0; s < signals; ++s)
+    for (size_t w = 0; w < (zones + 63) / 64; ++w)
+      engine.set_word(ids[s], w, rng());
+  auto start           = std::chrono::steady_clock::now();
+  const auto words     = engine.evaluate().size();
+  const double full_us = since_us(start);
+  failed += !check(0);
+
+  // Each round ends with one flip evaluated and timed on its own
+  double flip_us{};
+  for (size_t round = 1; round <= rounds && !failed; ++round) {
+    for (size_t f = 1; f < flips; ++f)
+      engine.set(ids[rng() % signals], rng() % zones, rng() % 2);
+    const auto signal = ids[rng() % signals];
+    const auto zone   = rng() % zones;
+    engine.set(signal, zone, false);
+    engine.evaluate();
+    engine.set(signal, zone, true);
+    start = std::chrono::steady_clock::now();
+    engine.evaluate();
+    flip_us += since_us(start);
+    failed += !check(round);
+  }
+
+  printf("  %zu zones, %zu rules over %zu signals, %zu rounds of %zu flips\n",
+         zones,
+         texts.size(),
+         signals,
+         rounds,
+         flips);
+  printf("  Full evaluation of %zu words: %.1f us, after one flip: %.2f us\n",
+         words,
+         full_us,
+         rounds ? flip_us / rounds : 0.0);
+  printf("  %s\n", failed ? "FAILED" : "Every zone matched the reference");
+  return failed ? 1 : 0;
+}
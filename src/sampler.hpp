@@ -0,0 +1,87 @@
+/**
+ * Adaptive input polling for boards without GPIO edge interrupts.
+ *
+ * Samples come quickly right after activity and back off exponentially
+ * while the inputs are idle, never exceeding the configured worst-case
+ * detection latency.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace hw {
+struct sampler_stats {
+  using clock = std::chrono::steady_clock;
+
+  uint64_t wakeups{};
+  uint64_t edges{};
+  std::chrono::microseconds max_latency{};
+  uint64_t latency_log2_us[32]{};  // Worst-case latency of each edge
+  clock::time_point since{clock::now()};
+
+  double wakeups_per_hour(clock::time_point now) const {
+    const auto s = std::chrono::duration<double>(now - since).count();
+    return s > 0 ? wakeups * 3600.0 / s : 0.0;
+  }
+  // Upper bound of the histogram bucket holding the 'q' quantile
+  uint64_t percentile_us(double q) const {
+    uint64_t seen{};
+    for (size_t i = 0; i < 32; ++i) {
+      seen += latency_log2_us[i];
+      if (edges && seen >= q * edges)
+        return uint64_t(1) << i;
+    }
+    return 0;
+  }
+};
+
+class adaptive_sampler {
+ public:
+  using clock = std::chrono::steady_clock;
+  using usec  = std::chrono::microseconds;
+
+  struct config {
+    usec min_interval{250};
+    usec max_latency{10'000};
+  };
+
+  explicit adaptive_sampler(config cfg)
+      : cfg_{cfg}, interval_{cfg.min_interval}, last_{clock::now()} {
+    cfg_.max_latency = std::max(cfg_.max_latency, cfg_.min_interval);
+  }
+
+  // Call right after every sample, 'changed' if any input changed
+  void sampled(clock::time_point now, bool changed) {
+    ++stats_.wakeups;
+    if (changed) {
+      // The edge happened at some point since the previous sample
+      const auto latency = std::chrono::duration_cast<usec>(now - last_);
+      const int bucket   = 64 - __builtin_clzll(uint64_t(latency.count()) | 1);
+      ++stats_.latency_log2_us[std::min(31, bucket)];
+      ++stats_.edges;
+      stats_.max_latency = std::max(stats_.max_latency, latency);
+      interval_          = cfg_.min_interval;
+    } else {
+      interval_ = std::min(interval_ * 2, cfg_.max_latency);
+    }
+    last_ = now;
+  }
+
+  // Delay until the next sample is due
+  usec next(clock::time_point now) const {
+    const auto due = last_ + interval_;
+    return due > now ? std::chrono::duration_cast<usec>(due - now) : usec{0};
+  }
+
+  const sampler_stats &stats() const { return stats_; }
+
+ private:
+  config cfg_;
+  usec interval_;
+  clock::time_point last_;
+  sampler_stats stats_;
+};
+}  // namespace hw
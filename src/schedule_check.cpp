@@ -0,0 +1,144 @@
+/**
+ * Check that a schedule keeps a zone on from its start minute for exactly
+ * its timeslot.
+ *
+ * Runs the controller in UTC and turns on one zone per half hour of the
+ * day, in each timeslot, then reads three days of GET /forecast. Every
+ * zone must switch on at its start minute and off 18 hours (LONG) or 12
+ * hours (SHORT) later, across midnight where the timeslot runs past it.
+ * The same schedules are also decided with the predicate scheduled_on()
+ * had before, which kept a zone that does not run past midnight on from
+ * 00:00 and cut one that does at midnight. That predicate must get them
+ * wrong, or the check proves nothing.
+ *
+ *   schedule_check CONTROLLER [--port=PORT]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+struct schedule {
+  int start;
+  bool short_slot;
+
+  int length() const { return (short_slot ? 12 : 18) * 60; }
+  int stop() const { return (start + length()) % 1440; }
+
+  // Before: on from 00:00 to the stop minute, or after the start minute
+  // to midnight when the timeslot runs past it
+  bool old_on(int minute) const { return stop() < start ? start < minute : minute < stop(); }
+};
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: schedule_check CONTROLLER [--port=PORT]\n");
+    return 1;
+  }
+  const auto port = uint16_t(std::stoul(option(args, "port").value_or("18380")));
+  setenv("TZ", "UTC", 1);
+
+  std::vector<schedule> schedules;
+  for (int start = 0; start < 1440; start += 30)
+    for (const bool short_slot : {false, true})
+      schedules.push_back({start, short_slot});
+
+  // The old predicate, minute by minute over one day
+  size_t old_wrong = 0;
+  for (const auto &s : schedules) {
+    int on = 0;
+    for (int m = 0; m < 1440; ++m)
+      on += s.old_on(m) != (((m - s.start + 1440) % 1440) < s.length());
+    old_wrong += on != 0;
+  }
+
+  harness::child lc;
+  if (!lc.start({args[1],
+                 "07:00",
+                 "--http=" + std::to_string(port),
+                 "--zones=" + std::to_string(schedules.size()),
+                 "--vgpio=schedule_check.sock"},
+                "schedule_check.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see schedule_check.log\n");
+    return 1;
+  }
+  std::string batch;
+  for (size_t z = 0; z < schedules.size(); ++z) {
+    char line[48];
+    snprintf(line, sizeof(line), "%zu turn_on %02d:%02d\n", z, schedules[z].start / 60, schedules[z].start % 60);
+    batch += line;
+    if (schedules[z].short_slot)
+      batch += std::to_string(z) + " change_on_time\n";
+  }
+  const auto posted = harness::request(port, "POST", "/zones/events", batch);
+  const auto body   = harness::request(port, "GET", "/forecast?days=3");
+  remove("schedule_check.sock");
+  if (!posted || !body) {
+    printf("  FAILED: the controller did not take the zones or forecast them\n");
+    return 1;
+  }
+
+  // Every on at the start minute, every off a timeslot after it, and an
+  // off first when the zone is on now
+  size_t wrong = 0, lines = 0, transitions = 0;
+  for (size_t at = 0, eol; (eol = body->find('\n', at)) != std::string::npos; at = eol + 1, ++lines) {
+    const std::string_view line(body->data() + at, eol - at);
+    const auto z = size_t(harness::number(line, "zone").value_or(-1));
+    if (z >= schedules.size()) {
+      ++wrong;
+      continue;
+    }
+    const auto &s  = schedules[z];
+    bool bad       = false;
+    bool expect_on = line.find("\"on\":true,\"transitions\"") == std::string_view::npos;
+    int64_t on_at  = -1;
+    for (size_t t = line.find("\"at\":"); t != std::string_view::npos; t = line.find("\"at\":", t + 5)) {
+      const auto when   = int64_t(std::strtoll(line.data() + t + 5, nullptr, 10));
+      const auto minute = int(when / 60 % 1440);
+      const bool on     = line.compare(line.find("\"on\":", t) + 5, 4, "true") == 0;
+      bad |= on != expect_on || minute != (on ? s.start : s.stop());
+      bad |= !on && on_at >= 0 && when - on_at != s.length() * 60;
+      on_at     = on ? when : -1;
+      expect_on = !on;
+      ++transitions;
+    }
+    if (bad)
+      printf("  Zone %zu, start %02d:%02d %s: %.*s\n",
+             z,
+             s.start / 60,
+             s.start % 60,
+             s.short_slot ? "SHORT" : "LONG",
+             int(line.size()),
+             line.data());
+    wrong += bad;
+  }
+  printf("  %zu schedules, %zu transitions over 3 days, %zu wrong, the old predicate gets %zu wrong\n",
+         lines,
+         transitions,
+         wrong,
+         old_wrong);
+  if (wrong || lines != schedules.size() || transitions < 4 * lines) {
+    printf("  FAILED: a zone was not on from its start minute for its timeslot\n");
+    return 1;
+  }
+  if (!old_wrong) {
+    printf("  FAILED: the old predicate passes as well, the check proves nothing\n");
+    return 1;
+  }
+  return 0;
+}
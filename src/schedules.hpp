@@ -0,0 +1,135 @@
+/**
+ * Zone schedules interned into a table of distinct schedules.
+ *
+ * A schedule is a start minute and a timeslot. Zones that are on hold a
+ * reference to theirs, most sites use a handful of schedules for all of
+ * their zones. evaluate() decides each distinct schedule once and ORs
+ * the member mask of every schedule that is on into one bit per zone.
+ * Masks list only the words holding members, so they take as much
+ * memory in total as one bitset of all zones, whatever the sharing.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace schedules {
+struct key {
+  uint16_t start;  // Minute of the day
+  bool short_slot;
+
+  bool operator==(const key &) const = default;
+  uint32_t packed() const { return uint32_t(start) << 1 | short_slot; }
+};
+
+struct table_stats {
+  uint64_t evaluations{};
+  uint64_t decided{};  // Schedules decided over all evaluations
+  uint64_t moves{};    // Zones put on a different schedule
+  uint64_t last_evaluate_ns{};
+};
+
+class table {
+ public:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  explicit table(size_t zones) : of_(zones, none) {}
+
+  size_t zones() const { return of_.size(); }
+  size_t unique() const { return entries_.size() - free_.size(); }
+  const table_stats &stats() const { return stats_; }
+
+  // Puts 'zone' on schedule 'k', interning it on first use
+  void assign(size_t zone, key k) {
+    if (zone >= of_.size())
+      return;
+    const auto current = of_[zone];
+    if (current != none && entries_[current].k == k)
+      return;
+    release(zone);
+
+    auto [it, added] = index_.try_emplace(k.packed(), 0);
+    if (added) {
+      it->second = free_.empty() ? uint32_t(entries_.size()) : free_.back();
+      if (free_.empty())
+        entries_.emplace_back();
+      else
+        free_.pop_back();
+      entries_[it->second].k = k;
+    }
+    auto &e = entries_[it->second];
+    ++e.refs;
+    set(e.words, zone, true);
+    of_[zone] = it->second;
+    ++stats_.moves;
+  }
+
+  // Takes 'zone' off its schedule, which goes with its last member
+  void release(size_t zone) {
+    if (zone >= of_.size() || of_[zone] == none)
+      return;
+    auto &e = entries_[of_[zone]];
+    set(e.words, zone, false);
+    if (--e.refs == 0) {
+      index_.erase(e.k.packed());
+      free_.push_back(of_[zone]);
+    }
+    of_[zone] = none;
+  }
+
+  // Schedule of 'zone', if it has one
+  const key *of(size_t zone) const { return zone < of_.size() && of_[zone] != none ? &entries_[of_[zone]].k : nullptr; }
+
+  // Decides every schedule once with 'decide(key)' and sets the bits of
+  // the zones on a schedule that is on, all other bits are cleared
+  template <class Decide>
+  void evaluate(Decide &&decide, std::vector<uint64_t> &levels) {
+    const auto start = std::chrono::steady_clock::now();
+    levels.assign((of_.size() + 63) / 64, 0);
+    for (const auto &e : entries_) {
+      if (!e.refs || !decide(e.k))
+        continue;
+      for (const auto &[w, bits] : e.words)
+        levels[w] |= bits;
+      ++stats_.decided;
+    }
+    ++stats_.evaluations;
+    stats_.last_evaluate_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           std::chrono::steady_clock::now() - start)
+                                           .count());
+  }
+
+ private:
+  // Member words of a schedule, sorted by word index
+  using mask = std::vector<std::pair<uint32_t, uint64_t>>;
+
+  struct entry {
+    key k{};
+    uint32_t refs{};
+    mask words;
+  };
+
+  static void set(mask &m, size_t zone, bool member) {
+    const auto w  = uint32_t(zone / 64);
+    const auto b  = uint64_t(1) << (zone % 64);
+    const auto it = std::lower_bound(m.begin(), m.end(), w, [](const auto &p, uint32_t v) { return p.first < v; });
+    if (member && (it == m.end() || it->first != w))
+      m.insert(it, {w, b});
+    else if (member)
+      it->second |= b;
+    else if (it != m.end() && it->first == w && !(it->second &= ~b))
+      m.erase(it);
+  }
+
+  std::vector<entry> entries_;
+  std::vector<uint32_t> free_;
+  std::unordered_map<uint32_t, uint32_t> index_;  // Packed key to entry
+  std::vector<uint32_t> of_;                      // Entry of each zone
+  table_stats stats_;
+};
+}  // namespace schedules
@@ -0,0 +1,107 @@
+/**
+ * Evaluation cost of interned schedules at different sharing ratios.
+ *
+ * Puts --zones zones on schedules drawn from 1, 8, 64, 1000 and all 2880
+ * distinct ones, then times a schedules::table evaluation against
+ * deciding every zone on its own, as iterate_task does per zone. Both
+ * must turn on the same zones at every quarter hour. Reported next to it
+ * is the cost of a zone moving to another schedule: onto one in use, and
+ * onto one the table interns for it and frees again when it moves back.
+ *
+ *   schedules_bench [--zones=N] [--moves=N] [--seed=N]
+ **/
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "schedules.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static double since_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// scheduled_on() of the controller, 18:00 long and 12:00 short timeslots
+static bool scheduled_on(schedules::key k, int64_t now) {
+  const int64_t stop = (k.start + (k.short_slot ? 12 : 18) * 60) % 1440;
+  return stop < k.start ? k.start <= now || now < stop : k.start <= now && now < stop;
+}
+
+int main(int argc, char *argv[]) {
+  auto args        = std::vector<std::string>(argv, argv + argc);
+  const auto zones = std::stoul(option(args, "zones").value_or("100000"));
+  const auto moves = std::stoul(option(args, "moves").value_or("100000"));
+  std::mt19937_64 rng{std::stoul(option(args, "seed").value_or("1"))};
+  bool failed = false;
+
+  printf("  %zu zones\n", size_t(zones));
+  for (const size_t distinct : {1, 8, 64, 1000, 2880}) {
+    std::vector<schedules::key> keys(distinct);
+    for (size_t i = 0; i < distinct; ++i)
+      keys[i] = {uint16_t(i % 1440), i / 1440 % 2 == 1};
+    schedules::table table{zones};
+    std::vector<schedules::key> of(zones);
+    for (size_t z = 0; z < zones; ++z) {
+      of[z] = keys[rng() % distinct];
+      table.assign(z, of[z]);
+    }
+
+    // Every 15 minutes of a day, both ways
+    std::vector<uint64_t> shared, alone((zones + 63) / 64);
+    double shared_ns = 0, alone_ns = 0;
+    size_t wrong     = 0;
+    for (int64_t now = 0; now < 1440; now += 15) {
+      auto start = std::chrono::steady_clock::now();
+      table.evaluate([&](schedules::key k) { return scheduled_on(k, now); }, shared);
+      shared_ns += since_ns(start);
+
+      start = std::chrono::steady_clock::now();
+      std::fill(alone.begin(), alone.end(), 0);
+      for (size_t z = 0; z < zones; ++z)
+        alone[z / 64] |= uint64_t(scheduled_on(of[z], now)) << (z % 64);
+      alone_ns += since_ns(start);
+      wrong += shared != alone;
+    }
+    printf("  %7zu schedules: table %9.0f ns, per zone %9.0f ns per evaluation (%.1fx)\n",
+           table.unique(),
+           shared_ns / 96,
+           alone_ns / 96,
+           alone_ns / shared_ns);
+    if (wrong) {
+      printf("  FAILED: %zu evaluations turned on other zones than deciding each zone\n", wrong);
+      failed = true;
+    }
+
+    // Moves onto schedules in use, then onto a new one and back
+    auto start = std::chrono::steady_clock::now();
+    for (size_t m = 0; m < moves; ++m) {
+      const auto z = rng() % zones;
+      of[z]        = keys[rng() % distinct];
+      table.assign(z, of[z]);
+    }
+    printf("  %17s moving a zone: %.0f ns onto a schedule in use", "", since_ns(start) / moves);
+    if (distinct < 2880) {
+      start = std::chrono::steady_clock::now();
+      for (size_t m = 0; m < moves; ++m) {
+        const auto z     = rng() % zones;
+        const auto fresh = distinct + rng() % (2880 - distinct);
+        table.assign(z, {uint16_t(fresh % 1440), fresh / 1440 == 1});
+        table.assign(z, of[z]);
+      }
+      printf(", %.0f ns onto a new one", since_ns(start) / (2 * moves));
+    }
+    printf("\n");
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/**
+ * Primary/standby pair sharing the controller state through shared memory.
+ *
+ * The primary mirrors its fsm state, schedule and output levels into a
+ * POSIX shared memory object and stamps a heartbeat next to it. Zones
+ * that differ from the default are mirrored after the fixed state,
+ * whenever they change, for as many zones as the object was opened for.
+ * The
+ * standby only watches: once the heartbeat is older than the takeover
+ * timeout, or the owning process is gone, it claims ownership, restores
+ * the mirrored state and drives the outputs from it.
+ *
+ * The state is double buffered, each copy under its own sequence lock.
+ * The primary writes the older copy and then points readers at it, so a
+ * primary killed halfway through a write leaves the newest complete copy
+ * untouched. Reads retry a bounded number of times, a standby never
+ * spins on a lock its dead writer left held. Zone states are double
+ * buffered the same way, apart from the fixed state.
+ **/
+
+#pragma once
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace standby {
+static constexpr char magic[8]      = {'L', 'C', 'M', 'I', 'R', 'R', '0', '3'};
+static constexpr size_t shadow_words = 64;  // Output channels mirrored: 4096
+
+struct snapshot {
+  uint8_t on;
+  uint8_t timeslot;
+  uint8_t light;  // Level last written to the light output
+  uint8_t reserved;
+  int32_t start_minutes;
+  char on_time[8];
+  uint32_t channels;
+  uint64_t shadow[shadow_words];
+};
+
+// A zone that is on or on the short timeslot, all others are default
+struct zone_state {
+  uint32_t zone;
+  uint16_t start;  // Minute of the day
+  uint8_t on;
+  uint8_t short_slot;
+};
+
+struct slot {
+  std::atomic<uint32_t> seq;  // Odd while the state is being written
+  snapshot state;
+};
+
+// The zone states of both copies follow the shared state, room for
+// as many as the mirror was opened for in each
+struct zone_slot {
+  std::atomic<uint32_t> seq;
+  uint32_t count;
+};
+
+struct shared {
+  char magic[8];
+  std::atomic<int32_t> owner;  // pid driving the outputs
+  std::atomic<int64_t> heartbeat_ns;
+  std::atomic<uint64_t> takeovers;
+  std::atomic<uint64_t> last_gap_us;
+  std::atomic<uint32_t> latest;  // Copy last written in full
+  slot copies[2];
+  uint32_t zone_capacity;  // Zones the states were mirrored for
+  std::atomic<uint32_t> zones_latest;
+  zone_slot zone_copies[2];
+};
+static_assert(std::atomic<int64_t>::is_always_lock_free, "needs lock-free atomics across processes");
+
+// Monotonic across processes on the same host
+inline int64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+class mirror {
+ public:
+  ~mirror() {
+    if (shm_)
+      munmap(shm_, size_);
+  }
+
+  // Room for the states of 'zones' zones. Both sides open for the same
+  // number, zones mirrored for another number are not read.
+  bool open(const std::string &name, size_t zones = 0) {
+    name_        = name[0] == '/' ? name : "/" + name;
+    size_        = sizeof(shared) + 2 * zones * sizeof(zone_state);
+    const int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+      return fail("shm_open");
+    // Never shrunk, the other side may map more
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || (st.st_size < off_t(size_) && ftruncate(fd, off_t(size_)) != 0)) {
+      close(fd);
+      return fail("ftruncate");
+    }
+    void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      return fail("mmap");
+    shm_   = static_cast<shared *>(p);
+    zones_ = uint32_t(zones);
+    // A fresh object is all zeroes, which is a valid unowned mirror
+    std::memcpy(shm_->magic, magic, sizeof(magic));
+    return true;
+  }
+
+  bool owned() const { return shm_->owner.load() == getpid(); }
+  bool has_state() const { return shm_->copies[shm_->latest.load()].state.on_time[0] != '\0'; }
+  uint64_t takeovers() const { return shm_->takeovers.load(); }
+  uint64_t last_gap_us() const { return shm_->last_gap_us.load(); }
+
+  void claim() {
+    shm_->owner.store(getpid());
+    beat();
+  }
+
+  void beat() { shm_->heartbeat_ns.store(monotonic_ns(), std::memory_order_release); }
+
+  // Overwrites the older copy, then makes it the latest
+  void publish(const snapshot &s) {
+    const auto next = 1 - shm_->latest.load(std::memory_order_relaxed);
+    auto &c         = shm_->copies[next];
+    const auto seq  = c.seq.load(std::memory_order_relaxed);
+    c.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&c.state, &s, sizeof(s));
+    c.seq.store(seq + 2, std::memory_order_release);
+    shm_->latest.store(next, std::memory_order_release);
+  }
+
+  // Overwrites the older zone copy, then makes it the latest. False if
+  // there are more states than zones.
+  bool publish_zones(std::span<const zone_state> states) {
+    if (states.size() > zones_)
+      return false;
+    const auto next = 1 - shm_->zones_latest.load(std::memory_order_relaxed);
+    auto &c         = shm_->zone_copies[next];
+    const auto seq  = c.seq.load(std::memory_order_relaxed);
+    c.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    c.count = uint32_t(states.size());
+    std::copy(states.begin(), states.end(), zone_states(next));
+    c.seq.store(seq + 2, std::memory_order_release);
+    shm_->zone_capacity = zones_;
+    shm_->zones_latest.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Call once the inherited state drives the outputs, records the gap
+  // since the previous owner's last heartbeat
+  void restored() {
+    const auto gap_us = last_beat_ns_ ? (monotonic_ns() - last_beat_ns_) / 1000 : 0;
+    shm_->last_gap_us.store(uint64_t(gap_us));
+    printf("  Took over from pid %d, outputs restored %lldus after its last heartbeat\n",
+           previous_,
+           (long long)gap_us);
+  }
+
+  // The latest complete snapshot, or the one before if the latest is
+  // being rewritten. Nothing if neither settles within 'tries' rounds.
+  std::optional<snapshot> read(unsigned tries = 1000) const {
+    snapshot s;
+    for (unsigned t = 0; t < tries; ++t) {
+      const auto newest = shm_->latest.load(std::memory_order_acquire);
+      for (const auto i : {newest, 1 - newest})
+        if (read(shm_->copies[i], s))
+          return s;
+    }
+    return std::nullopt;
+  }
+
+  // The latest complete zone states, as read() does. Nothing if none
+  // settle or they were mirrored for another number of zones.
+  std::optional<std::vector<zone_state>> read_zones(unsigned tries = 1000) const {
+    if (shm_->zone_capacity != zones_)
+      return std::nullopt;
+    std::vector<zone_state> states;
+    for (unsigned t = 0; t < tries; ++t) {
+      const auto newest = shm_->zones_latest.load(std::memory_order_acquire);
+      for (const auto i : {newest, 1 - newest}) {
+        const auto &c     = shm_->zone_copies[i];
+        const auto before = c.seq.load(std::memory_order_acquire);
+        if (before & 1 || c.count > zones_)
+          continue;
+        states.assign(zone_states(i), zone_states(i) + c.count);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (c.seq.load(std::memory_order_relaxed) == before)
+          return states;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Blocks until the owner stops beating for 'timeout' or exits, then
+  // claims the outputs. Returns false if 'running' was cleared first.
+  bool wait_for_takeover(std::chrono::microseconds timeout, volatile std::sig_atomic_t &running) {
+    printf("  Standby on %s\n", name_.c_str());
+    const auto limit = std::chrono::nanoseconds(timeout).count();
+    while (running) {
+      const auto owner = shm_->owner.load();
+      const auto beat  = shm_->heartbeat_ns.load(std::memory_order_acquire);
+      const auto now   = monotonic_ns();
+      const bool gone  = owner <= 0 || (kill(owner, 0) != 0 && errno == ESRCH);
+      if (gone || now - beat > limit) {
+        previous_     = owner;
+        last_beat_ns_ = beat;
+        shm_->takeovers.fetch_add(1);
+        claim();
+        return true;
+      }
+      const timespec pause{0, 200'000};
+      nanosleep(&pause, nullptr);
+    }
+    return false;
+  }
+
+ private:
+  static bool read(const slot &c, snapshot &s) {
+    const auto before = c.seq.load(std::memory_order_acquire);
+    if (before & 1)
+      return false;
+    std::memcpy(&s, &c.state, sizeof(s));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return c.seq.load(std::memory_order_relaxed) == before;
+  }
+
+  zone_state *zone_states(uint32_t copy) const {
+    return reinterpret_cast<zone_state *>(reinterpret_cast<char *>(shm_) + sizeof(shared)) + copy * zones_;
+  }
+
+  bool fail(const char *what) {
+    printf("  Mirror %s: %s failed: %s\n", name_.c_str(), what, strerror(errno));
+    return false;
+  }
+
+  std::string name_;
+  shared *shm_{};
+  size_t size_{};
+  uint32_t zones_{};
+  int32_t previous_{};
+  int64_t last_beat_ns_{};
+};
+}  // namespace standby
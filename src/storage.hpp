@@ -0,0 +1,467 @@
+/**
+ * Log structured storage for everything persisted on the SD card.
+ *
+ * Records are appended to an aligned in-memory buffer and written out as
+ * whole blocks of large segment files, on a size or time threshold. Old
+ * segments are compacted by a background thread: the latest record of
+ * every key survives, everything else ages out beyond the retention size.
+ **/
+
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "checksum.hpp"
+
+namespace storage {
+static constexpr size_t block_size     = 4096;
+static constexpr char segment_magic[8] = {'L', 'C', 'S', 'E', 'G', '0', '0', '1'};
+
+// Journal and checkpoint records are keyed, only the latest per key is kept
+enum class kind : uint8_t { log = 1, history = 2, journal = 3, checkpoint = 4 };
+static constexpr uint8_t store_stats_key = 0xFF;
+
+struct record_header {
+  uint32_t checksum;  // Over the rest of the header and the payload
+  uint16_t size;      // Payload bytes, records are padded to 8 bytes
+  kind type;
+  uint8_t key;
+  int64_t time_ns;  // CLOCK_REALTIME
+};
+static_assert(sizeof(record_header) == 16);
+static constexpr size_t max_payload = UINT16_MAX;
+
+struct segment_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t id;
+  int64_t created_ns;
+};
+
+enum class sync_mode { none, fdatasync, direct };
+
+struct config {
+  std::string dir;
+  size_t segment_size{4 << 20};
+  size_t flush_bytes{256 << 10};
+  std::chrono::seconds flush_interval{60};
+  size_t retain_bytes{64 << 20};
+  sync_mode sync{sync_mode::fdatasync};
+};
+
+struct stats {
+  uint64_t logical_bytes{};   // Record bytes appended
+  uint64_t physical_bytes{};  // Bytes written to the device
+  uint64_t flushes{};
+  uint64_t compacted_segments{};
+  int64_t since_ns{};  // First use, carried over restarts by checkpoints
+
+  double write_amplification() const {
+    return logical_bytes ? double(physical_bytes) / logical_bytes : 0.0;
+  }
+  double bytes_per_day(int64_t now_ns) const {
+    const double days = double(now_ns - since_ns) / (86400.0 * 1e9);
+    return days > 0 ? physical_bytes / days : 0.0;
+  }
+};
+
+inline int64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1'000'000'000LL + ts.tv_nsec;
+}
+
+inline uint32_t record_checksum(const record_header &h, const void *payload) {
+  const auto crc = checksum::crc32(&h.size, sizeof(h) - sizeof(h.checksum));
+  return checksum::crc32(payload, h.size, crc);
+}
+
+// Visits valid records of a mapped segment until the first gap or torn record
+template <class Fn>
+void scan_segment(const char *data, size_t size, Fn &&fn) {
+  size_t at = block_size;
+  while (at + sizeof(record_header) <= size) {
+    record_header h;
+    std::memcpy(&h, data + at, sizeof(h));
+    if (h.size == 0 && h.checksum == 0)
+      return;
+    if (at + sizeof(h) + h.size > size ||
+        h.checksum != record_checksum(h, data + at + sizeof(h)))
+      return;
+    fn(h, std::string_view(data + at + sizeof(h), h.size), at);
+    at += (sizeof(h) + h.size + 7) & ~size_t(7);
+  }
+}
+
+class store {
+ public:
+  explicit store(config cfg) : cfg_{std::move(cfg)} {
+    cfg_.flush_bytes  = std::max(cfg_.flush_bytes, 2 * (max_payload + 1) + block_size);
+    cfg_.segment_size = std::max(cfg_.segment_size, 2 * cfg_.flush_bytes);
+    capacity_ = (cfg_.flush_bytes + 2 * block_size - 1) & ~(block_size - 1);
+    buf_ = static_cast<char *>(std::aligned_alloc(block_size, capacity_));
+    std::memset(buf_, 0, capacity_);
+  }
+
+  ~store() {
+    {
+      std::lock_guard lock(mu_);
+      stopping_ = true;
+      if (fd_ >= 0) {
+        checkpoint_locked();
+        flush_locked();
+        close(fd_);
+        fd_ = -1;
+      }
+    }
+    wake_.notify_all();
+    if (compactor_.joinable())
+      compactor_.join();
+    std::free(buf_);
+  }
+
+  store(const store &)            = delete;
+  store &operator=(const store &) = delete;
+
+  bool open() {
+    mkdir(cfg_.dir.c_str(), 0755);
+    DIR *dir = opendir(cfg_.dir.c_str());
+    if (!dir) {
+      fprintf(stderr, "  Store %s: %s\n", cfg_.dir.c_str(), strerror(errno));
+      return false;
+    }
+    std::vector<uint32_t> ids;
+    while (const dirent *e = readdir(dir)) {
+      unsigned id;
+      char tail;
+      if (sscanf(e->d_name, "seg-%08u.lcs%c", &id, &tail) == 1)
+        ids.push_back(id);
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard lock(mu_);
+    for (const auto id : ids)
+      recover(id);
+    if (stats_.since_ns == 0)
+      stats_.since_ns = now_ns();
+    next_id_ = ids.empty() ? 1 : ids.back() + 1;
+    if (!open_segment())
+      return false;
+
+    compactor_ = std::thread([this] { compact_loop(); });
+    return true;
+  }
+
+  bool append(kind type, uint8_t key, const void *data, size_t len) {
+    std::lock_guard lock(mu_);
+    return append_locked(type, key, now_ns(), data, len);
+  }
+
+  // Time based flush and stats checkpoint, call this periodically
+  void tick() {
+    std::lock_guard lock(mu_);
+    const auto now = std::chrono::steady_clock::now();
+    if (fd_ < 0 || now - last_flush_ < cfg_.flush_interval)
+      return;
+    checkpoint_locked();
+    flush_locked();
+  }
+
+  void flush() {
+    std::lock_guard lock(mu_);
+    flush_locked();
+  }
+
+  storage::stats stats() const {
+    std::lock_guard lock(mu_);
+    return stats_;
+  }
+
+  std::string segment_path(uint32_t id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%08u.lcs", id);
+    return cfg_.dir + name;
+  }
+
+  // Sealed segments first, the active one last
+  std::vector<uint32_t> segments() const {
+    std::lock_guard lock(mu_);
+    std::vector<uint32_t> ids;
+    for (const auto &s : sealed_)
+      ids.push_back(s.id);
+    ids.push_back(active_id_);
+    return ids;
+  }
+
+  // Visits every record of every segment on disk, oldest first
+  template <class Fn>
+  void for_each(Fn &&fn) const {
+    for (const auto id : segments())
+      map_segment(id, [&](const char *data, size_t size) {
+        scan_segment(data, size, [&](const record_header &h, std::string_view payload, size_t) {
+          fn(h, payload);
+        });
+      });
+  }
+
+ private:
+  struct location {
+    uint32_t segment;
+    size_t offset;
+  };
+  struct sealed_segment {
+    uint32_t id;
+    uint64_t size;
+  };
+
+  template <class Fn>
+  bool map_segment(uint32_t id, Fn &&fn) const {
+    const int fd = ::open(segment_path(id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    struct stat st {};
+    fstat(fd, &st);
+    void *p = st.st_size > 0
+                  ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                  : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    fn(static_cast<const char *>(p), size_t(st.st_size));
+    munmap(p, st.st_size);
+    return true;
+  }
+
+  void recover(uint32_t id) {
+    uint64_t size{};
+    map_segment(id, [&](const char *data, size_t len) {
+      size = len;
+      if (len < block_size || std::memcmp(data, segment_magic, 8) != 0)
+        return;
+      scan_segment(data, len, [&](const record_header &h, std::string_view payload, size_t at) {
+        if (h.type == kind::checkpoint && h.key == store_stats_key &&
+            payload.size() == sizeof(stats_))
+          std::memcpy(&stats_, payload.data(), sizeof(stats_));
+        if (keyed(h.type))
+          index_[index_key(h.type, h.key)] = {id, at};
+      });
+    });
+    sealed_.push_back({id, size});
+    total_bytes_ += size;
+  }
+
+  static bool keyed(kind type) {
+    return type == kind::journal || type == kind::checkpoint;
+  }
+  static uint16_t index_key(kind type, uint8_t key) {
+    return uint16_t(uint16_t(type) << 8 | key);
+  }
+
+  bool open_segment() {
+    active_id_        = next_id_++;
+    const auto path   = segment_path(active_id_);
+    const int flags   = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    fd_               = -1;
+    if (cfg_.sync == sync_mode::direct) {
+      fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+      if (fd_ < 0 && errno == EINVAL) {
+        fprintf(stderr, "  Store: no O_DIRECT on %s, using fdatasync\n", cfg_.dir.c_str());
+        cfg_.sync = sync_mode::fdatasync;
+      }
+    }
+    if (fd_ < 0)
+      fd_ = ::open(path.c_str(), flags, 0644);
+    if (fd_ < 0) {
+      fprintf(stderr, "  Store %s: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+
+    std::memset(buf_, 0, capacity_);
+    segment_header sh{};
+    std::memcpy(sh.magic, segment_magic, 8);
+    sh.version    = 1;
+    sh.id         = active_id_;
+    sh.created_ns = now_ns();
+    std::memcpy(buf_, &sh, sizeof(sh));
+    buf_off_     = 0;
+    buf_len_     = block_size;
+    flushed_len_ = 0;
+    last_flush_  = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  bool append_locked(kind type, uint8_t key, int64_t time_ns, const void *data, size_t len) {
+    if (fd_ < 0 || len > max_payload)
+      return false;
+    const size_t need = (sizeof(record_header) + len + 7) & ~size_t(7);
+
+    if (buf_off_ + buf_len_ + need > cfg_.segment_size)
+      seal_locked();
+    if (buf_len_ + need > capacity_)
+      flush_locked();
+
+    record_header h{};
+    h.size     = uint16_t(len);
+    h.type     = type;
+    h.key      = key;
+    h.time_ns  = time_ns;
+    h.checksum = record_checksum(h, data);
+    std::memcpy(buf_ + buf_len_, &h, sizeof(h));
+    std::memcpy(buf_ + buf_len_ + sizeof(h), data, len);
+    if (keyed(type))
+      index_[index_key(type, key)] = {active_id_, buf_off_ + buf_len_};
+    buf_len_ += need;
+    stats_.logical_bytes += sizeof(h) + len;
+
+    if (buf_len_ >= cfg_.flush_bytes)
+      flush_locked();
+    return true;
+  }
+
+  // Writes every block holding new data, the partial tail block stays
+  // buffered and is written again by the next flush
+  void flush_locked() {
+    if (fd_ < 0 || buf_len_ == flushed_len_)
+      return;
+    const size_t len = (buf_len_ + block_size - 1) & ~(block_size - 1);
+    std::memset(buf_ + buf_len_, 0, len - buf_len_);
+    if (pwrite(fd_, buf_, len, off_t(buf_off_)) != ssize_t(len))
+      fprintf(stderr, "  Store write failed: %s\n", strerror(errno));
+    if (cfg_.sync == sync_mode::fdatasync)
+      fdatasync(fd_);
+    stats_.physical_bytes += len;
+    ++stats_.flushes;
+
+    const size_t full = buf_len_ & ~(block_size - 1);
+    std::memmove(buf_, buf_ + full, buf_len_ - full);
+    buf_off_ += full;
+    buf_len_ -= full;
+    flushed_len_ = buf_len_;
+    last_flush_  = std::chrono::steady_clock::now();
+  }
+
+  void seal_locked() {
+    flush_locked();
+    close(fd_);
+    const uint64_t size = buf_off_ + ((buf_len_ + block_size - 1) & ~(block_size - 1));
+    sealed_.push_back({active_id_, size});
+    total_bytes_ += size;
+    open_segment();
+    if (total_bytes_ > cfg_.retain_bytes)
+      wake_.notify_one();
+  }
+
+  void checkpoint_locked() {
+    storage::stats st = stats_;
+    append_locked(kind::checkpoint, store_stats_key, now_ns(), &st, sizeof(st));
+  }
+
+  void compact_loop() {
+    std::unique_lock lock(mu_);
+    while (true) {
+      wake_.wait(lock, [this] {
+        return stopping_ || (total_bytes_ > cfg_.retain_bytes && !sealed_.empty());
+      });
+      if (stopping_)
+        return;
+
+      const auto victim = sealed_.front();
+      lock.unlock();
+
+      // Sealed segments are immutable, read without holding the lock
+      std::vector<std::pair<record_header, std::string>> keep;
+      std::vector<size_t> offsets;
+      map_segment(victim.id, [&](const char *data, size_t size) {
+        scan_segment(data, size, [&](const record_header &h, std::string_view payload, size_t at) {
+          if (keyed(h.type)) {
+            keep.push_back({h, std::string(payload)});
+            offsets.push_back(at);
+          }
+        });
+      });
+
+      lock.lock();
+      if (stopping_)
+        return;
+      for (size_t i = 0; i < keep.size(); ++i) {
+        const auto &[h, payload] = keep[i];
+        const auto it            = index_.find(index_key(h.type, h.key));
+        // Superseded records are dropped, live ones move to the head
+        if (it != index_.end() && it->second.segment == victim.id &&
+            it->second.offset == offsets[i])
+          append_locked(h.type, h.key, h.time_ns, payload.data(), payload.size());
+      }
+      flush_locked();
+      unlink(segment_path(victim.id).c_str());
+      sealed_.pop_front();
+      total_bytes_ -= victim.size;
+      ++stats_.compacted_segments;
+    }
+  }
+
+  config cfg_;
+  char *buf_{};
+  size_t capacity_{};
+  size_t buf_off_{};  // File offset of buf_[0], block aligned
+  size_t buf_len_{};
+  size_t flushed_len_{};
+  int fd_{-1};
+  uint32_t active_id_{};
+  uint32_t next_id_{1};
+  std::chrono::steady_clock::time_point last_flush_;
+  std::deque<sealed_segment> sealed_;
+  uint64_t total_bytes_{};
+  std::map<uint16_t, location> index_;
+  storage::stats stats_;
+
+  mutable std::mutex mu_;
+  std::condition_variable wake_;
+  bool stopping_{false};
+  std::thread compactor_;
+};
+
+// Stream whose output is appended to 'store' as records of 'type', so
+// printf logging ends up in the batched segments. Output is also copied
+// to 'echo_fd' unless it is negative.
+inline FILE *open_stream(store &s, kind type, int echo_fd) {
+  struct cookie {
+    store *s;
+    kind type;
+    int echo_fd;
+  };
+  cookie_io_functions_t io{};
+  io.write = [](void *c, const char *buf, size_t size) -> ssize_t {
+    const auto *ck = static_cast<cookie *>(c);
+    for (size_t at = 0; at < size; at += max_payload)
+      ck->s->append(ck->type, 0, buf + at, std::min(max_payload, size - at));
+    if (ck->echo_fd >= 0 && write(ck->echo_fd, buf, size) < 0)
+      return -1;
+    return ssize_t(size);
+  };
+  io.close = [](void *c) -> int {
+    delete static_cast<cookie *>(c);
+    return 0;
+  };
+  return fopencookie(new cookie{&s, type, echo_fd}, "w", io);
+}
+}  // namespace storage
@@ -0,0 +1,139 @@
+/**
+ * Append throughput of the log structured store against per-line writes.
+ *
+ * Appends --records log lines of about 80 bytes to a storage::store in
+ * --dir with each sync mode, then reads them back. Reports records and
+ * megabytes per second, flushes and write amplification. The baseline is
+ * what the log did before the store: one write() per line, followed by
+ * fdatasync() every --sync-every lines. Point --dir at a tmpfs such as
+ * /dev/shm or at a mounted loop device to take the SD card out of the
+ * numbers. Every record must read back intact and in order.
+ *
+ *   store_bench [--dir=DIR] [--records=N] [--sync-every=N]
+ **/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "storage.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+static int64_t monotonic_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::string line(size_t i) {
+  char buf[96];
+  const int n =
+      snprintf(buf, sizeof(buf), "{\"time\":%zu,\"sm\":\"ctrl::fsm\",\"from\":\"ctrl::off\",\"to\":\"ctrl::on\"}\n", i);
+  return {buf, size_t(n)};
+}
+
+static void remove_segments(const std::string &dir) {
+  for (uint32_t id = 1; id < 4096; ++id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/seg-%08u.lcs", id);
+    remove((dir + name).c_str());
+  }
+  rmdir(dir.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  auto args        = std::vector<std::string>(argv, argv + argc);
+  const auto dir   = option(args, "dir").value_or(".");
+  const auto count = std::stoul(option(args, "records").value_or("200000"));
+  const auto every = std::max(1ul, std::stoul(option(args, "sync-every").value_or("1")));
+  bool failed      = false;
+
+  auto report = [&](const char *what, int64_t ns, size_t bytes, const char *extra) {
+    printf("  %-22s %9.0f records/s %7.1f MB/s %s\n", what, count / (ns / 1e9), bytes / (ns / 1e3), extra);
+  };
+
+  // Baseline, the log as it was written before the store
+  {
+    const auto path = dir + "/store_bench.log";
+    const int fd    = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      printf("  Opening %s failed\n", path.c_str());
+      return 1;
+    }
+    size_t bytes     = 0;
+    const auto start = monotonic_ns();
+    for (size_t i = 0; i < count; ++i) {
+      const auto l = line(i);
+      bytes += size_t(std::max<ssize_t>(0, write(fd, l.data(), l.size())));
+      if ((i + 1) % every == 0)
+        fdatasync(fd);
+    }
+    const auto ns = monotonic_ns() - start;
+    close(fd);
+    remove(path.c_str());
+    char extra[64];
+    snprintf(extra, sizeof(extra), "(write per line, fdatasync every %zu)", size_t(every));
+    report("per-line write", ns, bytes, extra);
+  }
+
+  using storage::sync_mode;
+  for (const auto mode : {sync_mode::none, sync_mode::fdatasync, sync_mode::direct}) {
+    const char *name = mode == sync_mode::none ? "none" : mode == sync_mode::fdatasync ? "fdatasync" : "direct";
+    const auto sub   = dir + "/store_bench." + name;
+    remove_segments(sub);
+    storage::config cfg;
+    cfg.dir  = sub;
+    cfg.sync = mode;
+    storage::stats st;
+    size_t bytes = 0;
+    int64_t ns   = 0;
+    {
+      storage::store s{cfg};
+      if (!s.open()) {
+        printf("  Opening the store in %s failed\n", sub.c_str());
+        return 1;
+      }
+      const auto start = monotonic_ns();
+      for (size_t i = 0; i < count; ++i) {
+        const auto l = line(i);
+        s.append(storage::kind::log, 0, l.data(), l.size());
+        bytes += l.size();
+      }
+      s.flush();
+      ns = monotonic_ns() - start;
+      st = s.stats();
+
+      size_t read = 0, wrong = 0;
+      s.for_each([&](const storage::record_header &h, std::string_view payload) {
+        if (h.type != storage::kind::log)
+          return;
+        wrong += payload != line(read);
+        ++read;
+      });
+      if (read != count || wrong) {
+        printf("  FAILED: %s read back %zu of %zu records, %zu wrong\n", name, read, size_t(count), wrong);
+        failed = true;
+      }
+    }
+    char extra[96];
+    snprintf(extra,
+             sizeof(extra),
+             "(%llu flushes, write amplification %.2f)",
+             (unsigned long long)st.flushes,
+             st.write_amplification());
+    report((std::string("store, sync ") + name).c_str(), ns, bytes, extra);
+    remove_segments(sub);
+  }
+  return failed ? 1 : 0;
+}
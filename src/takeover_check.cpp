@@ -0,0 +1,209 @@
+/**
+ * Failover gaps of a primary/standby pair under kill -9.
+ *
+ * Starts a primary with --mirror and a standby with --standby on the same
+ * name, kills the primary with SIGKILL and times how long the standby
+ * takes to restore the outputs and to answer HTTP. The standby then
+ * becomes the primary of the next round. Every successor must report the
+ * on_time given to the first primary. Before that, the mirror is checked
+ * directly: a publish cut short must leave the previous snapshot
+ * readable, and a read over torn copies must give up.
+ *
+ * Each controller runs --zones zones on a DMX file of its own. The first
+ * half of them are turned on from this minute, one on the short timeslot.
+ * After every takeover the successor's last frame must still show the
+ * first half on and the rest off, and so must GET /zones.
+ *
+ *   takeover_check CONTROLLER [--rounds=N] [--port=PORT] [--takeover-ms=MS] [--zones=N]
+ **/
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+#include "standby.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+// A publish that died halfway and a mirror torn beyond that
+static bool torn_writes(const std::string &name) {
+  standby::mirror m;
+  if (!m.open(name))
+    return false;
+  m.claim();
+  standby::snapshot s{};
+  snprintf(s.on_time, sizeof(s.on_time), "06:45");
+  m.publish(s);
+
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  void *p =
+      fd < 0 ? MAP_FAILED : mmap(nullptr, sizeof(standby::shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (p == MAP_FAILED)
+    return false;
+  auto *shm = static_cast<standby::shared *>(p);
+
+  bool ok = true;
+  shm->copies[1 - shm->latest.load()].seq.fetch_add(1);
+  const auto kept = m.read();
+  if (!kept || strcmp(kept->on_time, "06:45") != 0) {
+    printf("  FAILED: a publish cut short lost the previous snapshot\n");
+    ok = false;
+  }
+  shm->copies[shm->latest.load()].seq.fetch_add(1);
+  const auto start = harness::monotonic_ns();
+  if (m.read()) {
+    printf("  FAILED: read a snapshot from torn copies\n");
+    ok = false;
+  }
+  printf("  Torn mirror: previous snapshot %s, read over torn copies gave up after %.1f us\n",
+         kept ? "kept" : "lost",
+         (harness::monotonic_ns() - start) / 1e3);
+  munmap(p, sizeof(standby::shared));
+  shm_unlink(name.c_str());
+  return ok;
+}
+
+// The last frame a DMX universe wrote to 'path', start code first
+static std::vector<uint8_t> last_frame(const std::string &path, size_t channels) {
+  std::ifstream in(path, std::ios::binary);
+  const std::vector<uint8_t> all{std::istreambuf_iterator<char>(in), {}};
+  if (all.size() < channels + 1 || all.size() % (channels + 1))
+    return {};
+  return {all.end() - long(channels + 1), all.end()};
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: takeover_check CONTROLLER [--rounds=N] [--port=PORT] [--takeover-ms=MS] [--zones=N]\n");
+    return 1;
+  }
+  const auto rounds  = std::stoul(option(args, "rounds").value_or("10"));
+  const auto port    = uint16_t(std::stoul(option(args, "port").value_or("18320")));
+  const auto timeout = option(args, "takeover-ms").value_or("5");
+  const auto zones   = std::max(2ul, std::stoul(option(args, "zones").value_or("16")));
+  const auto name    = "/takeover_check." + std::to_string(getpid());
+  bool failed        = !torn_writes(name + ".torn");
+
+  // Every controller writes a DMX file of its own, its last frame is what
+  // that controller left the zones at
+  std::vector<std::string> dmx;
+  auto start = [&](const char *role) {
+    dmx.push_back("takeover_check." + std::to_string(dmx.size()) + ".dmx");
+    std::ofstream{dmx.back(), std::ios::trunc};
+    auto c = std::make_unique<harness::child>();
+    c->start({args[1],
+              "07:00",
+              "--http=" + std::to_string(port),
+              "--" + std::string(role) + "=" + name,
+              "--takeover-ms=" + timeout,
+              "--zones=" + std::to_string(zones),
+              "--outputs=dmx:" + dmx.back() + ":" + std::to_string(zones)},
+             "takeover_check.log");
+    return c;
+  };
+  const auto now = std::time(nullptr);
+  std::tm local{};
+  localtime_r(&now, &local);
+  char batch[48];
+  std::string events;
+  for (size_t z = 0; z < zones / 2; ++z) {
+    snprintf(batch, sizeof(batch), "%zu turn_on %02d:%02d\n", z, local.tm_hour, local.tm_min);
+    events += batch;
+  }
+  events += "1 change_on_time\n";
+
+  auto primary = start("mirror");
+  if (!harness::wait_http(port, std::chrono::seconds(10)) ||
+      !harness::request(port, "PUT", "/schedule", "{\"on_time\":\"06:45\"}") ||
+      !harness::request(port, "POST", "/zones/events", events)) {
+    printf("  The primary did not come up, see takeover_check.log\n");
+    return 1;
+  }
+
+  std::vector<double> gaps, answers;
+  for (size_t r = 0; r < rounds && !failed; ++r) {
+    auto standby = start("standby");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // A primary slowed past --takeover-ms, e.g. by the standby starting on
+    // the same core, is replaced before it is killed
+    const auto before = harness::request(port, "GET", "/standby");
+    if (!before || before->find("\"owner\":true") == std::string::npos) {
+      printf("  FAILED: the standby took over a live primary in round %zu, raise --takeover-ms\n", r);
+      failed = true;
+      break;
+    }
+
+    // Reaped at once, a zombie would still look alive to the standby
+    const auto killed = harness::monotonic_ns();
+    primary->signal(SIGKILL);
+    primary->wait(std::chrono::seconds(5));
+    if (!harness::wait_http(port, std::chrono::seconds(10))) {
+      printf("  FAILED: the standby did not take over in round %zu\n", r);
+      failed = true;
+      break;
+    }
+    answers.push_back((harness::monotonic_ns() - killed) / 1e6);
+    const auto mirror = harness::request(port, "GET", "/standby");
+    const auto status = harness::request(port, "GET", "/status");
+    gaps.push_back(mirror ? harness::number(*mirror, "last_gap_us").value_or(-1) / 1e3 : -1);
+    if (!status || harness::text(*status, "on_time") != "06:45") {
+      printf("  FAILED: round %zu lost the on_time: %s\n", r, status ? status->c_str() : "no status");
+      failed = true;
+    }
+
+    // A few passes later the zones must still be where they were
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    const auto frame = last_frame(dmx.back(), zones);
+    const auto on    = harness::request(port, "GET", "/zones");
+    size_t wrong     = frame.empty() ? zones : 0;
+    for (size_t z = 0; z < zones && !frame.empty(); ++z)
+      wrong += frame[1 + z] != (z < zones / 2 ? 255 : 0);
+    if (wrong || !on || harness::number(*on, "on").value_or(-1) != double(zones / 2)) {
+      printf("  FAILED: round %zu left %zu of %zu zone outputs wrong, %s\n",
+             r,
+             wrong,
+             size_t(zones),
+             on ? on->c_str() : "no zones");
+      failed = true;
+    }
+    primary = std::move(standby);
+  }
+  primary.reset();
+  shm_unlink(name.c_str());
+  for (const auto &path : dmx)
+    remove(path.c_str());
+
+  auto summary = [](const char *what, std::vector<double> v) {
+    if (v.empty())
+      return;
+    std::sort(v.begin(), v.end());
+    printf("  %s: min %.2f ms, median %.2f ms, max %.2f ms\n", what, v.front(), v[v.size() / 2], v.back());
+  };
+  printf("  %zu takeovers under kill -9, --takeover-ms=%s, %zu zones\n",
+         gaps.size(),
+         timeout.c_str(),
+         size_t(zones));
+  summary("Last heartbeat to restored outputs", gaps);
+  summary("Kill to HTTP answered", answers);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * Start times that put the daily on-time of zones in the cheapest hours.
+ *
+ * The day is cut into slots of a price curve, 96 slots of 15 minutes
+ * usually. Every start on the slot grid is an option with the slots it
+ * keeps on and what those cost, worked out once per timeslot from the
+ * schedule's day profile. Zones come in groups, one per circuit, each
+ * with a limit on the zones on in any slot. A group is solved greedily:
+ * longest timeslots first, every zone takes its cheapest option that
+ * fits under the limit. Where that leaves zones out, the cheap hours
+ * filled up unevenly, and the group is repaired: zones packed back to
+ * back around the day level the load, then move one at a time to the
+ * cheapest option that still fits. Zones that fit nowhere stay where
+ * they are and still load their slots, a group they push over its limit
+ * is reported. Groups share nothing and are solved in parallel.
+ *
+ *   tariff::problem p{prices, 15, kinds, kind_of, 500, 300};
+ *   const auto plan = tariff::solve(p);
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "forecast.hpp"
+
+namespace tariff {
+static constexpr size_t max_slots = 128;
+static constexpr uint8_t no_kind  = UINT8_MAX;
+
+// One bit per slot of the day
+struct slots {
+  uint64_t w[max_slots / 64]{};
+
+  bool test(size_t s) const { return w[s / 64] >> (s % 64) & 1; }
+  void set(size_t s) { w[s / 64] |= uint64_t(1) << (s % 64); }
+  void clear(size_t s) { w[s / 64] &= ~(uint64_t(1) << (s % 64)); }
+  bool meets(const slots &o) const { return (w[0] & o.w[0]) | (w[1] & o.w[1]); }
+  size_t count() const { return size_t(__builtin_popcountll(w[0]) + __builtin_popcountll(w[1])); }
+};
+
+// A start minute, the slots a zone starting then is on in and the cost
+// of its on-time, price times hours
+struct option {
+  uint16_t start;
+  double cost;
+  slots on;
+};
+
+// The options of one timeslot, cheapest first
+using kind = std::vector<option>;
+
+// Option of a schedule with day profile 'p' under 'prices'
+inline option make_option(const forecast::profile &p, uint16_t start, std::span<const double> prices,
+                          unsigned slot_minutes) {
+  option o{start, 0, {}};
+  for (size_t e = 0; e < p.size(); ++e) {
+    if (!p[e].on)
+      continue;
+    const unsigned from = p[e].minute;
+    const unsigned to   = e + 1 < p.size() ? p[e + 1].minute : 24 * 60;
+    for (unsigned m = from; m < to;) {
+      const auto s   = std::min<size_t>(m / slot_minutes, prices.size() - 1);
+      const auto end = std::min<unsigned>(to, unsigned(s + 1) * slot_minutes);
+      o.cost += prices[s] * (end - m) / 60.0;
+      o.on.set(s);
+      m = std::max(end, m + 1);
+    }
+  }
+  return o;
+}
+
+inline void sort_kind(kind &k) {
+  std::stable_sort(k.begin(), k.end(), [](const option &a, const option &b) { return a.cost < b.cost; });
+}
+
+struct problem {
+  std::vector<double> prices;  // Per slot
+  unsigned slot_minutes{15};
+  std::vector<kind> kinds;
+  std::vector<uint8_t> kind_of;  // Per zone, no_kind leaves a zone alone
+  std::vector<option> current;   // Per zone, where it is now, if planned
+  size_t group{1000};            // Consecutive zones sharing a limit
+  uint32_t limit{UINT32_MAX};    // Zones on in one slot, per group
+  unsigned threads{0};           // 0 for one per core
+};
+
+struct plan {
+  static constexpr int32_t kept = -1;
+
+  std::vector<int32_t> start;  // Per zone, minute of the day or kept
+  double cost{};
+  size_t placed{};
+  size_t repaired{};    // Placed by moving another zone
+  size_t unplaced{};    // Nothing fits under the limit, left as they were
+  uint32_t peak{};      // Most zones of a group on in one slot, unplaced ones included
+  size_t over_limit{};  // Groups the unplaced zones keep over the limit
+  uint64_t solve_us{};
+};
+
+namespace detail {
+class group_solver {
+ public:
+  group_solver(const problem &p, size_t first, size_t last)
+      : p_{p}, first_{first}, load_(p.prices.size()), chosen_(last - first), by_start_(p.kinds.size()) {
+    for (size_t k = 0; k < p.kinds.size(); ++k) {
+      by_start_[k].assign(load_.size(), nullptr);
+      for (const auto &o : p.kinds[k])
+        by_start_[k][std::min<size_t>(o.start / p.slot_minutes, load_.size() - 1)] = &o;
+    }
+    // Longest timeslots first, they are the hardest to fit
+    for (size_t z = first; z < last; ++z)
+      if (p.kind_of[z] < p.kinds.size() && !p.kinds[p.kind_of[z]].empty())
+        order_.push_back(uint32_t(z));
+    std::stable_sort(order_.begin(), order_.end(), [&](uint32_t a, uint32_t b) {
+      return length(a) > length(b);
+    });
+    if (!p.limit)
+      for (size_t s = 0; s < load_.size(); ++s)
+        full_.set(s);
+  }
+
+  // Every zone takes its cheapest option that fits
+  void greedy() {
+    for (const auto z : order_)
+      if (const auto *o = fits(z))
+        place(z, o);
+  }
+
+  // Zones packed back to back around the day, which levels the load to
+  // within one zone of even, whatever fits after that anywhere
+  void spread() {
+    size_t at = 0;
+    for (const auto z : order_) {
+      const auto *o = by_start_[p_.kind_of[z]][at];
+      if (!o || o->on.meets(full_))
+        o = fits(z);
+      if (o)
+        place(z, o);
+      at = (at + length(z)) % load_.size();
+    }
+  }
+
+  // Moves zones to cheaper options that fit until none is left, zones
+  // without one get another chance as others move
+  void improve() {
+    for (size_t pass = 0; pass < 16; ++pass) {
+      bool moved = false;
+      for (const auto z : order_) {
+        const auto *had = chosen_[z - first_];
+        if (had)
+          add(*had, -1);
+        const auto *o = fits(z);
+        if (o && (!had || o->cost < had->cost)) {
+          moved |= o != had;
+          place(z, o);
+        } else if (had) {
+          place(z, had);
+        }
+      }
+      if (!moved)
+        return;
+    }
+  }
+
+  size_t unplaced() const {
+    size_t n = 0;
+    for (const auto z : order_)
+      n += !chosen_[z - first_];
+    return n;
+  }
+
+  // Zones left out stay where they are, on the slots they are on now
+  void keep_unplaced() {
+    for (const auto z : order_)
+      if (!chosen_[z - first_] && z < p_.current.size()) {
+        add(p_.current[z], 1);
+        kept_cost_ += p_.current[z].cost;
+      }
+  }
+
+  double cost() const {
+    double c = kept_cost_;
+    for (const auto z : order_)
+      c += chosen_[z - first_] ? chosen_[z - first_]->cost : 0;
+    return c;
+  }
+
+  uint32_t peak() const { return load_.empty() ? 0 : *std::max_element(load_.begin(), load_.end()); }
+
+  void write(std::vector<int32_t> &start) const {
+    for (const auto z : order_)
+      if (const auto *o = chosen_[z - first_])
+        start[z] = o->start;
+  }
+
+ private:
+  size_t length(uint32_t z) const { return p_.kinds[p_.kind_of[z]].front().on.count(); }
+
+  const option *fits(uint32_t z) const {
+    for (const auto &o : p_.kinds[p_.kind_of[z]])
+      if (!o.on.meets(full_))
+        return &o;
+    return nullptr;
+  }
+
+  void place(uint32_t z, const option *o) {
+    add(*o, 1);
+    chosen_[z - first_] = o;
+  }
+
+  void add(const option &o, int sign) {
+    for (size_t s = 0; s < load_.size(); ++s) {
+      if (!o.on.test(s))
+        continue;
+      load_[s] += uint32_t(sign);
+      if (load_[s] >= p_.limit)
+        full_.set(s);
+      else
+        full_.clear(s);
+    }
+  }
+
+  const problem &p_;
+  size_t first_;
+  std::vector<uint32_t> load_;
+  slots full_;  // Slots at the limit
+  std::vector<const option *> chosen_;
+  std::vector<std::vector<const option *>> by_start_;  // Per kind and slot
+  std::vector<uint32_t> order_;
+  double kept_cost_{};
+};
+
+struct group_result {
+  double cost{};
+  size_t placed{}, repaired{}, unplaced{};
+  uint32_t peak{};
+};
+
+// Greedy, and where that leaves zones out the repaired spread if it
+// places more of them or the same for less
+inline group_result solve_group(const problem &p, size_t first, size_t last, std::vector<int32_t> &start) {
+  group_solver greedy{p, first, last};
+  greedy.greedy();
+  const auto left = greedy.unplaced();
+  group_solver *best = &greedy;
+
+  group_solver repair{p, first, last};
+  if (left) {
+    repair.spread();
+    repair.improve();
+    if (repair.unplaced() < left || (repair.unplaced() == left && repair.cost() < greedy.cost()))
+      best = &repair;
+  }
+
+  best->write(start);
+  group_result r;
+  r.unplaced = best->unplaced();
+  best->keep_unplaced();
+  r.cost     = best->cost();
+  r.repaired = left - r.unplaced;
+  r.peak     = best->peak();
+  for (size_t z = first; z < last; ++z)
+    r.placed += start[z] != plan::kept;
+  return r;
+}
+}  // namespace detail
+
+// Solves the groups on 'threads' threads, every zone of a kind is planned
+inline plan solve(const problem &p) {
+  const auto t0 = std::chrono::steady_clock::now();
+  plan out;
+  out.start.assign(p.kind_of.size(), plan::kept);
+  const size_t group  = std::max<size_t>(1, p.group);
+  const size_t groups = (p.kind_of.size() + group - 1) / group;
+  std::vector<detail::group_result> results(groups);
+
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t g; (g = next.fetch_add(1)) < groups;)
+      results[g] = detail::solve_group(p, g * group, std::min(p.kind_of.size(), (g + 1) * group), out.start);
+  };
+  const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  const auto threads = std::min(groups, p.threads ? size_t(p.threads) : cores);
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool)
+    t.join();
+
+  for (const auto &r : results) {
+    out.cost += r.cost;
+    out.placed += r.placed;
+    out.repaired += r.repaired;
+    out.unplaced += r.unplaced;
+    out.peak = std::max(out.peak, r.peak);
+    out.over_limit += r.peak > p.limit;
+  }
+  out.solve_us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - t0)
+                              .count());
+  return out;
+}
+}  // namespace tariff
@@ -0,0 +1,118 @@
+/**
+ * Solve time of the tariff planner for 10k zones.
+ *
+ * Puts --zones zones on random start minutes and timeslots, as in
+ * POST /tariff/plan, and plans them against a day of 96 quarter-hour
+ * prices with an evening peak, in circuits of --group zones with at most
+ * --limit of them on at once. Solves once on one thread and once on
+ * every core. The load each plan puts on every slot is counted again
+ * here, from the chosen starts and the zones left as they were, and must
+ * match the reported peak and circuits over the limit. Fails when a
+ * solve takes longer than --max-ms.
+ *
+ *   tariff_bench [--zones=N] [--group=N] [--limit=N] [--max-ms=MS] [--seed=N]
+ **/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "forecast.hpp"
+#include "tariff.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+// scheduled_on() of the controller, 18:00 long and 12:00 short timeslots
+static forecast::profile profile(uint16_t start, bool short_slot) {
+  const auto stop = uint16_t((start + (short_slot ? 12 : 18) * 60) % 1440);
+  auto on         = [&](int64_t m) { return stop < start ? start <= m || m < stop : start <= m && m < stop; };
+  return forecast::make_profile(on, {start, uint16_t(start + 1), stop, uint16_t(stop + 1)});
+}
+
+int main(int argc, char *argv[]) {
+  auto args         = std::vector<std::string>(argv, argv + argc);
+  const auto zones  = std::stoul(option(args, "zones").value_or("10000"));
+  const auto group  = std::stoul(option(args, "group").value_or("1000"));
+  const auto limit  = uint32_t(std::stoul(option(args, "limit").value_or("700")));
+  const auto max_ms = std::stod(option(args, "max-ms").value_or("1000"));
+  std::mt19937_64 rng{std::stoul(option(args, "seed").value_or("1"))};
+
+  tariff::problem p;
+  for (size_t s = 0; s < 96; ++s)
+    p.prices.push_back(0.10 + 0.25 * std::exp(-std::pow((s / 4.0 - 19) / 2.5, 2)) + 0.05 * (s / 4 >= 7));
+  p.slot_minutes = 15;
+  p.group        = group;
+  p.limit        = limit;
+  p.kinds.resize(2);
+  for (uint8_t slot = 0; slot < 2; ++slot) {
+    for (size_t s = 0; s < p.prices.size(); ++s)
+      p.kinds[slot].push_back(tariff::make_option(profile(uint16_t(s * 15), slot), uint16_t(s * 15), p.prices, 15));
+    tariff::sort_kind(p.kinds[slot]);
+  }
+  double baseline = 0;
+  for (size_t z = 0; z < zones; ++z) {
+    const auto start = uint16_t(rng() % 1440);
+    const bool slot  = rng() % 2;
+    p.kind_of.push_back(slot);
+    p.current.push_back(tariff::make_option(profile(start, slot), start, p.prices, 15));
+    baseline += p.current.back().cost;
+  }
+
+  bool failed = false;
+  for (const unsigned threads : {1u, 0u}) {
+    p.threads       = threads;
+    const auto plan = tariff::solve(p);
+
+    // Load of every slot per circuit, from the plan as the zones take it
+    uint32_t peak = 0;
+    size_t over   = 0;
+    for (size_t first = 0; first < zones; first += group) {
+      std::vector<uint32_t> load(p.prices.size());
+      for (size_t z = first; z < std::min<size_t>(zones, first + group); ++z) {
+        const auto &kind        = p.kinds[p.kind_of[z]];
+        const tariff::option *o = &p.current[z];
+        if (plan.start[z] != tariff::plan::kept)
+          for (const auto &k : kind)
+            if (k.start == plan.start[z])
+              o = &k;
+        for (size_t s = 0; s < load.size(); ++s)
+          load[s] += o->on.test(s);
+      }
+      const auto most = *std::max_element(load.begin(), load.end());
+      peak            = std::max(peak, most);
+      over += most > limit;
+    }
+    printf("  %zu zones, circuits of %zu, limit %u, %s: %.1f ms, placed %zu, unplaced %zu, peak %u, "
+           "%zu circuits over, cost %.0f of %.0f\n",
+           size_t(zones),
+           size_t(group),
+           limit,
+           threads == 1 ? "one thread" : "every core",
+           plan.solve_us / 1000.0,
+           plan.placed,
+           plan.unplaced,
+           plan.peak,
+           plan.over_limit,
+           plan.cost,
+           baseline);
+    if (peak != plan.peak || over != plan.over_limit) {
+      printf("  FAILED: the plan puts a peak of %u on the circuits and %zu over the limit\n", peak, over);
+      failed = true;
+    }
+    if (plan.solve_us / 1000.0 > max_ms) {
+      printf("  FAILED: the solve took longer than %.0f ms\n", max_ms);
+      failed = true;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,615 @@
+/**
+ * Summarizes flight recorder files and store segments, scanning them in
+ * parallel on every core.
+ *
+ *   trace_analyze FILE|DIR... [--threads=N] [--slow-us=US] [--flap-ms=MS]
+ *                             [--anomalies=N]
+ *
+ * A flight recorder file gives, per fsm event, the time until the fsm
+ * changed state and until the next output change, the time from an
+ * input edge to the next output change and the transition counts. A
+ * store directory, its segments or a --history file give the history's
+ * transition counts and how long each state lasted. Each argument, a
+ * site, is reported on its own, then all of them together.
+ *
+ * Anomalies are torn records, time running backwards, events slower
+ * than --slow-us and outputs or states flipping back within --flap-ms.
+ **/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "recorder.hpp"
+#include "storage.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+// Log-linear buckets, 16 per power of two, percentiles are within 6%
+struct histogram {
+  static constexpr size_t sub     = 16;
+  static constexpr size_t buckets = 61 * sub;
+
+  std::array<uint64_t, buckets> count{};
+  uint64_t total{};
+  uint64_t max{};
+
+  static size_t index(uint64_t v) {
+    if (v < sub)
+      return v;
+    const int e = 63 - __builtin_clzll(v);
+    return (e - 3) * sub + (v >> (e - 4) & (sub - 1));
+  }
+  static uint64_t upper(size_t i) {
+    if (i < sub)
+      return i;
+    const int shift = int(i / sub) - 1;
+    return ((sub + i % sub) << shift) + (uint64_t(1) << shift) - 1;
+  }
+
+  void add(uint64_t v) {
+    ++count[index(v)];
+    ++total;
+    max = std::max(max, v);
+  }
+  void merge(const histogram &o) {
+    for (size_t i = 0; i < buckets; ++i)
+      count[i] += o.count[i];
+    total += o.total;
+    max = std::max(max, o.max);
+  }
+  uint64_t percentile(double q) const {
+    uint64_t seen{};
+    for (size_t i = 0; i < buckets; ++i) {
+      seen += count[i];
+      if (seen && seen >= q * total)
+        return std::min(upper(i), max);
+    }
+    return max;
+  }
+};
+
+struct config {
+  uint64_t slow_ns{10'000'000};
+  uint64_t flap_ns{1'000'000'000};
+  size_t anomalies{20};
+};
+
+// Last transition of a state machine in a history
+struct edge {
+  int64_t time_ns;
+  std::string state;
+};
+
+struct summary {
+  uint64_t bytes{};
+  uint64_t records{};
+  uint64_t torn{};
+  std::map<std::string, uint64_t> transitions;  // "sm from -> to"
+  std::map<std::string, histogram> handled;     // "sm event" to its transition
+  std::map<std::string, histogram> to_output;   // "sm event" to the next output change
+  std::map<std::string, histogram> dwell;       // "sm state", history only
+  histogram input_to_output;
+  std::vector<std::string> anomalies;
+  uint64_t anomaly_count{};
+  std::map<std::string, edge> first, last;  // Per sm, to join histories in order
+
+  // 'describe' only runs while the list has room
+  template <class Describe>
+  void anomaly(const config &cfg, Describe &&describe) {
+    if (anomalies.size() < cfg.anomalies)
+      anomalies.push_back(describe());
+    ++anomaly_count;
+  }
+
+  // Appends 'o', which follows this one in time
+  void merge(const config &cfg, summary &&o) {
+    bytes += o.bytes;
+    records += o.records;
+    torn += o.torn;
+    for (const auto &[k, n] : o.transitions)
+      transitions[k] += n;
+    using latencies = std::map<std::string, histogram> summary::*;
+    for (const latencies m : {&summary::handled, &summary::to_output, &summary::dwell})
+      for (const auto &[k, h] : o.*m)
+        (this->*m)[k].merge(h);
+    input_to_output.merge(o.input_to_output);
+    for (auto &[sm, e] : o.first) {
+      const auto it = last.find(sm);
+      if (it == last.end()) {
+        first.emplace(sm, e);
+        continue;
+      }
+      stay(cfg, sm, it->second, e.time_ns);
+    }
+    for (auto &[sm, e] : o.last)
+      last[sm] = e;
+    for (auto &a : o.anomalies)
+      anomaly(cfg, [&] { return std::move(a); });
+    anomaly_count += o.anomaly_count - o.anomalies.size();
+  }
+
+  // Records a history transition of 'sm'
+  void transition(const config &cfg, int64_t time_ns, const std::string &sm,
+                  const std::string &from, const std::string &to) {
+    ++records;
+    ++transitions[sm + " " + from + " -> " + to];
+    if (const auto it = last.find(sm); it != last.end())
+      stay(cfg, sm, it->second, time_ns);
+    else
+      first.emplace(sm, edge{time_ns, from});
+    last[sm] = {time_ns, to};
+  }
+
+ private:
+  void stay(const config &cfg, const std::string &sm, const edge &since, int64_t until_ns) {
+    const auto ns = uint64_t(std::max<int64_t>(0, until_ns - since.time_ns));
+    dwell[sm + " " + since.state].add(ns);
+    if (ns < cfg.flap_ns)
+      anomaly(cfg, [&] { return sm + " left " + since.state + " after " + std::to_string(ns / 1000) + "us"; });
+  }
+};
+
+// MAPPED FILES
+struct mapping {
+  const char *data{};
+  size_t size{};
+
+  bool open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      return false;
+    madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+    data = static_cast<const char *>(p);
+    size = size_t(st.st_size);
+    return true;
+  }
+  ~mapping() {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+  }
+};
+
+// FLIGHT RECORDER
+namespace flight {
+static constexpr size_t block = 256;
+
+const recorder::header *header_of(const mapping &m) {
+  if (m.size < recorder::file_size(0))
+    return nullptr;
+  const auto *h = reinterpret_cast<const recorder::header *>(m.data);
+  if (std::memcmp(h->magic, recorder::magic, sizeof(h->magic)) != 0 || h->version != recorder::version ||
+      h->record_size != sizeof(recorder::record) || m.size < recorder::file_size(h->capacity))
+    return nullptr;
+  return h;
+}
+
+// Ticks to CLOCK_MONOTONIC, relative to the block's first record. The
+// difference is biased into the 52-bit mantissa of 2^52 and read back
+// as a double, an integer to float conversion compilers vectorize.
+void decode(const uint64_t *ticks, size_t n, const recorder::header &h, double *ns) {
+  constexpr uint64_t bias     = uint64_t(1) << 51;
+  constexpr uint64_t mantissa = (uint64_t(1) << 52) - 1;
+  constexpr uint64_t exponent = 0x4330000000000000;  // 2^52
+  const double offset         = 0x1p52 + 0x1p51;
+  const double base           = double(recorder::record_ns(h, ticks[0]));
+  const double scale          = h.ns_per_tick;
+  const uint64_t first        = ticks[0];
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t bits = ((ticks[i] - first + bias) & mantissa) | exponent;
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    ns[i] = base + (d - offset) * scale;
+  }
+}
+
+// Few distinct keys per trace, the one hit last is tried first
+template <class T>
+struct by_key {
+  std::vector<uint32_t> keys;
+  std::vector<T> values;
+  size_t last{};
+
+  T &operator[](uint32_t key) {
+    if (last < keys.size() && keys[last] == key)
+      return values[last];
+    last = std::find(keys.begin(), keys.end(), key) - keys.begin();
+    if (last == keys.size()) {
+      keys.push_back(key);
+      values.emplace_back();
+    }
+    return values[last];
+  }
+};
+
+struct state_machine {
+  uint16_t event{};
+  double since{};
+  bool awaiting_transition{};
+  bool awaiting_output{};
+};
+
+// Summarizes records [begin, end). Events and inputs still waiting at
+// 'end' are followed up to 'limit', the next chunk ignores them.
+summary scan(const mapping &m, uint64_t begin, uint64_t end, uint64_t limit, const config &cfg) {
+  const auto &h       = *header_of(m);
+  const auto *records = reinterpret_cast<const recorder::record *>(m.data + recorder::file_size(0));
+  const uint32_t names = std::min<uint32_t>(h.names.load(), recorder::max_names);
+  auto name            = [&](uint16_t i) { return std::string(i < names ? h.name[i] : "?"); };
+
+  std::array<state_machine, recorder::max_names> sms{};
+  by_key<uint64_t> transitions;
+  by_key<histogram> handled, to_output;
+  std::vector<double> last_output(size_t(UINT16_MAX) + 1, -1e300);  // Per pin
+  size_t awaiting_outputs = 0;
+  bool awaiting_input     = false;
+  double input_since      = 0;
+  double previous         = 0;
+
+  summary s;
+  auto wall = [&](double ns) { return int64_t(ns) + h.wall_offset_ns; };
+  auto when = [&](double ns) {
+    const time_t secs = wall(ns) / 1'000'000'000;
+    char text[32];
+    strftime(text, sizeof(text), "%F %T", localtime(&secs));
+    return std::string(text);
+  };
+
+  uint64_t ticks[block];
+  double ns[block];
+  bool valid[block];
+  const recorder::record *at[block];
+  for (uint64_t seq = begin; seq < limit;) {
+    // Past 'end' only while something waits for its follow-up
+    if (seq >= end && !awaiting_input && !awaiting_outputs &&
+        std::none_of(sms.begin(), sms.end(), [](const auto &sm) { return sm.awaiting_transition; }))
+      break;
+    const size_t n = size_t(std::min<uint64_t>(block, limit - seq));
+    for (size_t i = 0; i < n; ++i) {
+      at[i]    = &records[(seq + i) & (h.capacity - 1)];
+      valid[i] = at[i]->seq.load(std::memory_order_relaxed) == seq + i + 1;
+      ticks[i] = at[i]->ticks;
+    }
+    decode(ticks, n, h, ns);
+
+    for (size_t i = 0; i < n; ++i, ++seq) {
+      const bool counted = seq < end;
+      if (!valid[i]) {
+        s.torn += counted;
+        continue;
+      }
+      const auto &r = *at[i];
+      if (counted) {
+        ++s.records;
+        if (previous - ns[i] > 1e6)
+          s.anomaly(cfg, [&] {
+            return when(ns[i]) + " record " + std::to_string(seq) + " is " +
+                   std::to_string(int64_t(previous - ns[i]) / 1000) + "us older than the one before";
+          });
+      }
+      previous = ns[i];
+
+      switch (r.kind) {
+        case recorder::EVENT: {
+          if (!counted)
+            break;
+          auto &sm = sms[r.a % recorder::max_names];
+          awaiting_outputs += !sm.awaiting_output;
+          sm = {r.b, ns[i], true, true};
+          break;
+        }
+        case recorder::TRANSITION: {
+          auto &sm = sms[r.a % recorder::max_names];
+          if (counted)
+            ++transitions[uint32_t(r.a) << 16 | uint32_t(r.b) << 8 | r.c];
+          if (!sm.awaiting_transition)
+            break;
+          sm.awaiting_transition = false;
+          const auto latency     = uint64_t(std::max(0.0, ns[i] - sm.since));
+          handled[uint32_t(r.a) << 16 | sm.event].add(latency);
+          if (latency > cfg.slow_ns)
+            s.anomaly(cfg, [&] {
+              return when(ns[i]) + " " + name(r.a) + " took " + std::to_string(latency / 1000) + "us to handle " +
+                     name(sm.event);
+            });
+          break;
+        }
+        case recorder::INPUT:
+          if (counted) {
+            awaiting_input = true;
+            input_since    = ns[i];
+          }
+          break;
+        case recorder::OUTPUT: {
+          if (awaiting_input) {
+            s.input_to_output.add(uint64_t(std::max(0.0, ns[i] - input_since)));
+            awaiting_input = false;
+          }
+          for (size_t k = 0; awaiting_outputs && k < sms.size(); ++k) {
+            auto &sm = sms[k];
+            if (!sm.awaiting_output)
+              continue;
+            sm.awaiting_output = false;
+            --awaiting_outputs;
+            to_output[uint32_t(k) << 16 | sm.event].add(uint64_t(std::max(0.0, ns[i] - sm.since)));
+          }
+          if (!counted)
+            break;
+          auto &since = last_output[r.b];
+          if (ns[i] - since < double(cfg.flap_ns))
+            s.anomaly(cfg, [&] {
+              return when(ns[i]) + " output " + name(r.a) + " (" + std::to_string(r.b) + ") flipped back after " +
+                     std::to_string(int64_t(ns[i] - since) / 1000) + "us";
+            });
+          since = ns[i];
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < transitions.keys.size(); ++i) {
+    const auto k = transitions.keys[i];
+    s.transitions[name(k >> 16) + " " + name(k >> 8 & 0xff) + " -> " + name(k & 0xff)] += transitions.values[i];
+  }
+  for (auto *latencies : {&handled, &to_output})
+    for (size_t i = 0; i < latencies->keys.size(); ++i) {
+      const auto k = latencies->keys[i];
+      (latencies == &handled ? s.handled : s.to_output)[name(k >> 16) + " " + name(k & 0xffff)].merge(
+          latencies->values[i]);
+    }
+  return s;
+}
+}  // namespace flight
+
+// HISTORY
+namespace history {
+// Value of a member of a flat JSON object, 'key' is quoted with its colon
+std::string_view field(std::string_view json, std::string_view key) {
+  const auto at = json.find(key);
+  if (at == std::string_view::npos)
+    return {};
+  auto rest = json.substr(at + key.size());
+  if (!rest.empty() && rest[0] == '"') {
+    rest.remove_prefix(1);
+    return rest.substr(0, rest.find('"'));
+  }
+  return rest.substr(0, rest.find_first_of(",}"));
+}
+
+void line(summary &s, const config &cfg, std::string_view json, std::optional<int64_t> time_ns) {
+  const auto sm = field(json, "\"sm\":"), from = field(json, "\"from\":"), to = field(json, "\"to\":");
+  if (sm.empty() || from.empty() || to.empty())
+    return;
+  if (!time_ns)
+    time_ns = std::atoll(std::string(field(json, "\"time\":")).c_str()) * 1'000'000'000LL;
+  s.transition(cfg, *time_ns, std::string(sm), std::string(from), std::string(to));
+}
+
+summary segment(const mapping &m, const config &cfg) {
+  summary s;
+  storage::scan_segment(m.data, m.size, [&](const storage::record_header &h, std::string_view payload, size_t) {
+    if (h.type == storage::kind::history)
+      line(s, cfg, payload, h.time_ns);
+  });
+  return s;
+}
+
+// One object per line, as written by --history
+summary lines(const mapping &m, const config &cfg) {
+  summary s;
+  std::string_view text(m.data, m.size);
+  while (!text.empty()) {
+    const auto eol = text.find('\n');
+    line(s, cfg, text.substr(0, eol), std::nullopt);
+    text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+  }
+  return s;
+}
+}  // namespace history
+
+// REPORT
+static std::string duration(uint64_t ns) {
+  char text[32];
+  if (ns < 10'000)
+    snprintf(text, sizeof(text), "%lluns", (unsigned long long)ns);
+  else if (ns < 10'000'000)
+    snprintf(text, sizeof(text), "%.1fus", ns / 1e3);
+  else if (ns < 10'000'000'000)
+    snprintf(text, sizeof(text), "%.1fms", ns / 1e6);
+  else
+    snprintf(text, sizeof(text), "%.1fs", ns / 1e9);
+  return text;
+}
+
+static void print_latencies(const char *title, const std::map<std::string, histogram> &latencies) {
+  if (latencies.empty())
+    return;
+  printf("    %-44s %10s %10s %10s %10s %10s\n", title, "count", "p50", "p90", "p99", "max");
+  for (const auto &[key, h] : latencies)
+    printf("    %-44s %10llu %10s %10s %10s %10s\n",
+           key.c_str(),
+           (unsigned long long)h.total,
+           duration(h.percentile(0.50)).c_str(),
+           duration(h.percentile(0.90)).c_str(),
+           duration(h.percentile(0.99)).c_str(),
+           duration(h.max).c_str());
+}
+
+static void print(const std::string &site, const summary &s) {
+  printf("  %s: %llu records, %llu torn, %.1f MB\n",
+         site.c_str(),
+         (unsigned long long)s.records,
+         (unsigned long long)s.torn,
+         s.bytes / 1e6);
+  print_latencies("event to transition", s.handled);
+  print_latencies("event to output", s.to_output);
+  if (s.input_to_output.total)
+    print_latencies("", {{"input to output", s.input_to_output}});
+  print_latencies("time in state", s.dwell);
+  if (!s.transitions.empty()) {
+    printf("    transitions\n");
+    for (const auto &[key, n] : s.transitions)
+      printf("    %-44s %10llu\n", key.c_str(), (unsigned long long)n);
+  }
+  if (s.anomaly_count) {
+    printf("    anomalies: %llu\n", (unsigned long long)s.anomaly_count);
+    for (const auto &a : s.anomalies)
+      printf("      %s\n", a.c_str());
+  }
+}
+
+// WORK
+struct work {
+  size_t site;
+  std::shared_ptr<mapping> file;
+  enum { FLIGHT, SEGMENT, LINES } type;
+  uint64_t begin, end, limit;  // Records of a flight recorder file
+};
+
+static bool add_file(std::vector<work> &items, size_t site, const std::string &path) {
+  auto m = std::make_shared<mapping>();
+  if (!m->open(path)) {
+    printf("  %s: cannot map\n", path.c_str());
+    return false;
+  }
+  if (const auto *h = flight::header_of(*m)) {
+    // Chunks of 32 MB
+    constexpr uint64_t chunk = 1 << 20;
+    const uint64_t head      = h->head.load();
+    const uint64_t first     = head > h->capacity ? head - h->capacity : 0;
+    for (uint64_t b = first; b < head; b += chunk)
+      items.push_back({site, m, work::FLIGHT, b, std::min(head, b + chunk), head});
+  } else if (m->size >= storage::block_size && std::memcmp(m->data, storage::segment_magic, 8) == 0) {
+    items.push_back({site, m, work::SEGMENT, 0, 0, 0});
+  } else {
+    items.push_back({site, m, work::LINES, 0, 0, 0});
+  }
+  return true;
+}
+
+// A store directory's segments, oldest first
+static bool add_dir(std::vector<work> &items, size_t site, const std::string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return false;
+  std::vector<std::pair<unsigned, std::string>> segments;
+  while (const auto *e = readdir(dir)) {
+    unsigned id;
+    char tail;
+    if (sscanf(e->d_name, "seg-%08u.lcs%c", &id, &tail) == 1)
+      segments.emplace_back(id, path + "/" + e->d_name);
+  }
+  closedir(dir);
+  std::sort(segments.begin(), segments.end());
+  for (const auto &[id, file] : segments)
+    add_file(items, site, file);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  std::vector<std::string> sites;
+  for (size_t i = 1; i < args.size(); ++i)
+    if (args[i].rfind("--", 0) != 0)
+      sites.push_back(args[i]);
+  if (sites.empty()) {
+    printf("Usage: trace_analyze FILE|DIR... [--threads=N] [--slow-us=US] [--flap-ms=MS] [--anomalies=N]\n");
+    return 1;
+  }
+  config cfg;
+  if (const auto us = option(args, "slow-us"))
+    cfg.slow_ns = std::stoull(*us) * 1000;
+  if (const auto ms = option(args, "flap-ms"))
+    cfg.flap_ns = std::stoull(*ms) * 1'000'000;
+  if (const auto n = option(args, "anomalies"))
+    cfg.anomalies = std::stoul(*n);
+  const unsigned threads = option(args, "threads") ? std::stoul(*option(args, "threads"))
+                                                   : std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<work> items;
+  for (size_t site = 0; site < sites.size(); ++site) {
+    struct stat st {};
+    if (stat(sites[site].c_str(), &st) == 0 && S_ISDIR(st.st_mode) ? !add_dir(items, site, sites[site])
+                                                                     : !add_file(items, site, sites[site]))
+      return 1;
+  }
+
+  // Items are taken in order by whichever thread is free, results are
+  // joined in order afterwards
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<summary> results(items.size());
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < std::min<size_t>(threads, items.size()); ++t)
+    pool.emplace_back([&] {
+      for (size_t i; (i = next.fetch_add(1)) < items.size();) {
+        const auto &w = items[i];
+        if (w.type == work::FLIGHT) {
+          results[i]       = flight::scan(*w.file, w.begin, w.end, w.limit, cfg);
+          results[i].bytes = (w.end - w.begin) * sizeof(recorder::record);
+        } else {
+          results[i]       = w.type == work::SEGMENT ? history::segment(*w.file, cfg) : history::lines(*w.file, cfg);
+          results[i].bytes = w.file->size;
+        }
+      }
+    });
+  for (auto &t : pool)
+    t.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t bytes = 0;
+  std::vector<summary> per_site(sites.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    bytes += results[i].bytes;
+    per_site[items[i].site].merge(cfg, std::move(results[i]));
+  }
+  // Sites are not joined in time, each one's histories end with it
+  summary all;
+  for (size_t site = 0; site < sites.size(); ++site) {
+    print(sites[site], per_site[site]);
+    per_site[site].first.clear();
+    per_site[site].last.clear();
+    all.merge(cfg, std::move(per_site[site]));
+  }
+  if (sites.size() > 1)
+    print("all sites", all);
+  printf("  Scanned %.1f MB in %.1fms on %zu threads, %.2f GB/s\n",
+         bytes / 1e6,
+         seconds * 1e3,
+         pool.size(),
+         bytes / seconds / 1e9);
+  return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * In-place upgrade: the running process execs the binary now on disk.
+ *
+ * Before exec the controller writes its fsm state, schedule, output
+ * shadow and zone states into an image in a memfd. The memfd and the
+ * HTTP listening socket stay open across exec, the new process finds
+ * the image through --upgrade-fd=N and restores from it before it
+ * touches an output. Outputs are never released in between: the pin
+ * and bus latches keep their levels while no process drives them, and
+ * the new process writes the same levels back first.
+ *
+ *   kill -USR2 $(pidof light_controller)
+ *   curl -X POST localhost:8080/upgrade
+ **/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "standby.hpp"
+
+namespace upgrade {
+static constexpr char magic[8]    = {'L', 'C', 'U', 'P', 'G', 'R', 'D', '1'};
+static constexpr uint32_t version = 1;
+
+using zone_state = standby::zone_state;
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t zones;
+  int32_t http_fd;  // Listening socket, -1 without one
+  uint32_t reserved;
+  int64_t exec_ns;  // standby::monotonic_ns() right before exec
+  standby::snapshot state;
+};
+
+struct image {
+  standby::snapshot state{};
+  int http_fd{-1};
+  int64_t exec_ns{};
+  std::vector<zone_state> zones;
+};
+
+inline bool write_all(int fd, const void *data, size_t len) {
+  const auto *p = static_cast<const char *>(data);
+  while (len) {
+    const ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= size_t(n);
+  }
+  return true;
+}
+
+inline bool read_all(int fd, void *data, size_t len) {
+  auto *p = static_cast<char *>(data);
+  while (len) {
+    const ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= size_t(n);
+  }
+  return true;
+}
+
+// Writes 'img' into a memfd that survives exec, -1 on failure
+inline int save(const image &img) {
+  const int fd = memfd_create("light_controller-upgrade", 0);
+  if (fd < 0) {
+    printf("  Upgrade memfd_create failed: %s\n", strerror(errno));
+    return -1;
+  }
+  header h{};
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.zones   = uint32_t(img.zones.size());
+  h.http_fd = img.http_fd;
+  h.exec_ns = img.exec_ns;
+  h.state   = img.state;
+  if (!write_all(fd, &h, sizeof(h)) ||
+      !write_all(fd, img.zones.data(), img.zones.size() * sizeof(zone_state)) ||
+      lseek(fd, 0, SEEK_SET) != 0) {
+    printf("  Upgrade image write failed: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Reads and closes the image handed over in 'fd'
+inline std::optional<image> load(int fd) {
+  header h;
+  image img;
+  bool ok = read_all(fd, &h, sizeof(h)) && std::memcmp(h.magic, magic, sizeof(magic)) == 0 &&
+            h.version == version;
+  if (ok) {
+    img.zones.resize(h.zones);
+    ok = read_all(fd, img.zones.data(), img.zones.size() * sizeof(zone_state));
+  }
+  close(fd);
+  if (!ok) {
+    printf("  Upgrade image in fd %d unreadable, starting fresh\n", fd);
+    return std::nullopt;
+  }
+  img.state   = h.state;
+  img.http_fd = h.http_fd;
+  img.exec_ns = h.exec_ns;
+  return img;
+}
+
+// The binary to exec, taken at startup: once a new build replaces the
+// file, /proc/self/exe names the old, deleted one
+inline std::string self_path() {
+  char path[4096];
+  const ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (n <= 0)
+    return {};
+  std::string s(path, size_t(n));
+  constexpr std::string_view deleted = " (deleted)";
+  if (s.size() > deleted.size() && s.compare(s.size() - deleted.size(), deleted.size(), deleted) == 0)
+    s.resize(s.size() - deleted.size());
+  return s;
+}
+
+// Execs 'exe' with 'args' plus --upgrade-fd, keeping 'image_fd' and
+// 'inherit' open. Only returns if exec failed, with everything closed
+// or back to close-on-exec.
+inline void exec(const std::string &exe, std::vector<std::string> args, int image_fd,
+                 const std::vector<int> &inherit) {
+  constexpr std::string_view flag = "--upgrade-fd=";
+  std::erase_if(args, [&](const std::string &a) { return a.compare(0, flag.size(), flag) == 0; });
+  args.push_back(std::string(flag) + std::to_string(image_fd));
+
+  std::vector<char *> argv;
+  for (auto &a : args)
+    argv.push_back(a.data());
+  argv.push_back(nullptr);
+
+  for (const int fd : inherit)
+    fcntl(fd, F_SETFD, 0);
+  fflush(nullptr);
+  execv(exe.c_str(), argv.data());
+
+  printf("  Upgrade exec of %s failed: %s\n", exe.c_str(), strerror(errno));
+  for (const int fd : inherit)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  close(image_fd);
+}
+}  // namespace upgrade
@@ -0,0 +1,146 @@
+/**
+ * Checks that outputs never flicker across in-place upgrades.
+ *
+ * Runs the controller with a DMX universe written into a FIFO, so every
+ * frame any process sends is seen in order. Once the zones settle, the
+ * controller is upgraded again and again, by SIGUSR2 and POST /upgrade
+ * in turn, while requests keep arriving. Every frame from then on must
+ * equal the settled one, every request must be answered, and the light,
+ * the schedule and the zones must be as before.
+ *
+ *   upgrade_check CONTROLLER [--upgrades=N] [--port=PORT] [--dir=DIR]
+ **/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+static std::optional<std::string> option(const std::vector<std::string> &args, const std::string &name) {
+  const auto prefix = "--" + name + "=";
+  for (const auto &arg : args)
+    if (arg.rfind(prefix, 0) == 0)
+      return arg.substr(prefix.size());
+  return std::nullopt;
+}
+
+int main(int argc, char *argv[]) {
+  auto args = std::vector<std::string>(argv, argv + argc);
+  if (args.size() < 2) {
+    printf("Usage: upgrade_check CONTROLLER [--upgrades=N] [--port=PORT] [--dir=DIR]\n");
+    return 1;
+  }
+  const auto upgrades = std::stoul(option(args, "upgrades").value_or("6"));
+  const auto port     = uint16_t(std::stoul(option(args, "port").value_or("18330")));
+  const auto fifo     = option(args, "dir").value_or(".") + "/upgrade_check.dmx";
+  const size_t zones  = 16;
+
+  // Opened before the controller, whose blocking open waits for a reader
+  remove(fifo.c_str());
+  const int bus = mkfifo(fifo.c_str(), 0600) == 0 ? open(fifo.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC) : -1;
+  if (bus < 0) {
+    printf("  Making the FIFO %s failed\n", fifo.c_str());
+    return 1;
+  }
+  std::vector<std::string> frames;
+  std::string pending;
+  auto drain = [&] {
+    char buf[4096];
+    for (ssize_t n; (n = read(bus, buf, sizeof(buf))) > 0;)
+      pending.append(buf, size_t(n));
+    for (; pending.size() >= zones + 1; pending.erase(0, zones + 1))
+      frames.push_back(pending.substr(0, zones + 1));
+  };
+
+  harness::child lc;
+  if (!lc.start({args[1],
+                 "07:00",
+                 "--http=" + std::to_string(port),
+                 "--zones=" + std::to_string(zones),
+                 "--outputs=dmx:" + fifo + ":" + std::to_string(zones)},
+                "upgrade_check.log") ||
+      !harness::wait_http(port, std::chrono::seconds(10))) {
+    printf("  The controller did not come up, see upgrade_check.log\n");
+    return 1;
+  }
+
+  // Nine zones on from this minute, one of them on the short slot, and
+  // one off on the short slot
+  const auto now = time(nullptr);
+  tm local{};
+  localtime_r(&now, &local);
+  std::string batch;
+  for (size_t z = 0; z < 9; ++z) {
+    char line[48];
+    snprintf(line, sizeof(line), "%zu turn_on %02d:%02d\n", z, local.tm_hour, local.tm_min);
+    batch += line;
+  }
+  batch += "4 change_on_time\n12 turn_on 07:00\n12 change_on_time\n12 turn_off\n";
+  if (!harness::request(port, "POST", "/zones/events", batch) ||
+      !harness::request(port, "PUT", "/schedule", "{\"on_time\":\"06:45\",\"timeslot\":\"SHORT\"}")) {
+    printf("  Setting up the zones failed\n");
+    return 1;
+  }
+  auto zones_on = [&]() -> std::optional<double> {
+    const auto res = harness::request(port, "GET", "/zones");
+    return res ? harness::number(*res, "on") : std::nullopt;
+  };
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  drain();
+  if (frames.empty()) {
+    printf("  No frame reached the bus\n");
+    return 1;
+  }
+  const auto settled     = frames.back();
+  const auto zones_then  = zones_on();
+  const auto status_then = harness::request(port, "GET", "/status");
+  frames.clear();
+
+  size_t requests{}, failed_requests{};
+  for (size_t u = 0; u < upgrades; ++u) {
+    if (u % 2)
+      harness::request(port, "POST", "/upgrade");
+    else
+      lc.signal(SIGUSR2);
+    // Requests land in the exec gap and after it
+    const auto until = harness::monotonic_ns() + 300'000'000;
+    while (harness::monotonic_ns() < until) {
+      ++requests;
+      failed_requests += !harness::request(port, "GET", "/status");
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+  drain();
+
+  size_t flickers{};
+  for (const auto &f : frames)
+    flickers += f != settled;
+  const auto zones_now  = zones_on();
+  const auto status_now = harness::request(port, "GET", "/status");
+  const bool same       = zones_then && zones_then == zones_now && status_then && status_then == status_now;
+
+  printf("  %zu upgrades, %zu frames on the bus, %zu differed from the settled one\n",
+         upgrades,
+         frames.size(),
+         flickers);
+  printf("  %zu of %zu requests answered, status %s\n",
+         requests - failed_requests,
+         requests,
+         status_now ? status_now->c_str() : "missing");
+  close(bus);
+  remove(fifo.c_str());
+  if (flickers || failed_requests || !same || lc.wait(std::chrono::milliseconds(0)) >= 0) {
+    printf("  FAILED%s\n", same ? "" : ": the zones or the status changed");
+    return 1;
+  }
+  return 0;
+}
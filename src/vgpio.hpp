@@ -0,0 +1,300 @@
+/**
+ * Virtual GPIO chip in userspace, for exercising the GPIO paths without
+ * hardware.
+ *
+ * The chip runs on its own thread and is reached like a character device:
+ * requests and replies go over one socketpair, edge events with their
+ * timestamps over another. External drivers, such as the gpio_storm tool,
+ * connect to a Unix socket and drive input lines or watch output lines.
+ * When the consumer falls behind, edge events are dropped and counted,
+ * as with a full kernel event FIFO.
+ **/
+
+#pragma once
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gpio.hpp"
+
+namespace vgpio {
+static constexpr size_t lines = 64;
+
+enum op : uint8_t {
+  REQUEST_INPUT,
+  REQUEST_OUTPUT,
+  GET,
+  SET,
+  VALUE,  // Reply to the above
+  EVENT,  // Edge on an input, or a change of a watched output
+  DRIVE,  // Driver sets the level of an input line
+  WATCH,  // Driver subscribes to output changes
+  ERROR,
+};
+
+struct message {
+  uint8_t op;
+  uint8_t line;
+  uint8_t value;
+  uint8_t reserved;
+  uint32_t seq;
+  uint64_t time_ns;  // CLOCK_MONOTONIC when the level changed
+};
+
+inline uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+inline int seqpacket_socket() { return socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0); }
+
+inline sockaddr_un unix_address(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+class chip {
+ public:
+  chip() {
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, control_);
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, events_);
+    stop_ = eventfd(0, EFD_CLOEXEC);
+  }
+  ~chip() {
+    if (thread_.joinable()) {
+      const uint64_t one = 1;
+      if (write(stop_, &one, sizeof(one)) == sizeof(one))
+        thread_.join();
+      else
+        thread_.detach();
+    }
+    for (const int fd : {control_[0], control_[1], events_[0], events_[1], stop_, listen_fd_})
+      if (fd >= 0)
+        close(fd);
+    for (const auto &d : drivers_)
+      close(d.fd);
+    if (!path_.empty())
+      unlink(path_.c_str());
+  }
+
+  // Drivers connect on 'path', the chip thread starts serving
+  bool start(const std::string &path) {
+    listen_fd_ = seqpacket_socket();
+    auto addr  = unix_address(path);
+    unlink(path.c_str());
+    if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd_, 8) != 0) {
+      printf("  Virtual gpiochip on %s failed: %s\n", path.c_str(), strerror(errno));
+      return false;
+    }
+    path_   = path;
+    thread_ = std::thread([this] { serve(); });
+    printf("  Virtual gpiochip, drivers connect on %s\n", path.c_str());
+    return true;
+  }
+
+  // Consumer side, the equivalents of the chip and line request fds
+  int control_fd() const { return control_[0]; }
+  int event_fd() const { return events_[0]; }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct line {
+    bool requested;
+    bool output;
+    bool value;
+  };
+  struct driver {
+    int fd;
+    bool watching;
+  };
+
+  void serve() {
+    std::vector<pollfd> fds;
+    for (;;) {
+      fds.clear();
+      fds.push_back({stop_, POLLIN, 0});
+      fds.push_back({control_[1], POLLIN, 0});
+      fds.push_back({listen_fd_, POLLIN, 0});
+      for (const auto &d : drivers_)
+        fds.push_back({d.fd, POLLIN, 0});
+      if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+        return;
+      if (fds[0].revents)
+        return;
+      if (fds[1].revents & POLLIN)
+        consumer();
+      if (fds[2].revents & POLLIN) {
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0)
+          drivers_.push_back({fd, false});
+      }
+      // Back to front, a driver may be removed while serving
+      for (size_t i = fds.size(); i-- > 3;)
+        if (fds[i].revents)
+          from_driver(i - 3);
+    }
+  }
+
+  void consumer() {
+    message m;
+    if (recv(control_[1], &m, sizeof(m), 0) != sizeof(m))
+      return;
+    message reply{VALUE, m.line, 0, 0, m.seq, monotonic_ns()};
+    if (m.line >= lines) {
+      reply.op = ERROR;
+    } else {
+      auto &l = lines_[m.line];
+      switch (m.op) {
+        case REQUEST_INPUT:
+        case REQUEST_OUTPUT:
+          l = {true, m.op == REQUEST_OUTPUT, l.value};
+          break;
+        case SET:
+          if (!l.output) {
+            reply.op = ERROR;
+          } else if (l.value != bool(m.value)) {
+            l.value = m.value;
+            notify_watchers({EVENT, m.line, m.value, 0, m.seq, reply.time_ns});
+          }
+          break;
+        case GET:
+          break;
+        default:
+          reply.op = ERROR;
+      }
+      reply.value = l.value;
+    }
+    send(control_[1], &reply, sizeof(reply), MSG_NOSIGNAL);
+  }
+
+  void from_driver(size_t i) {
+    message m;
+    if (recv(drivers_[i].fd, &m, sizeof(m), MSG_DONTWAIT) != sizeof(m)) {
+      close(drivers_[i].fd);
+      drivers_.erase(drivers_.begin() + i);
+      return;
+    }
+    if (m.op == WATCH) {
+      drivers_[i].watching = true;
+      return;
+    }
+    if (m.op != DRIVE || m.line >= lines)
+      return;
+    auto &l = lines_[m.line];
+    if (l.output || l.value == bool(m.value))
+      return;
+    l.value = m.value;
+    if (!l.requested)
+      return;
+    const message event{EVENT, m.line, m.value, 0, m.seq, monotonic_ns()};
+    if (send(events_[1], &event, sizeof(event), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(event))
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void notify_watchers(const message &m) {
+    for (const auto &d : drivers_)
+      if (d.watching)
+        send(d.fd, &m, sizeof(m), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+
+  int control_[2]{-1, -1};
+  int events_[2]{-1, -1};
+  int stop_{-1};
+  int listen_fd_{-1};
+  std::string path_;
+  line lines_[lines]{};
+  std::vector<driver> drivers_;
+  std::atomic<uint64_t> dropped_{};
+  std::thread thread_;
+};
+
+struct io_stats {
+  uint64_t requests{};
+  uint64_t round_trip_ns{};  // Total, over all requests
+  uint64_t max_round_trip_ns{};
+  uint64_t events{};
+  uint64_t event_log2_ns[40]{};  // Edge timestamp to consumer read
+
+  uint64_t percentile_ns(double q) const {
+    uint64_t seen{};
+    for (size_t i = 0; i < 40; ++i) {
+      seen += event_log2_ns[i];
+      if (events && seen >= q * events)
+        return uint64_t(1) << i;
+    }
+    return 0;
+  }
+};
+
+// hw templates on top of the virtual chip, pins are line offsets. Round
+// trips are serialized, the light task thread writes concurrently. The
+// statistics are kept under the same lock, stats() returns a copy.
+class backend : public hw::gpio_backend {
+ public:
+  explicit backend(chip &c) : chip_{c} {}
+
+  void setup_input(int pin, bool) override { request(REQUEST_INPUT, pin, 0); }
+  void setup_output(int pin) override { request(REQUEST_OUTPUT, pin, 0); }
+  bool read(int pin) override { return request(GET, pin, 0); }
+  void write(int pin, bool level) override { request(SET, pin, level); }
+
+  // Reads pending edge events, returns how many there were
+  size_t drain() {
+    size_t n = 0;
+    message m;
+    while (recv(chip_.event_fd(), &m, sizeof(m), MSG_DONTWAIT) == sizeof(m)) {
+      const auto ns = monotonic_ns() - m.time_ns;
+      const std::lock_guard lock{mutex_};
+      ++stats_.event_log2_ns[std::min(39, 64 - __builtin_clzll(ns | 1))];
+      ++stats_.events;
+      ++n;
+    }
+    return n;
+  }
+
+  int event_fd() const { return chip_.event_fd(); }
+  uint64_t dropped() const { return chip_.dropped(); }
+  io_stats stats() const {
+    const std::lock_guard lock{mutex_};
+    return stats_;
+  }
+
+ private:
+  bool request(op o, int pin, bool value) {
+    const std::lock_guard lock{mutex_};
+    const auto start = monotonic_ns();
+    message m{o, uint8_t(pin), value, 0, ++seq_, 0};
+    if (send(chip_.control_fd(), &m, sizeof(m), MSG_NOSIGNAL) != sizeof(m) ||
+        recv(chip_.control_fd(), &m, sizeof(m), 0) != sizeof(m) || m.op == ERROR)
+      return false;
+    const auto ns = monotonic_ns() - start;
+    ++stats_.requests;
+    stats_.round_trip_ns += ns;
+    stats_.max_round_trip_ns = std::max(stats_.max_round_trip_ns, ns);
+    return m.value;
+  }
+
+  chip &chip_;
+  mutable std::mutex mutex_;
+  uint32_t seq_{};
+  io_stats stats_;
+};
+}  // namespace vgpio
@@ -0,0 +1,345 @@
+/**
+ * File backed zone state for warm restarts without parsing.
+ *
+ * The bit-sliced engine runs directly on a shared mapping of the file.
+ * Behind the header block sit three regions of identical layout: the
+ * live state and two checkpoints. Checkpoints alternate, each carries a
+ * generation and a CRC, so a torn write can only ever damage the copy
+ * being written. A clean shutdown seals the live region, the next start
+ * maps it and carries on; after a crash the newest intact checkpoint is
+ * copied over the live region first.
+ *
+ * Sections are found by id through an offset table relative to the
+ * region start. A file with another version or zone count is upgraded
+ * by copying every known section by id into a fresh layout.
+ **/
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include "bitslice.hpp"
+#include "checksum.hpp"
+
+namespace zonefile {
+static constexpr char magic[8]       = {'L', 'C', 'Z', 'O', 'N', 'E', 'S', '1'};
+static constexpr uint32_t version    = 1;
+static constexpr size_t block_size   = 4096;
+static constexpr size_t max_sections = 8;
+
+enum section_id : uint32_t { ON = 1, SHORT_SLOT = 2, START = 3, COUNTERS = 4 };
+
+struct section {
+  uint32_t id;
+  uint32_t reserved;
+  uint64_t offset;  // From the start of a region
+  uint64_t size;
+};
+
+struct checkpoint_slot {
+  uint64_t generation;
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t crc;  // Of the header with this field zeroed
+  uint64_t zones;
+  uint64_t region_size;
+  uint32_t sections;
+  uint32_t clean;  // Live region matches the newest checkpoint
+  checkpoint_slot slots[2];
+  section table[max_sections];
+};
+static_assert(sizeof(header) <= 512, "the header must fit one sector");
+
+enum class origin { fresh, clean, checkpoint, upgraded };
+
+inline const char *origin_name(origin o) {
+  switch (o) {
+    case origin::fresh:
+      return "fresh";
+    case origin::clean:
+      return "clean";
+    case origin::checkpoint:
+      return "checkpoint";
+    case origin::upgraded:
+      return "upgraded";
+  }
+  return "";
+}
+
+struct file_stats {
+  origin from{origin::fresh};
+  uint64_t open_us{};
+  uint64_t first_output_us{};  // From open() until outputs were committed
+  uint64_t checkpoints{};
+  uint64_t generation{};
+  uint64_t checkpoint_max_us{};
+};
+
+class mapped_zones {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  ~mapped_zones() { close(); }
+
+  bool open(const std::string &path, size_t zones) {
+    opened_ = clock::now();
+    path_   = path;
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return fail("open");
+
+    struct stat st {};
+    fstat(fd, &st);
+    header old{};
+    const bool readable = size_t(st.st_size) >= block_size &&
+                          pread(fd, &old, sizeof(old), 0) == ssize_t(sizeof(old));
+
+    bool ok;
+    if (!readable || !valid(old) || size_t(st.st_size) < file_size(old)) {
+      ok = create(fd, zones);
+    } else if (old.version == version && old.zones == zones) {
+      ok = map(fd, size_t(st.st_size));
+      if (ok)
+        stats_.from = recover();
+    } else {
+      ok = upgrade(fd, old, zones);
+    }
+    ::close(fd);
+    if (!ok) {
+      if (base_)
+        munmap(base_, size_);
+      base_ = nullptr;
+      return false;
+    }
+
+    hdr()->clean = 0;
+    seal();
+    stats_.open_us    = elapsed_us(opened_);
+    stats_.generation = newest().generation;
+    printf("  Zone file %s: %zu zones, %s in %lluus\n",
+           path.c_str(),
+           zones,
+           origin_name(stats_.from),
+           (unsigned long long)stats_.open_us);
+    return true;
+  }
+
+  // The engine must not outlive this object
+  bitslice::state state() {
+    const size_t words = (hdr()->zones + 63) / 64;
+    return {{reinterpret_cast<uint64_t *>(data(ON)), words},
+            {reinterpret_cast<uint64_t *>(data(SHORT_SLOT)), words},
+            {reinterpret_cast<uint16_t *>(data(START)), size_t(hdr()->zones)},
+            reinterpret_cast<bitslice::counters *>(data(COUNTERS))};
+  }
+
+  // Copies the live region over the older checkpoint
+  void checkpoint() {
+    if (!base_)
+      return;
+    const auto start = clock::now();
+    auto &h          = *hdr();
+    const int slot   = h.slots[0].generation <= h.slots[1].generation ? 0 : 1;
+    auto *copy       = region(1 + slot);
+    std::memcpy(copy, live(), h.region_size);
+    const auto crc = checksum::crc32(copy, h.region_size);
+    msync(copy, h.region_size, MS_SYNC);
+
+    h.slots[slot] = {newest().generation + 1, crc, 0};
+    seal();
+    ++stats_.checkpoints;
+    stats_.generation        = h.slots[slot].generation;
+    stats_.checkpoint_max_us = std::max(stats_.checkpoint_max_us, elapsed_us(start));
+  }
+
+  void output_committed() {
+    if (base_ && !stats_.first_output_us)
+      stats_.first_output_us = elapsed_us(opened_);
+  }
+
+  const file_stats &stats() const { return stats_; }
+
+  void close() {
+    if (!base_)
+      return;
+    checkpoint();
+    hdr()->clean = 1;
+    seal();
+    munmap(base_, size_);
+    base_ = nullptr;
+  }
+
+ private:
+  static uint64_t elapsed_us(clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - since).count();
+  }
+
+  static uint32_t header_crc(header h) {
+    h.crc = 0;
+    return checksum::crc32(&h, sizeof(h));
+  }
+
+  static bool valid(const header &h) {
+    return std::memcmp(h.magic, magic, sizeof(magic)) == 0 && h.crc == header_crc(h) &&
+           h.sections <= max_sections;
+  }
+
+  // Section offsets within one region, every section 8-byte aligned
+  static header layout(size_t zones) {
+    header h{};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version         = version;
+    h.zones           = zones;
+    const auto words  = (zones + 63) / 64;
+    const uint64_t sizes[] = {words * 8, words * 8, (zones * 2 + 7) / 8 * 8, sizeof(bitslice::counters)};
+    const section_id ids[] = {ON, SHORT_SLOT, START, COUNTERS};
+    uint64_t at            = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      h.table[i] = {ids[i], 0, at, sizes[i]};
+      at += sizes[i];
+    }
+    h.sections    = 4;
+    h.region_size = (at + block_size - 1) / block_size * block_size;
+    return h;
+  }
+
+  static size_t file_size(const header &h) { return block_size + 3 * h.region_size; }
+
+  bool fail(const char *what) {
+    printf("  Zone file %s: %s failed: %s\n", path_.c_str(), what, strerror(errno));
+    return false;
+  }
+
+  bool map(int fd, size_t size) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+      return fail("mmap");
+    base_ = static_cast<uint8_t *>(p);
+    size_ = size;
+    return size >= file_size(*hdr());
+  }
+
+  bool create(int fd, size_t zones) {
+    const auto h = layout(zones);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, off_t(file_size(h))) != 0)
+      return fail("ftruncate");
+    if (!map(fd, file_size(h)))
+      return false;
+    *hdr()      = h;
+    stats_.from = origin::fresh;
+    return true;
+  }
+
+  // Newest checkpoint with an intact copy, nothing if both are damaged
+  std::optional<int> newest_intact() {
+    const auto &h = *hdr();
+    std::optional<int> best;
+    for (int s = 0; s < 2; ++s) {
+      const auto &slot = h.slots[s];
+      if (!slot.generation || (best && h.slots[*best].generation > slot.generation))
+        continue;
+      if (checksum::crc32(region(1 + s), h.region_size) == slot.crc)
+        best = s;
+    }
+    return best;
+  }
+
+  const checkpoint_slot &newest() {
+    const auto &h = *hdr();
+    return h.slots[h.slots[0].generation >= h.slots[1].generation ? 0 : 1];
+  }
+
+  // Picks the live region after a clean stop, the newest intact
+  // checkpoint after a crash, and a zeroed state if nothing survived
+  origin recover() {
+    auto &h = *hdr();
+    if (h.clean && newest().generation &&
+        checksum::crc32(live(), h.region_size) == newest().crc)
+      return origin::clean;
+    if (const auto slot = newest_intact()) {
+      std::memcpy(live(), region(1 + *slot), h.region_size);
+      // A newer but torn checkpoint is the next one to overwrite
+      if (h.slots[1 - *slot].generation > h.slots[*slot].generation)
+        h.slots[1 - *slot] = {};
+      return origin::checkpoint;
+    }
+    std::memset(live(), 0, h.region_size);
+    return origin::fresh;
+  }
+
+  // Recovers from the old layout, then copies its sections by id
+  bool upgrade(int fd, const header &old, size_t zones) {
+    const int newest_slot = old.slots[0].generation >= old.slots[1].generation ? 0 : 1;
+    std::string saved(old.region_size, '\0');
+    auto load = [&](size_t region) {
+      const off_t at = off_t(block_size + region * old.region_size);
+      return pread(fd, saved.data(), saved.size(), at) == ssize_t(saved.size());
+    };
+    auto intact = [&](int slot) {
+      return old.slots[slot].generation && load(1 + slot) &&
+             checksum::crc32(saved.data(), saved.size()) == old.slots[slot].crc;
+    };
+    const bool clean = old.clean && old.slots[newest_slot].generation && load(0) &&
+                       checksum::crc32(saved.data(), saved.size()) == old.slots[newest_slot].crc;
+    if (!clean && !intact(newest_slot) && !intact(1 - newest_slot))
+      return create(fd, zones);
+
+    if (!create(fd, zones))
+      return false;
+    for (size_t j = 0; j < old.sections; ++j) {
+      const auto &from = old.table[j];
+      if (from.offset + from.size > old.region_size)
+        continue;
+      if (auto *to = find(from.id))
+        std::memcpy(live() + to->offset, saved.data() + from.offset, std::min(to->size, from.size));
+    }
+
+    // Bits of zones beyond a shrunk zone count must not linger
+    if (zones % 64)
+      for (const auto id : {ON, SHORT_SLOT})
+        reinterpret_cast<uint64_t *>(data(id))[zones / 64] &= (uint64_t(1) << (zones % 64)) - 1;
+    stats_.from = origin::upgraded;
+    return true;
+  }
+
+  const section *find(uint32_t id) {
+    for (size_t i = 0; i < hdr()->sections; ++i)
+      if (hdr()->table[i].id == id)
+        return &hdr()->table[i];
+    return nullptr;
+  }
+  uint8_t *data(section_id id) { return live() + find(id)->offset; }
+
+  void seal() {
+    hdr()->crc = header_crc(*hdr());
+    msync(base_, block_size, MS_SYNC);
+  }
+
+  header *hdr() { return reinterpret_cast<header *>(base_); }
+  uint8_t *region(size_t i) { return base_ + block_size + i * hdr()->region_size; }
+  uint8_t *live() { return region(0); }
+
+  std::string path_;
+  uint8_t *base_{};
+  size_t size_{};
+  clock::time_point opened_;
+  file_stats stats_;
+};
+}  // namespace zonefile